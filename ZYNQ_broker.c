@@ -0,0 +1,566 @@
+/**********************************************************
+ *
+ *  Register broker.
+ *
+ *  A broker process owns the mappings of a device and
+ *  serves register calls from other processes through a
+ *  shared memory ring.  Clients claim a slot with a CAS,
+ *  publish the request and wait for the response on the
+ *  slot's sequence number, spinning first and sleeping on
+ *  a futex only when the other side is slow.  The broker
+ *  is the only writer of the registers, so test mode
+ *  strobes of different clients never interleave.
+ *
+ *  Clients select BACKEND_BROKER, every other call keeps
+ *  its signature.
+ *
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "ZYNQ_private.h"
+#include "include/ZYNQ_broker.h"
+
+#define BROKER_MAGIC     (0x4b52425a)	/* "ZBRK" little endian */
+#define BROKER_VERSION   (3)
+/* Ring size, a power of 2 of at least 3 */
+#define BROKER_SLOTS     (64)
+#define BROKER_MAX_GPIO  (32)
+/* Polls of a slot before sleeping on its futex, when there is a CPU to spin on */
+#define BROKER_SPINS     (20000)
+/* Longest futex sleep, bounds the stop and liveness checks */
+#define BROKER_WAIT_NS   (100000000)
+/* Futex sleeps a claimed slot gets to name its client before the broker takes it back */
+#define BROKER_CLAIM_WAITS (10)
+/* Yields on a full ring between checks for a dead broker or client */
+#define BROKER_FULL_YIELDS (1024)
+
+typedef struct {
+	/* pos: free for the client at pos, pos + 1: request, pos + 2: response */
+	uint32_t seq;
+	/* Client asleep on seq */
+	uint32_t waiting;
+	/* Position claimed << 32 | pid of its client, set with one CAS, pid 0 once taken back */
+	uint64_t owner;
+	uint32_t op;
+	uint32_t offset;
+	uint32_t arg;
+	uint32_t data[MAX_CHANS];
+	int32_t rv;
+} __attribute__((aligned(64))) _broker_slot_t;
+
+struct _broker_shm {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t pid;
+	uint32_t opmode;
+	uint32_t num_gpio;
+	uint32_t chan_mask[BROKER_MAX_GPIO];
+	/* Next position claimed by a client */
+	uint32_t tail __attribute__((aligned(64)));
+	/* Broker asleep on the seq of its next slot */
+	uint32_t sleeping __attribute__((aligned(64)));
+	_broker_slot_t slot[BROKER_SLOTS];
+};
+
+/* BROKER_SPINS, or 0 on a single CPU where spinning only delays the other side */
+static int _spins = -1;
+
+typedef int (*_bits_fn_t)(zynq_dev_t *dev, uint32_t offset, uint32_t channel, uint32_t mask);
+
+/* Indexed by tri, then BITS_SET/BITS_CLEAR/BITS_TOGGLE */
+static const _bits_fn_t _broker_bits[2][3] = {
+	{ zynq_dev_set_bits,     zynq_dev_clear_bits,     zynq_dev_toggle_bits },
+	{ zynq_dev_set_tri_bits, zynq_dev_clear_tri_bits, zynq_dev_toggle_tri_bits },
+};
+
+static void _futex_wait(uint32_t *addr, uint32_t val)
+{
+	struct timespec ts = { 0, BROKER_WAIT_NS };
+
+	syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+static void _futex_wake(uint32_t *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/*
+ * Wait for *seq to reach want, spinning and then sleeping with *sleeping
+ * set so the other side knows to wake us.  Returns 0 after a timeout.
+ */
+static int _seq_wait(uint32_t *seq, uint32_t want, uint32_t *sleeping)
+{
+	uint32_t cur;
+	int i;
+
+	for (i = 0; i < _spins; i++)
+	{
+		if (__atomic_load_n(seq, __ATOMIC_ACQUIRE) == want)
+		{
+			return 1;
+		}
+	}
+
+	__atomic_store_n(sleeping, 1, __ATOMIC_SEQ_CST);
+
+	if ( (cur = __atomic_load_n(seq, __ATOMIC_SEQ_CST)) != want)
+	{
+		_futex_wait(seq, cur);
+	}
+
+	__atomic_store_n(sleeping, 0, __ATOMIC_RELAXED);
+
+	return __atomic_load_n(seq, __ATOMIC_ACQUIRE) == want;
+}
+
+/* Publish a new seq and wake the other side if it went to sleep */
+static void _seq_post(uint32_t *seq, uint32_t val, uint32_t *sleeping)
+{
+	__atomic_store_n(seq, val, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(sleeping, __ATOMIC_SEQ_CST))
+	{
+		_futex_wake(seq);
+	}
+}
+
+static void _spins_init(void)
+{
+	if (_spins < 0)
+	{
+		_spins = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? BROKER_SPINS : 0;
+	}
+}
+
+static int _pid_alive(uint32_t pid)
+{
+	return pid != 0 && (kill((pid_t) pid, 0) == 0 || errno == EPERM);
+}
+
+/* Client of the slot claimed at pos, 0 while unnamed or taken back */
+static uint32_t _slot_owner(_broker_slot_t *slot, uint32_t pos)
+{
+	uint64_t owner = __atomic_load_n(&slot->owner, __ATOMIC_ACQUIRE);
+
+	return (uint32_t) (owner >> 32) == pos ? (uint32_t) owner : 0;
+}
+
+/*
+ * Name the client of the slot just claimed at pos, over the owner of the
+ * lap before.  Fails when the broker took the claim back first, or the
+ * ring went on without us, the caller then claims another position.
+ */
+static int _slot_own(_broker_slot_t *slot, uint32_t pos)
+{
+	uint64_t owner = __atomic_load_n(&slot->owner, __ATOMIC_RELAXED);
+
+	do
+	{
+		if ((uint32_t) (owner >> 32) != pos - BROKER_SLOTS)
+		{
+			return 0;
+		}
+	} while (!__atomic_compare_exchange_n(&slot->owner, &owner, (uint64_t) pos << 32 | (uint32_t) getpid(), 0,
+		__ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+	return 1;
+}
+
+/*
+ * Skip the slot at head when its client died before posting the request.
+ * A claim still unnamed after BROKER_CLAIM_WAITS sleeps is taken back with
+ * a CAS on owner, so a client merely stalled in between finds it gone and
+ * never posts into the skipped slot.  Returns 1 once the slot is handed to
+ * the next lap.
+ */
+static int _broker_reap(_broker_shm_t *shm, _broker_slot_t *slot, uint32_t head, uint32_t *waits)
+{
+	uint32_t pos = head;
+
+	uint64_t owner;
+
+	/* Not claimed yet */
+	if (__atomic_load_n(&shm->tail, __ATOMIC_ACQUIRE) == head)
+	{
+		*waits = 0;
+		return 0;
+	}
+
+	owner = __atomic_load_n(&slot->owner, __ATOMIC_ACQUIRE);
+
+	if ((uint32_t) (owner >> 32) == head)
+	{
+		/* Named, skipped only once its client is gone */
+		if (_pid_alive((uint32_t) owner))
+		{
+			*waits = 0;
+			return 0;
+		}
+	}
+	else if (++(*waits) < BROKER_CLAIM_WAITS ||
+		!__atomic_compare_exchange_n(&slot->owner, &owner, (uint64_t) head << 32, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+	{
+		return 0;
+	}
+
+	*waits = 0;
+
+	/* Fails when the request was posted after all, it is served next */
+	if (!__atomic_compare_exchange_n(&slot->seq, &pos, head + BROKER_SLOTS, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+	{
+		return 0;
+	}
+
+	ERR("zynq_broker_serve: Client pid %d gone before posting its request, slot skipped...\n", (uint32_t) owner);
+
+	return 1;
+}
+
+static int32_t _broker_exec(zynq_dev_t *dev, _broker_slot_t *slot)
+{
+	uint32_t tri, op;
+
+	switch (slot->op)
+	{
+		case BROKER_SET_DIR:
+			return zynq_dev_set_gpio_direction(dev, slot->offset, slot->data, slot->arg);
+		case BROKER_GET_DIR:
+			return zynq_dev_get_gpio_direction(dev, slot->offset, slot->data, slot->arg);
+		case BROKER_WRITE:
+			return zynq_dev_write(dev, slot->offset, slot->data, slot->arg);
+		case BROKER_WRITE_LW:
+			return zynq_dev_write_lw(dev, slot->offset, slot->data, slot->arg);
+		case BROKER_WRITE_UW:
+			return zynq_dev_write_uw(dev, slot->offset, slot->data, slot->arg);
+		case BROKER_READ:
+			return zynq_dev_read(dev, slot->offset, slot->data, slot->arg);
+		case BROKER_READ_LW:
+			return zynq_dev_read_lw(dev, slot->offset, slot->data, slot->arg);
+		case BROKER_READ_UW:
+			return zynq_dev_read_uw(dev, slot->offset, slot->data, slot->arg);
+		case BROKER_BITS:
+			tri = BROKER_BITS_TRI(slot->arg);
+			op = BROKER_BITS_OP(slot->arg);
+			if (tri > 1 || op > BITS_TOGGLE)
+			{
+				break;
+			}
+			return _broker_bits[tri][op](dev, slot->offset, BROKER_BITS_CHAN(slot->arg), slot->data[CH1_INDEX]);
+		default:
+			break;
+	}
+
+	ERR("zynq_broker: Error, invalid op=%d, arg=0x%x...\n", slot->op, slot->arg);
+
+	return -1;
+}
+
+int zynq_broker_serve(zynq_dev_t *dev, const char *name, uint32_t mode, const int *stop)
+{
+	char *fn = "zynq_broker_serve";
+
+	_broker_shm_t *shm;
+
+	_broker_slot_t *slot;
+
+	uint32_t head = 0, waits = 0;
+
+	uint64_t served = 0;
+
+	uint32_t i;
+
+	int fd;
+
+	if (dev == NULL || dev->open != 1 || dev->broker != NULL || dev->num_gpio > BROKER_MAX_GPIO)
+	{
+		ERR("%s: Error, device not open or not servable...\n", fn);
+		return -1;
+	}
+
+	if (name == NULL)
+	{
+		name = BROKER_DEFAULT_NAME;
+	}
+
+	_spins_init();
+
+	if ( (fd = shm_open(name, O_RDWR | O_CREAT, mode)) == -1)
+	{
+		ERR("%s: Can't open shared memory %s...\n", fn, name);
+		return -1;
+	}
+
+	/* Clients may run as other users, the umask must not narrow mode */
+	if (fchmod(fd, mode) == -1 || ftruncate(fd, sizeof(_broker_shm_t)) == -1 ||
+		(shm = mmap(0, sizeof(_broker_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+	{
+		ERR("%s: Can't map shared memory %s...\n", fn, name);
+		close(fd);
+		return -1;
+	}
+
+	close(fd);
+
+	if (shm->magic == BROKER_MAGIC && shm->pid != (uint32_t) getpid() && _pid_alive(shm->pid))
+	{
+		ERR("%s: %s already served by pid %d...\n", fn, name, shm->pid);
+		munmap(shm, sizeof(_broker_shm_t));
+		return -1;
+	}
+
+	memset(shm, 0, sizeof(_broker_shm_t));
+
+	shm->version = BROKER_VERSION;
+	shm->pid = getpid();
+	shm->opmode = dev->opmode;
+	shm->num_gpio = dev->num_gpio;
+	for (i = 0; i < dev->num_gpio; i++)
+	{
+		shm->chan_mask[i] = dev->gpio[i].chan_mask;
+	}
+	for (i = 0; i < BROKER_SLOTS; i++)
+	{
+		shm->slot[i].seq = i;
+		/* Owned by the lap before the first */
+		shm->slot[i].owner = (uint64_t) (i - BROKER_SLOTS) << 32;
+	}
+
+	/* Clients only attach once the magic is visible */
+	__atomic_store_n(&shm->magic, BROKER_MAGIC, __ATOMIC_RELEASE);
+
+	DBG("%s: Serving %d GPIOs on %s...\n", fn, dev->num_gpio, name);
+
+	while (stop == NULL || !__atomic_load_n(stop, __ATOMIC_ACQUIRE))
+	{
+		slot = &shm->slot[head & (BROKER_SLOTS - 1)];
+
+		if (!_seq_wait(&slot->seq, head + 1, &shm->sleeping))
+		{
+			if (_broker_reap(shm, slot, head, &waits))
+			{
+				head++;
+			}
+			continue;
+		}
+
+		waits = 0;
+
+		slot->rv = _broker_exec(dev, slot);
+
+		_seq_post(&slot->seq, head + 2, &slot->waiting);
+
+		head++;
+		served++;
+	}
+
+	DBG("%s: %llu requests served...\n", fn, (unsigned long long) served);
+
+	shm->magic = 0;
+	munmap(shm, sizeof(_broker_shm_t));
+	shm_unlink(name);
+
+	return 0;
+}
+
+zynq_dev_t * _broker_connect(const char *fn, const char *name, uint32_t opmode, uint32_t initmode)
+{
+	_broker_shm_t *shm;
+
+	zynq_dev_t *dev;
+
+	uint32_t i;
+
+	int fd;
+
+	if (name == NULL || name[0] == '\0')
+	{
+		name = BROKER_DEFAULT_NAME;
+	}
+
+	/* The registers live in the broker, there is nothing to shadow here */
+	if (initmode & INIT_SHADOW_MODE)
+	{
+		ERR("%s: Error, shadow registers not available through the broker...\n", fn);
+		return NULL;
+	}
+
+	_spins_init();
+
+	if ( (fd = shm_open(name, O_RDWR, 0)) == -1)
+	{
+		ERR("%s: Can't open %s, is the broker running...\n", fn, name);
+		return NULL;
+	}
+
+	shm = mmap(0, sizeof(_broker_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (shm == MAP_FAILED)
+	{
+		ERR("%s: Can't map %s...\n", fn, name);
+		return NULL;
+	}
+
+	if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != BROKER_MAGIC ||
+		shm->version != BROKER_VERSION || !_pid_alive(shm->pid))
+	{
+		ERR("%s: %s is not served by a running broker...\n", fn, name);
+		munmap(shm, sizeof(_broker_shm_t));
+		return NULL;
+	}
+
+	/* The broker generates (or not) the test mode strobe for every client */
+	if (shm->opmode != opmode)
+	{
+		ERR("%s: Error, broker runs opmode=%d, not %d...\n", fn, shm->opmode, opmode);
+		munmap(shm, sizeof(_broker_shm_t));
+		return NULL;
+	}
+
+	if ( (dev = calloc(1, sizeof(*dev))) == NULL ||
+		(dev->gpio = calloc(shm->num_gpio, sizeof(*dev->gpio))) == NULL)
+	{
+		ERR("%s: Can't allocate device...\n", fn);
+		free(dev);
+		munmap(shm, sizeof(_broker_shm_t));
+		return NULL;
+	}
+
+	dev->mem_fd = -1;
+	dev->num_gpio = shm->num_gpio;
+	for (i = 0; i < dev->num_gpio; i++)
+	{
+		dev->gpio[i].chan_mask = shm->chan_mask[i];
+	}
+	dev->opmode = opmode;
+	dev->broker = shm;
+	dev->init = 1;
+	dev->open = 1;
+
+	DBG("%s: Connected to broker pid %d on %s...\n", fn, shm->pid, name);
+
+	return dev;
+}
+
+void _broker_disconnect(zynq_dev_t *dev)
+{
+	munmap(dev->broker, sizeof(_broker_shm_t));
+
+	dev->broker = NULL;
+	dev->init = 0;
+	dev->open = 0;
+	dev->opmode = OP_NORMAL_MODE;
+}
+
+/*
+ * Called now and then while the ring is full.  Fails when the broker
+ * exited, frees the slot when its previous client died before collecting
+ * its response.
+ */
+static int _broker_full(const char *fn, _broker_shm_t *shm, _broker_slot_t *slot, uint32_t pos, uint32_t seq)
+{
+	uint32_t prev = pos - BROKER_SLOTS;
+
+	if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != BROKER_MAGIC || !_pid_alive(shm->pid))
+	{
+		ERR("%s: Broker pid %d exited...\n", fn, shm->pid);
+		return -1;
+	}
+
+	if (seq == prev + 2 && !_pid_alive(_slot_owner(slot, prev)) &&
+		__atomic_compare_exchange_n(&slot->seq, &seq, pos, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+	{
+		ERR("%s: Client pid %d died before collecting its response, slot freed...\n", fn, _slot_owner(slot, prev));
+	}
+
+	return 0;
+}
+
+int _broker_call(zynq_dev_t *dev, const char *fn, uint32_t op, uint32_t offset, uint32_t arg, uint32_t *data)
+{
+	_broker_shm_t *shm = dev->broker;
+
+	_broker_slot_t *slot;
+
+	uint32_t pos, seq, yields = 0;
+
+	int rv;
+
+	/* Claim the slot of the next position */
+	pos = __atomic_load_n(&shm->tail, __ATOMIC_RELAXED);
+
+	for (;;)
+	{
+		slot = &shm->slot[pos & (BROKER_SLOTS - 1)];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+		if (seq == pos)
+		{
+			if (__atomic_compare_exchange_n(&shm->tail, &pos, pos + 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				/* Lets the broker or the next lap skip the slot should we die holding it */
+				if (_slot_own(slot, pos))
+				{
+					break;
+				}
+
+				ERR("%s: Claim of slot %u taken back by the broker, claiming again...\n", fn, pos);
+				pos = __atomic_load_n(&shm->tail, __ATOMIC_RELAXED);
+			}
+		}
+		else if ((int32_t) (seq - pos) < 0)
+		{
+			/* Ring full, the previous client of this slot has not collected its response */
+			if (++yields % BROKER_FULL_YIELDS == 0 && _broker_full(fn, shm, slot, pos, seq) != 0)
+			{
+				return -1;
+			}
+			sched_yield();
+			pos = __atomic_load_n(&shm->tail, __ATOMIC_RELAXED);
+		}
+		else
+		{
+			pos = __atomic_load_n(&shm->tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->waiting = 0;
+	slot->op = op;
+	slot->offset = offset;
+	slot->arg = arg;
+	slot->data[CH1_INDEX] = data[CH1_INDEX];
+	slot->data[CH2_INDEX] = data[CH2_INDEX];
+
+	_seq_post(&slot->seq, pos + 1, &shm->sleeping);
+
+	while (!_seq_wait(&slot->seq, pos + 2, &slot->waiting))
+	{
+		if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != BROKER_MAGIC || !_pid_alive(shm->pid))
+		{
+			ERR("%s: Broker pid %d exited...\n", fn, shm->pid);
+			return -1;
+		}
+	}
+
+	data[CH1_INDEX] = slot->data[CH1_INDEX];
+	data[CH2_INDEX] = slot->data[CH2_INDEX];
+	rv = slot->rv;
+
+	/* Hand the slot to the client one lap ahead */
+	__atomic_store_n(&slot->seq, pos + BROKER_SLOTS, __ATOMIC_RELEASE);
+
+	return rv;
+}
@@ -0,0 +1,755 @@
+/**********************************************************
+ *
+ *  Change-only capture files.
+ *
+ *  Samples from the capture engine are reduced to records
+ *  of the samples that changed: a varint time delta, the
+ *  XOR with the previous state of each changed word and a
+ *  count of the unchanged samples skipped.  The encoder
+ *  fills one block at a time on the caller's thread, full
+ *  blocks go to a flusher thread through a small pool so
+ *  the disk never holds up the encoder unless the whole
+ *  pool is waiting to be written.
+ *
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "ZYNQ_private.h"
+#include "include/ZYNQ_capfile.h"
+
+/* Blocks in the writer's pool */
+#define CAPFILE_BUFS (4)
+
+/* Largest record, a header, an idle count and four values */
+#define CAPFILE_REC_MAX (6 * 10)
+
+/* Samples taken out of the capture ring at a time */
+#define CAPFILE_CHUNK (4096)
+
+typedef struct {
+	zynq_capfile_blk_t blk;
+	uint8_t *buf;
+} _capfile_buf_t;
+
+struct zynq_capfile {
+	int fd;
+	zynq_capfile_hdr_t hdr;
+	_capfile_buf_t bufs[CAPFILE_BUFS];
+	/* Blocks handed to the flusher and blocks written, under lock */
+	uint64_t queued;
+	uint64_t written;
+	int closing;
+	int error;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	/* Encoder state, only touched by the writing thread */
+	_capfile_buf_t *cur;
+	uint32_t state[4];
+	uint64_t prev_ns;
+	uint64_t idle;
+	uint64_t idle_ns;
+	int started;
+	zynq_capfile_stats_t stats;
+};
+
+struct zynq_capfile_reader {
+	FILE *fp;
+	zynq_capfile_hdr_t hdr;
+	zynq_capfile_blk_t blk;
+	uint8_t *buf;
+	uint32_t pos;
+	uint32_t left;
+	uint32_t state[4];
+	uint64_t prev_ns;
+	/* A record decoded by zynq_capfile_seek() but not read yet */
+	int peeked;
+	zynq_capfile_ev_t peek;
+};
+
+static inline uint32_t _put_varint(uint8_t *p, uint64_t v)
+{
+	uint32_t n = 0;
+
+	while (v >= 0x80)
+	{
+		p[n++] = (uint8_t) v | 0x80;
+		v >>= 7;
+	}
+	p[n++] = (uint8_t) v;
+
+	return n;
+}
+
+/* Bytes used, 0 when the varint runs past end */
+static inline uint32_t _get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+	uint32_t n = 0, shift = 0;
+
+	*v = 0;
+
+	while (p + n < end && shift < 64)
+	{
+		*v |= (uint64_t) (p[n] & 0x7f) << shift;
+		if ((p[n++] & 0x80) == 0)
+		{
+			return n;
+		}
+		shift += 7;
+	}
+
+	return 0;
+}
+
+static void * _capfile_main(void *arg)
+{
+	zynq_capfile_t *cf = arg;
+
+	_capfile_buf_t *b;
+
+	struct iovec iov[2];
+
+	ssize_t len;
+
+	pthread_mutex_lock(&cf->lock);
+
+	for (;;)
+	{
+		while (cf->written == cf->queued && !cf->closing)
+		{
+			pthread_cond_wait(&cf->cond, &cf->lock);
+		}
+
+		if (cf->written == cf->queued)
+		{
+			break;
+		}
+
+		b = &cf->bufs[cf->written % CAPFILE_BUFS];
+		pthread_mutex_unlock(&cf->lock);
+
+		iov[0].iov_base = &b->blk;
+		iov[0].iov_len = sizeof(b->blk);
+		iov[1].iov_base = b->buf;
+		iov[1].iov_len = b->blk.bytes;
+		len = (ssize_t) (sizeof(b->blk) + b->blk.bytes);
+
+		/* The encoder never touches a queued block, write it unlocked */
+		if (!__atomic_load_n(&cf->error, __ATOMIC_RELAXED) && writev(cf->fd, iov, 2) != len)
+		{
+			ERR("zynq_capfile: Error writing block, dropping the rest...\n");
+			__atomic_store_n(&cf->error, 1, __ATOMIC_RELAXED);
+		}
+
+		pthread_mutex_lock(&cf->lock);
+		cf->written++;
+		pthread_cond_broadcast(&cf->cond);
+	}
+
+	pthread_mutex_unlock(&cf->lock);
+
+	return NULL;
+}
+
+/* Start the next block from the current state, waits for a free buffer */
+static int _capfile_begin(zynq_capfile_t *cf)
+{
+	pthread_mutex_lock(&cf->lock);
+
+	while (cf->queued - cf->written >= CAPFILE_BUFS && !cf->error)
+	{
+		pthread_cond_wait(&cf->cond, &cf->lock);
+	}
+
+	cf->cur = &cf->bufs[cf->queued % CAPFILE_BUFS];
+
+	pthread_mutex_unlock(&cf->lock);
+
+	if (cf->error)
+	{
+		return -1;
+	}
+
+	memset(&cf->cur->blk, 0, sizeof(cf->cur->blk));
+	cf->cur->blk.magic = CAPFILE_BLK_MAGIC;
+	cf->cur->blk.base_ns = cf->prev_ns;
+	cf->cur->blk.data[CH1_INDEX] = cf->state[0];
+	cf->cur->blk.data[CH2_INDEX] = cf->state[1];
+	cf->cur->blk.tri[CH1_INDEX] = cf->state[2];
+	cf->cur->blk.tri[CH2_INDEX] = cf->state[3];
+
+	return 0;
+}
+
+/* Hand the current block to the flusher */
+static void _capfile_end(zynq_capfile_t *cf)
+{
+	cf->cur->blk.last_ns = cf->prev_ns;
+
+	cf->stats.blocks++;
+	cf->stats.bytes += sizeof(zynq_capfile_blk_t) + cf->cur->blk.bytes;
+
+	pthread_mutex_lock(&cf->lock);
+	cf->queued++;
+	pthread_cond_broadcast(&cf->cond);
+	pthread_mutex_unlock(&cf->lock);
+
+	cf->cur = NULL;
+}
+
+static int _capfile_emit(zynq_capfile_t *cf, uint64_t ts_ns, uint32_t changed, const uint32_t *xor)
+{
+	zynq_capfile_blk_t *blk;
+
+	uint8_t *p;
+
+	uint32_t i;
+
+	if (cf->cur != NULL && cf->cur->blk.bytes + CAPFILE_REC_MAX > cf->hdr.block_size)
+	{
+		_capfile_end(cf);
+	}
+
+	if (cf->cur == NULL && _capfile_begin(cf) != 0)
+	{
+		return -1;
+	}
+
+	blk = &cf->cur->blk;
+	p = cf->cur->buf + blk->bytes;
+
+	p += _put_varint(p, (ts_ns - cf->prev_ns) << 5 | (cf->idle ? CAPFILE_IDLE : 0) | changed);
+
+	if (cf->idle)
+	{
+		p += _put_varint(p, cf->idle);
+	}
+
+	for (i = 0; i < 4; i++)
+	{
+		if (changed & (1 << i))
+		{
+			p += _put_varint(p, xor[i]);
+		}
+	}
+
+	blk->bytes = p - cf->cur->buf;
+	blk->records++;
+	blk->samples += cf->idle + 1;
+
+	cf->stats.records++;
+	cf->prev_ns = ts_ns;
+	cf->idle = 0;
+
+	return 0;
+}
+
+zynq_capfile_t * zynq_capfile_open(const char *path, const zynq_capture_cfg_t *cfg, uint32_t block_size)
+{
+	char *fn = "zynq_capfile_open";
+
+	zynq_capfile_t *cf;
+
+	uint32_t i;
+
+	if (path == NULL || cfg == NULL)
+	{
+		ERR("%s: Error, invalid path or capture config...\n", fn);
+		return NULL;
+	}
+
+	if (block_size == 0)
+	{
+		block_size = CAPFILE_BLOCK_SIZE;
+	}
+
+	if (block_size < 2 * CAPFILE_REC_MAX)
+	{
+		ERR("%s: Error, block_size=%u too small...\n", fn, block_size);
+		return NULL;
+	}
+
+	if ( (cf = calloc(1, sizeof(*cf))) == NULL)
+	{
+		ERR("%s: Can't allocate capture file...\n", fn);
+		return NULL;
+	}
+
+	for (i = 0; i < CAPFILE_BUFS; i++)
+	{
+		if ( (cf->bufs[i].buf = malloc(block_size)) == NULL)
+		{
+			ERR("%s: Can't allocate %u byte blocks...\n", fn, block_size);
+			goto fail;
+		}
+	}
+
+	cf->hdr.magic = CAPFILE_MAGIC;
+	cf->hdr.version = CAPFILE_VERSION;
+	cf->hdr.hdr_size = sizeof(zynq_capfile_hdr_t);
+	cf->hdr.block_size = block_size;
+	cf->hdr.offset = cfg->offset;
+	cf->hdr.channel_mask = cfg->channel_mask;
+	cf->hdr.flags = cfg->flags;
+	cf->hdr.interval_ns = cfg->interval_ns;
+
+	if ( (cf->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1)
+	{
+		ERR("%s: Can't open %s...\n", fn, path);
+		goto fail;
+	}
+
+	if (write(cf->fd, &cf->hdr, sizeof(cf->hdr)) != sizeof(cf->hdr))
+	{
+		ERR("%s: Error writing %s...\n", fn, path);
+		close(cf->fd);
+		goto fail;
+	}
+
+	cf->stats.bytes = sizeof(cf->hdr);
+
+	pthread_mutex_init(&cf->lock, NULL);
+	pthread_cond_init(&cf->cond, NULL);
+
+	if (pthread_create(&cf->thread, NULL, _capfile_main, cf) != 0)
+	{
+		ERR("%s: Can't start flusher thread...\n", fn);
+		pthread_cond_destroy(&cf->cond);
+		pthread_mutex_destroy(&cf->lock);
+		close(cf->fd);
+		goto fail;
+	}
+
+	DBG("%s: Writing %s in %u byte blocks...\n", fn, path, block_size);
+
+	return cf;
+
+fail:
+	for (i = 0; i < CAPFILE_BUFS; i++)
+	{
+		free(cf->bufs[i].buf);
+	}
+	free(cf);
+
+	return NULL;
+}
+
+int zynq_capfile_write(zynq_capfile_t *cf, const zynq_sample_t *samples, size_t n)
+{
+	uint32_t xor[4], changed, i;
+
+	size_t k;
+
+	if (cf == NULL || (samples == NULL && n != 0))
+	{
+		return -1;
+	}
+
+	for (k = 0; k < n; k++)
+	{
+		const zynq_sample_t *s = &samples[k];
+
+		if (!cf->started)
+		{
+			/* The first record is a change from zero at dt 0 */
+			cf->prev_ns = s->ts_ns;
+			cf->started = 1;
+		}
+		else if (s->ts_ns < cf->prev_ns)
+		{
+			ERR("zynq_capfile_write: Error, samples out of order...\n");
+			return -1;
+		}
+
+		xor[0] = s->data[CH1_INDEX] ^ cf->state[0];
+		xor[1] = s->data[CH2_INDEX] ^ cf->state[1];
+		xor[2] = s->tri[CH1_INDEX] ^ cf->state[2];
+		xor[3] = s->tri[CH2_INDEX] ^ cf->state[3];
+
+		for (changed = 0, i = 0; i < 4; i++)
+		{
+			changed |= xor[i] ? 1 << i : 0;
+		}
+
+		cf->stats.samples++;
+
+		if (changed == 0 && cf->stats.records != 0)
+		{
+			cf->idle++;
+			cf->idle_ns = s->ts_ns;
+			continue;
+		}
+
+		/* A new block starts from the state before this sample */
+		if (_capfile_emit(cf, s->ts_ns, changed, xor) != 0)
+		{
+			return -1;
+		}
+
+		for (i = 0; i < 4; i++)
+		{
+			cf->state[i] ^= xor[i];
+		}
+	}
+
+	return 0;
+}
+
+int zynq_capfile_record(zynq_capfile_t *cf, zynq_capture_t *cap, const int *stop)
+{
+	char *fn = "zynq_capfile_record";
+
+	zynq_sample_t *samples;
+
+	struct timespec ts = { 0, 1000000 };
+
+	size_t n;
+
+	int done, rv = 0;
+
+	if (cf == NULL || cap == NULL)
+	{
+		ERR("%s: Error, invalid file or capture...\n", fn);
+		return -1;
+	}
+
+	if ( (samples = malloc(CAPFILE_CHUNK * sizeof(zynq_sample_t))) == NULL)
+	{
+		ERR("%s: Can't allocate %d samples...\n", fn, CAPFILE_CHUNK);
+		return -1;
+	}
+
+	do
+	{
+		if (stop != NULL && __atomic_load_n(stop, __ATOMIC_ACQUIRE))
+		{
+			zynq_capture_stop(cap);
+		}
+
+		/* Check before reading, the last samples are in the ring by then */
+		done = zynq_capture_done(cap);
+
+		while ( (n = zynq_capture_read(cap, samples, CAPFILE_CHUNK)) > 0 && rv == 0)
+		{
+			rv = zynq_capfile_write(cf, samples, n);
+		}
+
+		if (!done && rv == 0)
+		{
+			nanosleep(&ts, NULL);
+		}
+	} while (!done && rv == 0);
+
+	free(samples);
+
+	return rv;
+}
+
+int zynq_capfile_close(zynq_capfile_t *cf, zynq_capfile_stats_t *stats)
+{
+	char *fn = "zynq_capfile_close";
+
+	uint32_t i, xor[4] = { 0, 0, 0, 0 };
+
+	int rv = 0;
+
+	if (cf == NULL)
+	{
+		ERR("%s: Error, no capture file...\n", fn);
+		return -1;
+	}
+
+	/* Close the trailing idle run, the record itself is its last sample */
+	if (cf->idle)
+	{
+		cf->idle--;
+		rv = _capfile_emit(cf, cf->idle_ns, 0, xor);
+	}
+
+	if (cf->cur != NULL)
+	{
+		_capfile_end(cf);
+	}
+
+	pthread_mutex_lock(&cf->lock);
+	cf->closing = 1;
+	pthread_cond_broadcast(&cf->cond);
+	pthread_mutex_unlock(&cf->lock);
+
+	pthread_join(cf->thread, NULL);
+
+	if (cf->error || close(cf->fd) != 0)
+	{
+		rv = -1;
+	}
+
+	cf->stats.ratio = cf->stats.bytes ? (double) cf->stats.samples * sizeof(zynq_sample_t) / cf->stats.bytes : 0;
+
+	DBG("%s: %llu samples in %llu records, %llu bytes...\n", fn, (unsigned long long) cf->stats.samples,
+		(unsigned long long) cf->stats.records, (unsigned long long) cf->stats.bytes);
+
+	if (stats != NULL)
+	{
+		*stats = cf->stats;
+	}
+
+	pthread_cond_destroy(&cf->cond);
+	pthread_mutex_destroy(&cf->lock);
+
+	for (i = 0; i < CAPFILE_BUFS; i++)
+	{
+		free(cf->bufs[i].buf);
+	}
+	free(cf);
+
+	return rv;
+}
+
+zynq_capfile_reader_t * zynq_capfile_reader_open(const char *path)
+{
+	char *fn = "zynq_capfile_reader_open";
+
+	zynq_capfile_reader_t *rd;
+
+	if ( (rd = calloc(1, sizeof(*rd))) == NULL)
+	{
+		ERR("%s: Can't allocate reader...\n", fn);
+		return NULL;
+	}
+
+	if (path == NULL || (rd->fp = fopen(path, "rb")) == NULL)
+	{
+		ERR("%s: Can't open %s...\n", fn, path ? path : "(null)");
+		free(rd);
+		return NULL;
+	}
+
+	if (fread(&rd->hdr, sizeof(rd->hdr), 1, rd->fp) != 1 || rd->hdr.magic != CAPFILE_MAGIC ||
+		rd->hdr.version != CAPFILE_VERSION || rd->hdr.hdr_size != sizeof(rd->hdr))
+	{
+		ERR("%s: %s is not a version %d capture file...\n", fn, path, CAPFILE_VERSION);
+		fclose(rd->fp);
+		free(rd);
+		return NULL;
+	}
+
+	if ( (rd->buf = malloc(rd->hdr.block_size)) == NULL)
+	{
+		ERR("%s: Can't allocate %u byte block...\n", fn, rd->hdr.block_size);
+		fclose(rd->fp);
+		free(rd);
+		return NULL;
+	}
+
+	return rd;
+}
+
+const zynq_capfile_hdr_t * zynq_capfile_reader_hdr(zynq_capfile_reader_t *rd)
+{
+	return rd != NULL ? &rd->hdr : NULL;
+}
+
+/* Next block header, 0 at the end of the file */
+static int _capfile_next_blk(zynq_capfile_reader_t *rd)
+{
+	size_t n;
+
+	if ( (n = fread(&rd->blk, 1, sizeof(rd->blk), rd->fp)) == 0)
+	{
+		return 0;
+	}
+
+	if (n != sizeof(rd->blk) || rd->blk.magic != CAPFILE_BLK_MAGIC || rd->blk.bytes > rd->hdr.block_size)
+	{
+		ERR("zynq_capfile: Corrupt block header...\n");
+		return -1;
+	}
+
+	return 1;
+}
+
+static int _capfile_load_blk(zynq_capfile_reader_t *rd)
+{
+	if (fread(rd->buf, 1, rd->blk.bytes, rd->fp) != rd->blk.bytes)
+	{
+		ERR("zynq_capfile: Block truncated...\n");
+		return -1;
+	}
+
+	rd->pos = 0;
+	rd->left = rd->blk.records;
+	rd->prev_ns = rd->blk.base_ns;
+	rd->state[0] = rd->blk.data[CH1_INDEX];
+	rd->state[1] = rd->blk.data[CH2_INDEX];
+	rd->state[2] = rd->blk.tri[CH1_INDEX];
+	rd->state[3] = rd->blk.tri[CH2_INDEX];
+
+	return 0;
+}
+
+/* Decode one record, 0 at the end of the file */
+static int _capfile_decode(zynq_capfile_reader_t *rd, zynq_capfile_ev_t *ev)
+{
+	const uint8_t *end;
+
+	uint64_t h, v;
+
+	uint32_t i, n;
+
+	int rv;
+
+	while (rd->left == 0)
+	{
+		if ( (rv = _capfile_next_blk(rd)) <= 0 || (rv = _capfile_load_blk(rd)) != 0)
+		{
+			return rv;
+		}
+	}
+
+	end = rd->buf + rd->blk.bytes;
+
+	if ( (n = _get_varint(rd->buf + rd->pos, end, &h)) == 0)
+	{
+		goto corrupt;
+	}
+	rd->pos += n;
+
+	ev->idle = 0;
+	if (h & CAPFILE_IDLE)
+	{
+		if ( (n = _get_varint(rd->buf + rd->pos, end, &ev->idle)) == 0)
+		{
+			goto corrupt;
+		}
+		rd->pos += n;
+	}
+
+	ev->changed = h & (CAPFILE_CH1 | CAPFILE_CH2 | CAPFILE_TRI1 | CAPFILE_TRI2);
+
+	for (i = 0; i < 4; i++)
+	{
+		if (ev->changed & (1 << i))
+		{
+			if ( (n = _get_varint(rd->buf + rd->pos, end, &v)) == 0)
+			{
+				goto corrupt;
+			}
+			rd->pos += n;
+			rd->state[i] ^= (uint32_t) v;
+		}
+	}
+
+	rd->prev_ns += h >> 5;
+	rd->left--;
+
+	ev->ts_ns = rd->prev_ns;
+	ev->data[CH1_INDEX] = rd->state[0];
+	ev->data[CH2_INDEX] = rd->state[1];
+	ev->tri[CH1_INDEX] = rd->state[2];
+	ev->tri[CH2_INDEX] = rd->state[3];
+
+	return 1;
+
+corrupt:
+	ERR("zynq_capfile: Corrupt record...\n");
+	return -1;
+}
+
+int zynq_capfile_read(zynq_capfile_reader_t *rd, zynq_capfile_ev_t *ev, int max)
+{
+	int n = 0, rv;
+
+	if (rd == NULL || ev == NULL)
+	{
+		return -1;
+	}
+
+	if (rd->peeked && max > 0)
+	{
+		ev[n++] = rd->peek;
+		rd->peeked = 0;
+	}
+
+	while (n < max)
+	{
+		if ( (rv = _capfile_decode(rd, &ev[n])) < 0)
+		{
+			return -1;
+		}
+
+		if (rv == 0)
+		{
+			break;
+		}
+
+		n++;
+	}
+
+	return n;
+}
+
+int zynq_capfile_seek(zynq_capfile_reader_t *rd, uint64_t ts_ns)
+{
+	char *fn = "zynq_capfile_seek";
+
+	int rv;
+
+	if (rd == NULL || fseek(rd->fp, sizeof(rd->hdr), SEEK_SET) != 0)
+	{
+		ERR("%s: Error, no reader or can't rewind...\n", fn);
+		return -1;
+	}
+
+	rd->left = 0;
+	rd->peeked = 0;
+
+	/* Skip whole blocks by their headers, then decode within the block */
+	while ( (rv = _capfile_next_blk(rd)) > 0 && rd->blk.last_ns < ts_ns)
+	{
+		if (fseek(rd->fp, rd->blk.bytes, SEEK_CUR) != 0)
+		{
+			ERR("%s: Can't skip block...\n", fn);
+			return -1;
+		}
+	}
+
+	if (rv <= 0)
+	{
+		return rv;
+	}
+
+	if (_capfile_load_blk(rd) != 0)
+	{
+		return -1;
+	}
+
+	while ( (rv = _capfile_decode(rd, &rd->peek)) > 0 && rd->peek.ts_ns < ts_ns)
+	{
+	}
+
+	rd->peeked = rv > 0;
+
+	return rv < 0 ? -1 : 0;
+}
+
+int zynq_capfile_reader_close(zynq_capfile_reader_t *rd)
+{
+	if (rd == NULL)
+	{
+		return -1;
+	}
+
+	fclose(rd->fp);
+	free(rd->buf);
+	free(rd);
+
+	return 0;
+}
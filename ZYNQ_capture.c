@@ -0,0 +1,305 @@
+/**********************************************************
+ *
+ *  High rate input capture (logic analyzer mode).
+ *
+ *  A dedicated, optionally pinned and SCHED_FIFO, thread
+ *  samples one GPIO into a preallocated single producer,
+ *  single consumer ring of timestamped records.  Checks
+ *  are done once at start, each sample is only the
+ *  register loads and a timestamp.
+ *
+ **********************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "ZYNQ_private.h"
+#include "include/ZYNQ_capture.h"
+
+/* Intervals below this are busy waited rather than slept */
+#define CAPTURE_SPIN_NS (50000ULL)
+
+struct zynq_capture {
+	zynq_dev_t *dev;
+	zynq_capture_cfg_t cfg;
+	volatile gpio_t *regs;
+	/* Tri values come from here when the device keeps a shadow */
+	const uint32_t *shadow_tri;
+	zynq_sample_t *ring;
+	uint32_t mask;
+	/* Written by the sampler */
+	uint64_t head __attribute__((aligned(64)));
+	/* Written by zynq_capture_read() */
+	uint64_t tail __attribute__((aligned(64)));
+	pthread_t thread;
+	int joined;
+	int stop;
+	int done;
+	uint64_t dropped;
+	uint64_t start_ns;
+	uint64_t last_ns;
+	uint64_t max_gap_ns;
+};
+
+static void _cap_pin(zynq_capture_t *cap)
+{
+	cpu_set_t set;
+
+	if (cap->cfg.cpu < 0)
+	{
+		return;
+	}
+
+	CPU_ZERO(&set);
+	CPU_SET(cap->cfg.cpu, &set);
+
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+	{
+		ERR("zynq_capture: Can't pin sampler to CPU %d, running unpinned...\n", cap->cfg.cpu);
+	}
+}
+
+static void * _cap_main(void *arg)
+{
+	zynq_capture_t *cap = arg;
+
+	const zynq_capture_cfg_t *cfg = &cap->cfg;
+
+	volatile gpio_t *regs = cap->regs;
+
+	zynq_sample_t *rec;
+
+	uint64_t head = 0, tail = 0, taken = 0;
+
+	uint64_t now, prev, next, end;
+
+	uint32_t ch1 = cfg->channel_mask & CH1_MASK;
+
+	uint32_t ch2 = cfg->channel_mask & CH2_MASK;
+
+	uint32_t tri = cfg->flags & CAPTURE_TRI;
+
+	_cap_pin(cap);
+	_set_rt_priority("zynq_capture", cfg->rt_priority);
+
+	cap->start_ns = prev = next = _now_ns();
+	end = cfg->duration_ns ? cap->start_ns + cfg->duration_ns : UINT64_MAX;
+
+	while (!__atomic_load_n(&cap->stop, __ATOMIC_RELAXED))
+	{
+		if (cfg->interval_ns)
+		{
+			next += cfg->interval_ns;
+
+			if (_sleep_until(next, cfg->interval_ns < CAPTURE_SPIN_NS ? cfg->interval_ns : 0, &cap->stop))
+			{
+				break;
+			}
+		}
+
+		now = _now_ns();
+
+		if (now >= end)
+		{
+			break;
+		}
+
+		if (now - prev > cap->max_gap_ns)
+		{
+			cap->max_gap_ns = now - prev;
+		}
+		prev = now;
+		taken++;
+
+		/* Only look at the reader's index when the ring seems full */
+		if (head - tail > cap->mask && head - (tail = __atomic_load_n(&cap->tail, __ATOMIC_ACQUIRE)) > cap->mask)
+		{
+			cap->dropped++;
+		}
+		else
+		{
+			rec = &cap->ring[head & cap->mask];
+			rec->ts_ns = now;
+			rec->data[CH1_INDEX] = ch1 ? regs->ch[CH1_INDEX].data : 0;
+			rec->data[CH2_INDEX] = ch2 ? regs->ch[CH2_INDEX].data : 0;
+
+			if (tri)
+			{
+				rec->tri[CH1_INDEX] = !ch1 ? 0 : cap->shadow_tri ? cap->shadow_tri[CH1_INDEX] : regs->ch[CH1_INDEX].tri;
+				rec->tri[CH2_INDEX] = !ch2 ? 0 : cap->shadow_tri ? cap->shadow_tri[CH2_INDEX] : regs->ch[CH2_INDEX].tri;
+			}
+
+			__atomic_store_n(&cap->head, ++head, __ATOMIC_RELEASE);
+		}
+
+		if (cfg->max_samples && taken >= cfg->max_samples)
+		{
+			break;
+		}
+	}
+
+	cap->last_ns = prev;
+	__atomic_store_n(&cap->done, 1, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+zynq_capture_t * zynq_capture_start(zynq_dev_t *dev, const zynq_capture_cfg_t *cfg)
+{
+	char *fn = "zynq_capture_start";
+
+	zynq_capture_t *cap;
+
+	uint32_t size = 1;
+
+	if (dev == NULL || dev->open != 1 || dev->broker != NULL || cfg == NULL)
+	{
+		ERR("%s: Device not open...\n", fn);
+		return NULL;
+	}
+
+	if (cfg->offset >= dev->num_gpio || _get_gpio(dev, fn, cfg->offset) == NULL || cfg->channel_mask == 0 ||
+		(cfg->channel_mask & ~dev->gpio[cfg->offset].chan_mask))
+	{
+		ERR("%s: Error, offset=%d, channel_mask=0x%x not valid...\n", fn, cfg->offset, cfg->channel_mask);
+		return NULL;
+	}
+
+	if (cfg->ring_size == 0 || cfg->ring_size > 0x80000000)
+	{
+		ERR("%s: Error, ring_size=%u out of range...\n", fn, cfg->ring_size);
+		return NULL;
+	}
+
+	while (size < cfg->ring_size)
+	{
+		size <<= 1;
+	}
+
+	if ( (cap = calloc(1, sizeof(*cap))) == NULL ||
+		(cap->ring = malloc((size_t) size * sizeof(zynq_sample_t))) == NULL)
+	{
+		ERR("%s: Can't allocate %u samples...\n", fn, size);
+		free(cap);
+		return NULL;
+	}
+
+	/* Fault the ring in now rather than on the sampler's time */
+	memset(cap->ring, 0, (size_t) size * sizeof(zynq_sample_t));
+
+	cap->dev = dev;
+	cap->cfg = *cfg;
+	cap->regs = dev->gpio[cfg->offset].regs;
+	cap->shadow_tri = dev->shadow ? dev->gpio[cfg->offset].shadow_tri : NULL;
+	cap->mask = size - 1;
+
+	if (pthread_create(&cap->thread, NULL, _cap_main, cap) != 0)
+	{
+		ERR("%s: Can't start sampler thread...\n", fn);
+		free(cap->ring);
+		free(cap);
+		return NULL;
+	}
+
+	DBG("%s: Sampling offset=%d, channel_mask=0x%x into %u samples...\n", fn,
+		cfg->offset, cfg->channel_mask, size);
+
+	return cap;
+}
+
+size_t zynq_capture_read(zynq_capture_t *cap, zynq_sample_t *samples, size_t max)
+{
+	uint64_t head, tail;
+
+	size_t n = 0;
+
+	if (cap == NULL || samples == NULL)
+	{
+		return 0;
+	}
+
+	head = __atomic_load_n(&cap->head, __ATOMIC_ACQUIRE);
+	tail = cap->tail;
+
+	while (tail != head && n < max)
+	{
+		samples[n++] = cap->ring[tail & cap->mask];
+		tail++;
+	}
+
+	__atomic_store_n(&cap->tail, tail, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+int zynq_capture_done(zynq_capture_t *cap)
+{
+	return __atomic_load_n(&cap->done, __ATOMIC_ACQUIRE);
+}
+
+int zynq_capture_get_stats(zynq_capture_t *cap, zynq_capture_stats_t *stats)
+{
+	uint64_t end;
+
+	if (cap == NULL || stats == NULL)
+	{
+		return -1;
+	}
+
+	/* Unlocked snapshot, exact once the sampler has stopped */
+	end = zynq_capture_done(cap) ? cap->last_ns : _now_ns();
+
+	stats->samples = __atomic_load_n(&cap->head, __ATOMIC_ACQUIRE);
+	stats->dropped = cap->dropped;
+	stats->elapsed_ns = end > cap->start_ns ? end - cap->start_ns : 0;
+	stats->rate_hz = stats->elapsed_ns ? (stats->samples + stats->dropped) * 1e9 / stats->elapsed_ns : 0;
+	stats->max_gap_ns = cap->max_gap_ns;
+
+	return 0;
+}
+
+int zynq_capture_wait(zynq_capture_t *cap)
+{
+	if (cap == NULL)
+	{
+		return -1;
+	}
+
+	if (!cap->joined)
+	{
+		pthread_join(cap->thread, NULL);
+		cap->joined = 1;
+	}
+
+	return 0;
+}
+
+int zynq_capture_stop(zynq_capture_t *cap)
+{
+	if (cap == NULL)
+	{
+		return -1;
+	}
+
+	__atomic_store_n(&cap->stop, 1, __ATOMIC_RELEASE);
+
+	return zynq_capture_wait(cap);
+}
+
+int zynq_capture_close(zynq_capture_t *cap)
+{
+	if (zynq_capture_stop(cap) != 0)
+	{
+		return -1;
+	}
+
+	free(cap->ring);
+	free(cap);
+
+	return 0;
+}
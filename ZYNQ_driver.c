@@ -1,8 +1,8 @@
 /**********************************************************
  *
- *  Skeleton driver for writing and reading to the Zynq PL 
+ *  Skeleton driver for writing and reading to the Zynq PL
  *   from a Linux C program.
- * 
+ *
  **********************************************************/
 
 #include <stdio.h>
@@ -10,107 +10,313 @@
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 
-#include "include/ZYNQ_driver.h"
+#include "ZYNQ_private.h"
 
 /* Output from Xilinx Vivado Memory Map Window, GPIO Memory Offset */
 #define GPIO0_BASE_ADDRESS     0x41200000
 #define GPIO1_BASE_ADDRESS     0x41201000
 #define GPIO2_BASE_ADDRESS     0x41202000
- 
-/* Location in MicroZed Linux of xdevcfg char device, prog_done */
-#define PL_PROG_DONE (const char *) ("/sys/dev/char/249:0/device/prog_done")
+
 /* Hard code default file into driver */
 #define DEFAULT_PL (const char *) ("/store/mep/zynq_fpga_bin_files/ucm1_0.bin")
 
 #define MAP_SIZE (4096UL)
 #define MAP_MASK (MAP_SIZE - 1)
 
-/* Masks for testing log settings */
-#define ERROR (0x01)
-#define DEBUG (0x02)
-#define DIAG  (0x04)
+/* Debug level, initial setting set to lowest level */
+int _zynq_dbg_lvl = 0;
+
+static int _devmem_open(const char *fn, const char *path);
+static off_t _devmem_offset(off_t win_base);
+static int _sim_open(const char *fn, const char *path);
+static off_t _sim_offset(off_t win_base);
+
+static const _backend_t _backends[] = {
+	[BACKEND_DEVMEM] = { "devmem", _devmem_open, _devmem_offset, 1 },
+	[BACKEND_SIM]    = { "sim",    _sim_open,    _sim_offset,    0 },
+	/* Opened with _broker_connect(), never mapped */
+	[BACKEND_BROKER] = { "broker", NULL,         NULL,           0 },
+};
+
+#define NUM_BACKENDS (sizeof(_backends) / sizeof(_backends[0]))
+
+/* Default design, used by the zynq_init() family of calls */
+static const zynq_gpio_cfg_t _default_gpio[NUM_GPIO] = {
+	{ GPIO0_BASE_ADDRESS, MAX_CHANS },
+	{ GPIO1_BASE_ADDRESS, MAX_CHANS },
+	{ GPIO2_BASE_ADDRESS, MAX_CHANS },
+};
+
+/* Backend used by the next zynq_init(), /dev/mem unless told otherwise */
+static uint32_t _backend_id = BACKEND_DEVMEM;
+static char _backend_path[256] = "";
+
+/* Device driven by the zynq_init() family of calls */
+static zynq_dev_t *_dev = NULL;
+
+/*
+ * Pending zynq_init_async().  Register calls made while _dev is still NULL
+ * look here, _async_lock and _async_cond also guard the handles.
+ */
+static pthread_mutex_t _async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _async_cond = PTHREAD_COND_INITIALIZER;
+static int _async_pending = 0;
+static int _async_block = 0;
+
+struct zynq_init_handle {
+	uint32_t opmode;
+	uint32_t initmode;
+	zynq_init_cb_t cb;
+	void *arg;
+	int rv;
+	int done;
+	int refs;		/* Init thread and caller, see zynq_init_wait() */
+};
 
-/* Macro to shorten log lines */
-#define ERR  if( dbg_lvl & ERROR ) printf
-#define DBG  if( dbg_lvl & DEBUG ) printf
-#define DLOG if( dbg_lvl & DIAG ) printf
+/* Phases of the last open and close, see zynq_get_profile() */
+static zynq_profile_t _prof_init;
+static zynq_profile_t _prof_close;
 
+static void _prof_start(zynq_profile_t *prof)
+{
+	memset(prof, 0, sizeof(*prof));
+	prof->start_ns = _now_ns();
+}
 
-/* Debug level, initial setting set to lowest level */
-static int dbg_lvl = 0;   
+/* Close the phase running since the previous mark */
+static void _prof_mark(zynq_profile_t *prof, const char *name)
+{
+	uint64_t now = _now_ns();
 
-/* Memory file device is closed at initialization */
-static int mem_fd = -1;
+	if (prof->num_phases < PROFILE_MAX_PHASES)
+	{
+		prof->phase[prof->num_phases].name = name;
+		prof->phase[prof->num_phases].ns = now - prof->start_ns - prof->total_ns;
+		prof->num_phases++;
+	}
+
+	prof->total_ns = now - prof->start_ns;
+}
 
-/* TO DO: Review if these are all necessary */
-static void *_mapped_base0;
-static void *_mapped_dev_base0;
-static void *_mapped_base1;
-static void *_mapped_dev_base1;
-static void *_mapped_base2;
-static void *_mapped_dev_base2;
+static void _prof_print(FILE *fp, const char *what, const zynq_profile_t *prof)
+{
+	uint32_t i;
 
-static int _zynq_pl_prog = 0;
-static int _zynq_pl_open = 0;
-static int _zynq_pl_init = 0;
-static int _opmode = 0;
+	fprintf(fp, "%s: %llu us", what, (unsigned long long) prof->total_ns / 1000);
 
-/* Pointers to the starting address of each GPIO */
-static volatile gpio_t *GPIO0 = NULL;
-static volatile gpio_t *GPIO1 = NULL;
-static volatile gpio_t *GPIO2 = NULL;
+	for (i = 0; i < prof->num_phases; i++)
+	{
+		fprintf(fp, ", %s %llu us", prof->phase[i].name, (unsigned long long) prof->phase[i].ns / 1000);
+	}
 
-/* Low level functions */
+	fprintf(fp, "\n");
+}
 
-int _check_offset(const char *fn, uint32_t offset)
+/* _dev while zynq_init_async() runs: wait for it or fail as closed */
+static zynq_dev_t * _async_dev()
 {
-	if (offset > (NUM_GPIO - 1))
+	pthread_mutex_lock(&_async_lock);
+
+	while (_async_pending && _async_block)
 	{
-		ERR("%s: Error, offset=%d out of range...\n", fn, offset);
+		pthread_cond_wait(&_async_cond, &_async_lock);
+	}
+
+	pthread_mutex_unlock(&_async_lock);
+
+	return __atomic_load_n(&_dev, __ATOMIC_ACQUIRE);
+}
+
+/* Device of the zynq_* calls, only an unopened device takes the slow path */
+static inline zynq_dev_t * _cur_dev()
+{
+	zynq_dev_t *dev = __atomic_load_n(&_dev, __ATOMIC_ACQUIRE);
+
+	if (__builtin_expect(dev == NULL && __atomic_load_n(&_async_pending, __ATOMIC_ACQUIRE), 0))
+	{
+		return _async_dev();
+	}
+
+	return dev;
+}
+
+/* Backend functions */
+
+static int _devmem_open(const char *fn, const char *path)
+{
+	int fd;
+
+	if (path == NULL || path[0] == '\0')
+	{
+		path = "/dev/mem";
+	}
+
+	if ( (fd = open(path, O_RDWR | O_SYNC)) == -1)
+	{
+		ERR("%s: Can't open %s...\n", fn, path);
+	}
+
+	return fd;
+}
+
+static off_t _devmem_offset(off_t win_base)
+{
+	return win_base;
+}
+
+/*
+ * Simulated PL: a shared file laid out like the register window, which for
+ * the default design is exactly zynq_mmap_t.  With a path the file can be
+ * opened by other processes to watch or drive the "hardware", without one
+ * an anonymous memfd is used.
+ */
+static int _sim_open(const char *fn, const char *path)
+{
+	int fd;
+
+	if (path != NULL && path[0] != '\0')
+	{
+		fd = open(path, O_RDWR | O_CREAT, 0666);
+	}
+	else
+	{
+#ifdef SYS_memfd_create
+		fd = syscall(SYS_memfd_create, "zynq_sim", 0);
+#else
+		char tmpl[] = "/tmp/zynq_simXXXXXX";
+
+		if ( (fd = mkstemp(tmpl)) != -1)
+		{
+			unlink(tmpl);
+		}
+#endif
+		path = "(anonymous)";
+	}
+
+	if (fd == -1)
+	{
+		ERR("%s: Can't open simulated PL %s...\n", fn, path);
 		return -1;
 	}
 
+	DBG("%s: Simulated PL %s opened...\n", fn, path);
+
+	return fd;
+}
+
+static off_t _sim_offset(off_t win_base)
+{
 	return 0;
 }
 
-volatile gpio_t * _get_gpio (const char *fn, uint32_t offset)
+/* Low level functions */
+
+/* Load the shadow copy of one GPIO from its registers at regs */
+static void _shadow_load_entry(_gpio_entry_t *entry, volatile gpio_t *regs)
 {
-	int rv;
+	uint32_t ch;
 
-	/* Invalid offset, return NULL */
-	if ( (rv = _check_offset(fn, offset)) != 0)
+	for (ch = 0; ch < MAX_CHANS; ch++)
+	{
+		if (entry->chan_mask & (1 << ch))
+		{
+			entry->shadow_data[ch] = regs->ch[ch].data;
+			entry->shadow_tri[ch] = regs->ch[ch].tri;
+		}
+	}
+}
+
+/* Lazy mode, map one GPIO block the first time it is used */
+static volatile gpio_t * _map_gpio(zynq_dev_t *dev, const char *fn, uint32_t offset)
+{
+	_gpio_entry_t *entry = &dev->gpio[offset];
+
+	volatile gpio_t *regs;
+
+	size_t size;
+
+	void *map;
+
+	/*
+	 * Not the GPIO lock, a thread-safe writer holds it when it gets here.
+	 * One thread maps and loads the shadow, nobody can write through regs
+	 * before it is published, so the shadow matches the hardware.
+	 */
+	_spin_lock(&entry->map_lock);
+
+	/* Mapped by another thread meanwhile */
+	if ( (regs = __atomic_load_n(&entry->regs, __ATOMIC_ACQUIRE)) != NULL)
+	{
+		_spin_unlock(&entry->map_lock);
+		return regs;
+	}
+
+	size = ((entry->map_off & MAP_MASK) + sizeof(gpio_t) + MAP_MASK) & ~MAP_MASK;
+	map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, dev->mem_fd, entry->map_off & ~MAP_MASK);
+
+	if (map == MAP_FAILED)
 	{
+		_spin_unlock(&entry->map_lock);
+		ERR("%s: Can't map GPIO%d to user space...\n", fn, offset);
 		return NULL;
 	}
-	
-	switch(offset) {
-		case ID_REV:
-			return GPIO0;
-			break;
-		case CR: 
-			return GPIO1;	
-			break;
-		case DR: 
-			return GPIO2;
-			break;
-		default:
-			/* Invalid offset, return NULL */
-			return NULL;
-			break;
+
+	regs = (volatile gpio_t *) ((char *) map + (entry->map_off & MAP_MASK));
+
+	if (dev->shadow)
+	{
+		_shadow_load_entry(entry, regs);
 	}
 
-	return NULL;
+	entry->map = map;
+	entry->map_size = size;
+
+	__atomic_store_n(&entry->regs, regs, __ATOMIC_RELEASE);
+
+	_spin_unlock(&entry->map_lock);
+
+	DBG("%s: GPIO%d mapped at address %p on first use\n", fn, offset, regs);
+
+	return regs;
+}
+
+volatile gpio_t * _get_gpio (zynq_dev_t *dev, const char *fn, uint32_t offset)
+{
+	volatile gpio_t *regs;
+
+	/* Invalid offset, return NULL */
+	if (offset >= dev->num_gpio)
+	{
+		ERR("%s: Error, offset=%d out of range...\n", fn, offset);
+		return NULL;
+	}
+
+	/* Acquire pairs with the publishing store, the shadow is loaded before it */
+	if (__builtin_expect(dev->lazy, 0))
+	{
+		regs = __atomic_load_n(&dev->gpio[offset].regs, __ATOMIC_ACQUIRE);
+		return regs != NULL ? regs : _map_gpio(dev, fn, offset);
+	}
 
+	/* NULL until the GPIO has been mapped */
+	return dev->gpio[offset].regs;
 }
 
 
-int _write(const  char *fn, uint32_t offset, uint32_t *data, uint32_t channel_mask)
+int _write(zynq_dev_t *dev, const char *fn, uint32_t offset, uint32_t *data, uint32_t channel_mask)
 {
 	volatile gpio_t *gpio;
-	
-	gpio = _get_gpio(fn, offset);
+
+	_gpio_entry_t *entry;
+
+	/* Marks the first record of the call, elided writes leave none */
+	uint32_t call = TRACE_CALL;
+
+	gpio = _get_gpio(dev, fn, offset);
 
 	/* Check to verify gpio has been initialized */
 	if (gpio == NULL)
@@ -118,33 +324,48 @@ int _write(const  char *fn, uint32_t offset, uint32_t *data, uint32_t channel_ma
 		return -1;
 	}
 
+	entry = &dev->gpio[offset];
+
 	/* All error checking done in top level function call, just perform operations here */
 
-	if (channel_mask & CH1_MASK) 
+	if (channel_mask & CH1_MASK)
 	{
-		DBG("%s: Writing to Offset %d, Channel 1, data=0x%8.8x...\n", 
-			fn, offset, data[CH1_INDEX]);
-		/* Write data to Channel 1 */
-		gpio->ch[CH1_INDEX].data = data[CH1_INDEX];
+		/* Shadow mode skips writing the value the register already holds */
+		if (!dev->shadow || entry->shadow_data[CH1_INDEX] != data[CH1_INDEX])
+		{
+			DBG_HOT("%s: Writing to Offset %d, Channel %d, data=0x%8.8x...\n",
+				fn, offset, 1, data[CH1_INDEX]);
+			/* Write data to Channel 1 */
+			gpio->ch[CH1_INDEX].data = data[CH1_INDEX];
+			TRACE(dev, offset, CH1_INDEX, TRACE_WRITE | call, data[CH1_INDEX]);
+			call = 0;
+		}
+		entry->shadow_data[CH1_INDEX] = data[CH1_INDEX];
 	}
 
 	if (channel_mask & CH2_MASK)
 	{
-		DBG("%s: Writing to Offset %d, Channel 2, data=0x%8.8x...\n", 
-			fn, offset, data[CH2_INDEX]);
-		/* Write data to Channel 2 */
-		gpio->ch[CH2_INDEX].data = data[CH2_INDEX];
+		/* Shadow mode skips writing the value the register already holds */
+		if (!dev->shadow || entry->shadow_data[CH2_INDEX] != data[CH2_INDEX])
+		{
+			DBG_HOT("%s: Writing to Offset %d, Channel %d, data=0x%8.8x...\n",
+				fn, offset, 2, data[CH2_INDEX]);
+			/* Write data to Channel 2 */
+			gpio->ch[CH2_INDEX].data = data[CH2_INDEX];
+			TRACE(dev, offset, CH2_INDEX, TRACE_WRITE | call, data[CH2_INDEX]);
+		}
+		entry->shadow_data[CH2_INDEX] = data[CH2_INDEX];
 	}
 
 	return 0;
 }
 
 
-int _read(const char *fn, uint32_t offset, uint32_t *data, uint32_t channel_mask)
+int _read(zynq_dev_t *dev, const char *fn, uint32_t offset, uint32_t *data, uint32_t channel_mask)
 {
 	volatile gpio_t *gpio;
-	
-	gpio = _get_gpio(fn, offset);
+
+	gpio = _get_gpio(dev, fn, offset);
 
 	/* Check to verify gpio has been initialized */
 	if (gpio == NULL)
@@ -158,18 +379,20 @@ int _read(const char *fn, uint32_t offset, uint32_t *data, uint32_t channel_mask
 	if (channel_mask & CH1_MASK)
 	{
 		data[CH1_INDEX] = gpio->ch[CH1_INDEX].data;
+		TRACE(dev, offset, CH1_INDEX, TRACE_CALL, data[CH1_INDEX]);
 
-		DBG("%s: Reading from Offset %d, Channel 1, data=0x%8.8x...\n", 
-			fn, offset, data[CH1_INDEX]);
+		DBG_HOT("%s: Reading from Offset %d, Channel %d, data=0x%8.8x...\n",
+			fn, offset, 1, data[CH1_INDEX]);
 	}
 
 	/* Read Channel 2 to data[CH2_INDEX] */
 	if (channel_mask & CH2_MASK)
 	{
 		data[CH2_INDEX] = gpio->ch[CH2_INDEX].data;
+		TRACE(dev, offset, CH2_INDEX, channel_mask & CH1_MASK ? 0 : TRACE_CALL, data[CH2_INDEX]);
 
-		DBG("%s: Reading from Offset %d, Channel 2, data=0x%8.8x...\n", 
-			fn, offset, data[CH2_INDEX]);
+		DBG_HOT("%s: Reading from Offset %d, Channel %d, data=0x%8.8x...\n",
+			fn, offset, 2, data[CH2_INDEX]);
 	}
 
 	return 0;
@@ -178,11 +401,16 @@ int _read(const char *fn, uint32_t offset, uint32_t *data, uint32_t channel_mask
 
 
 
-int _write_dir(const  char *fn, uint32_t offset, uint32_t *data, uint32_t channel_mask)
+int _write_dir(zynq_dev_t *dev, const char *fn, uint32_t offset, uint32_t *data, uint32_t channel_mask)
 {
 	volatile gpio_t *gpio;
-	
-	gpio = _get_gpio(fn, offset);
+
+	_gpio_entry_t *entry;
+
+	/* Marks the first record of the call, elided writes leave none */
+	uint32_t call = TRACE_CALL;
+
+	gpio = _get_gpio(dev, fn, offset);
 
 	/* Check to verify gpio has been initialized */
 	if (gpio == NULL)
@@ -190,32 +418,47 @@ int _write_dir(const  char *fn, uint32_t offset, uint32_t *data, uint32_t channe
 		return -1;
 	}
 
+	entry = &dev->gpio[offset];
+
 	/* All error checking done in top level function call, just perform operations here */
 
-	if (channel_mask & CH1_MASK) 
+	if (channel_mask & CH1_MASK)
 	{
-		DBG("%s: Writing to Offset %d, Channel 1, tri=0x%8.8x...\n", 
-			fn, offset, data[CH1_INDEX]);
-		/* Write data to Channel 1 */
-		gpio->ch[CH1_INDEX].tri = data[CH1_INDEX];
+		/* Shadow mode skips writing the value the register already holds */
+		if (!dev->shadow || entry->shadow_tri[CH1_INDEX] != data[CH1_INDEX])
+		{
+			DBG_HOT("%s: Writing to Offset %d, Channel %d, tri=0x%8.8x...\n",
+				fn, offset, 1, data[CH1_INDEX]);
+			/* Write data to Channel 1 */
+			gpio->ch[CH1_INDEX].tri = data[CH1_INDEX];
+			TRACE(dev, offset, CH1_INDEX, TRACE_WRITE | TRACE_TRI | call, data[CH1_INDEX]);
+			call = 0;
+		}
+		entry->shadow_tri[CH1_INDEX] = data[CH1_INDEX];
 	}
 
 	if (channel_mask & CH2_MASK)
 	{
-		DBG("%s: Writing to Offset %d, Channel 2, tri=0x%8.8x...\n", 
-			fn, offset, data[CH2_INDEX]);
-		/* Write data to Channel 2 */
-		gpio->ch[CH2_INDEX].tri = data[CH2_INDEX];
+		/* Shadow mode skips writing the value the register already holds */
+		if (!dev->shadow || entry->shadow_tri[CH2_INDEX] != data[CH2_INDEX])
+		{
+			DBG_HOT("%s: Writing to Offset %d, Channel %d, tri=0x%8.8x...\n",
+				fn, offset, 2, data[CH2_INDEX]);
+			/* Write data to Channel 2 */
+			gpio->ch[CH2_INDEX].tri = data[CH2_INDEX];
+			TRACE(dev, offset, CH2_INDEX, TRACE_WRITE | TRACE_TRI | call, data[CH2_INDEX]);
+		}
+		entry->shadow_tri[CH2_INDEX] = data[CH2_INDEX];
 	}
 
 	return 0;
 }
 
-int _read_dir(const char *fn, uint32_t offset, uint32_t *data, uint32_t channel_mask)
+int _read_dir(zynq_dev_t *dev, const char *fn, uint32_t offset, uint32_t *data, uint32_t channel_mask)
 {
 	volatile gpio_t *gpio;
-	
-	gpio = _get_gpio(fn, offset);
+
+	gpio = _get_gpio(dev, fn, offset);
 
 	/* Check to verify gpio has been initialized */
 	if (gpio == NULL)
@@ -225,29 +468,33 @@ int _read_dir(const char *fn, uint32_t offset, uint32_t *data, uint32_t channel_
 
 	/* All error checking done in top level function call, just perform operations here */
 
+	/* Only this process drives the tri registers, with the shadow on answer from it */
+
 	/* Read Channel 1 to data[CH1_INDEX] */
 	if (channel_mask & CH1_MASK)
 	{
-		data[CH1_INDEX] = gpio->ch[CH1_INDEX].tri;
+		data[CH1_INDEX] = dev->shadow ? dev->gpio[offset].shadow_tri[CH1_INDEX] : gpio->ch[CH1_INDEX].tri;
+		TRACE(dev, offset, CH1_INDEX, TRACE_TRI | TRACE_CALL, data[CH1_INDEX]);
 
-		DBG("%s: Reading from Offset %d, Channel 1, tri=0x%8.8x...\n", 
-			fn, offset, data[CH1_INDEX]);
+		DBG_HOT("%s: Reading from Offset %d, Channel %d, tri=0x%8.8x...\n",
+			fn, offset, 1, data[CH1_INDEX]);
 	}
 
 	/* Read Channel 2 to data[CH2_INDEX] */
 	if (channel_mask & CH2_MASK)
 	{
-		data[CH2_INDEX] = gpio->ch[CH2_INDEX].tri;
+		data[CH2_INDEX] = dev->shadow ? dev->gpio[offset].shadow_tri[CH2_INDEX] : gpio->ch[CH2_INDEX].tri;
+		TRACE(dev, offset, CH2_INDEX, TRACE_TRI | (channel_mask & CH1_MASK ? 0 : TRACE_CALL), data[CH2_INDEX]);
 
-		DBG("%s: Reading from Offset %d, Channel 2, tri=0x%8.8x...\n", 
-			fn, offset, data[CH2_INDEX]);
+		DBG_HOT("%s: Reading from Offset %d, Channel %d, tri=0x%8.8x...\n",
+			fn, offset, 2, data[CH2_INDEX]);
 	}
 
 	return 0;
 
 }
 
-int _sw_clock(const char *fn)
+int _sw_clock(zynq_dev_t *dev, const char *fn)
 {
 	int rv = 0;
 
@@ -255,18 +502,18 @@ int _sw_clock(const char *fn)
 
 	DBG("_sw_clock\n");
 
-	data[CH1_INDEX] = 0x00000001;	
-	
+	data[CH1_INDEX] = 0x00000001;
+
 	/* Write 1 followed by 0 to the CH1 of CR to generate clock edge */
 
-	if ( (rv = _write(fn, CR, data, CH1_MASK)) != 0)
+	if ( (rv = _write(dev, fn, CR, data, CH1_MASK)) != 0)
 	{
 		ERR("%s: Error in _write() call, rv=%d...\n", fn, rv);
 		return rv;
 	}
 
 
-	if ( (rv = _read(fn, CR, data, CH1_MASK|CH2_MASK)) != 0)
+	if ( (rv = _read(dev, fn, CR, data, CH1_MASK)) != 0)
 	{
 		ERR("%s: Error in _write() call, rv=%d...\n", fn, rv);
 		return rv;
@@ -274,13 +521,13 @@ int _sw_clock(const char *fn)
 
 	data[CH1_INDEX] = 0x00000000;
 
-	if ( (rv = _write(fn, CR, data, CH1_MASK)) != 0)
+	if ( (rv = _write(dev, fn, CR, data, CH1_MASK)) != 0)
 	{
 		ERR("%s: Error in _write() call, rv=%d...\n", fn, rv);
 		return rv;
 	}
 
-	if ( (rv = _read(fn, CR, data, CH1_MASK|CH2_MASK)) != 0)
+	if ( (rv = _read(dev, fn, CR, data, CH1_MASK)) != 0)
 	{
 		ERR("%s: Error in _write() call, rv=%d...\n", fn, rv);
 		return rv;
@@ -290,598 +537,1772 @@ int _sw_clock(const char *fn)
 
 }
 
-int _pl_program(const char *fn, char *filename)
+/* Current data register contents for a read-modify-write */
+int _read_current(zynq_dev_t *dev, const char *fn, uint32_t offset, uint32_t *data, uint32_t channel_mask)
 {
-	int rv = 0;
+	uint32_t ch;
 
-	char cmd[255] = "cat ";
+	if (!dev->shadow)
+	{
+		return _read(dev, fn, offset, data, channel_mask);
+	}
 
-	if (filename == NULL)
+	/* Maps a lazy GPIO, loading its shadow */
+	if (_get_gpio(dev, fn, offset) == NULL)
 	{
-		DBG("%s: filename==NULL, using default=%s\n", fn, DEFAULT_PL);
-		sprintf(filename, DEFAULT_PL);
+		return -1;
+	}
+
+	/* The shadow holds what was last written, no bus read needed */
+	for (ch = 0; ch < MAX_CHANS; ch++)
+	{
+		if (channel_mask & (1 << ch))
+		{
+			data[ch] = dev->gpio[offset].shadow_data[ch];
+			TRACE(dev, offset, ch, channel_mask & ((1 << ch) - 1) ? 0 : TRACE_CALL, data[ch]);
+		}
 	}
 
-	strcat(cmd, filename);
-	strcat(cmd, " > /dev/xdevcfg");
+	return 0;
+}
 
-	DBG("%s: Executing - %s...\n", fn, cmd);
+/* Reload the shadow copy of every data and tri register from hardware */
+int _shadow_load(zynq_dev_t *dev, const char *fn)
+{
+	_gpio_entry_t *entry;
 
-	_zynq_pl_prog = 0;
+	uint32_t i;
 
-	if ( (rv = system(cmd) != 0))
+	for (i = 0; i < dev->num_gpio; i++)
 	{
-		
-		ERR("%s: ERROR programming the PL...\n", fn);	
-		return rv;
+		entry = &dev->gpio[i];
+
+		/* Lazily mapped GPIOs load their shadow when first mapped */
+		if (entry->regs == NULL && dev->lazy)
+		{
+			continue;
+		}
+
+		if (entry->regs == NULL)
+		{
+			ERR("%s: GPIO%d not mapped...\n", fn, i);
+			return -1;
+		}
+
+		_shadow_load_entry(entry, entry->regs);
 	}
 
-	_zynq_pl_prog = 1;
+	DBG("%s: Shadow registers loaded...\n", fn);
 
 	return 0;
 }
 
-int _pl_check(const char *fn)
+int _set_shadow(zynq_dev_t *dev, const char *fn, int enable)
 {
+	int rv = 0;
 
-	char prog_done[80] = "";
+	if (dev == NULL || dev->open != 1)
+	{
+		ERR("%s: Device not open...\n", fn);
+		return -1;
+	}
 
-	int ret = 0;
+	/* Registers may have changed while the shadow was not in use */
+	if (enable && (rv = _shadow_load(dev, fn)) != 0)
+	{
+		return rv;
+	}
 
-	int plprogdone_fd = -1;
+	dev->shadow = enable != 0;
 
-	DBG("%s: Opening PL fd=%s...\n", fn, PL_PROG_DONE);
+	return 0;
+}
 
-	plprogdone_fd = open(PL_PROG_DONE, O_RDONLY);
-	if (plprogdone_fd == -1)
+/* Validate the common arguments of a top level call */
+int _check_call(zynq_dev_t *dev, const char *fn, uint32_t offset, uint32_t *data, uint32_t channel_mask)
+{
+	if (dev == NULL || dev->open != 1)
 	{
-       		ERR("%s: Can't open fd=%s...\n", fn, PL_PROG_DONE);
-        	return -1;
+		ERR("%s: Device not open...\n", fn);
+		return -1;
 	}
 
-	ret = read(plprogdone_fd, prog_done, 1);
-	prog_done[ret] = '\0';
-	DBG("%s: Closing PL fd=%s...\n", fn, PL_PROG_DONE);
-	close(plprogdone_fd);
-
-	if (prog_done[0] != '1')
+	/* Verify data is not null */
+	if (data == NULL)
 	{
-		ERR("%s: PL not programmed...\n", fn);	
-		_zynq_pl_prog = 0;
-		return -1;	
+		ERR("%s: Data not available...\n", fn);
+		return -1;
 	}
-		
-	else 
+
+	/* Channel 2 of a single channel GPIO, let _get_gpio() report bad offsets */
+	if (offset < dev->num_gpio && (channel_mask & (CH1_MASK|CH2_MASK) & ~dev->gpio[offset].chan_mask))
 	{
-		DBG("%s: PL programmed...\n", fn);
-		_zynq_pl_prog = 1;
+		ERR("%s: Error, channel_mask=0x%x not valid for offset=%d...\n", fn, channel_mask, offset);
+		return -1;
 	}
 
 	return 0;
-
 }
 
-int _pl_open(const char *fn)
+/*
+ * Thread-safe mode: serialize writers of a GPIO.  A test mode write also
+ * strobes CR, so CR is held too, always taken in offset order so two
+ * writers can never wait on each other.  force locks the GPIO even when
+ * not in thread-safe mode, for the bit operations.
+ */
+void _write_lock(zynq_dev_t *dev, uint32_t offset, int force)
 {
+	int clk = dev->threadsafe && dev->opmode && offset != CR && CR < dev->num_gpio;
 
-	int rv = 0;
+	if ((!dev->threadsafe && !force) || offset >= dev->num_gpio)
+	{
+		return;
+	}
 
-	off_t dev_base0 = GPIO0_BASE_ADDRESS;
-	off_t dev_base1 = GPIO1_BASE_ADDRESS;
-	off_t dev_base2 = GPIO2_BASE_ADDRESS;
+	if (clk && CR < offset)
+	{
+		_gpio_lock(&dev->gpio[CR]);
+	}
 
-	int gpio0_open = 0;
-	int gpio1_open = 0;
-	int gpio2_open = 0;
+	_gpio_lock(&dev->gpio[offset]);
 
-	/* Device already open */
-	if (_zynq_pl_open)
+	if (clk && CR > offset)
 	{
-		ERR("%s: Device already opened...\n", fn);
-		rv = -1;
-	}
-		
-	else 
-	{
-		/* Attempt to open the memory device */		
-		mem_fd = open("/dev/mem", O_RDWR | O_SYNC);
-        	if (mem_fd == -1) 
-		{
-        		ERR("%s: Can't open /dev/mem...\n", fn);
-			rv = -1;
-    		}
-
-				
-		/* Map GPIO pointers to memory file device */
-		else 
-		{
-    	
-			DBG("%s: /dev/mem opened...\n", fn);
-			
-			/*** Memory map GPIO0 ***/
-			_mapped_base0 = mmap(0, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, dev_base0 & ~MAP_MASK);
-        
-			if (_mapped_base0 == (void *) -1) 
-			{
-       				ERR("%s: Can't map the memory to user space...\n", fn);
-		        	gpio0_open = 0;
-				GPIO0 = NULL;
-				rv = -1;
-    			
-			}
-				
-			else
-			{
-	   			_mapped_dev_base0 = _mapped_base0 + (dev_base0 & MAP_MASK);				
+		_gpio_lock(&dev->gpio[CR]);
+	}
+}
 
-				/*ZM = (zynq_mmap_t *) mapped_dev_base;*/
-				GPIO0 = (gpio_t *) _mapped_dev_base0;
-				gpio0_open = 1;
-				
-				DBG("%s: Memory mapped at address %p, %p, %p\n", fn, _mapped_base0, _mapped_dev_base0, GPIO0);
-				DBG("%s: FPGAID=%x...\n", fn, GPIO0->ch[CH1_INDEX].data);				
-				DBG("%s: REV=%x...\n", fn, GPIO0->ch[CH2_INDEX].data);
+void _write_unlock(zynq_dev_t *dev, uint32_t offset, int force)
+{
+	if ((!dev->threadsafe && !force) || offset >= dev->num_gpio)
+	{
+		return;
+	}
 
-			}
+	if (dev->threadsafe && dev->opmode && offset != CR && CR < dev->num_gpio)
+	{
+		_gpio_unlock(&dev->gpio[CR]);
+	}
 
+	_gpio_unlock(&dev->gpio[offset]);
+}
 
-			/*** Memory map GPIO1 ***/
-			_mapped_base1 = mmap(0, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, dev_base1 & ~MAP_MASK);
-        
-			if (_mapped_base1 == (void *) -1) 
-			{
-       				ERR("%s: Can't map the memory to user space...\n", fn);
-		        	gpio1_open = 0;
-				GPIO1 = NULL;
-				rv = -1;    			
-			}
-				
-			else
-			{
-	   			_mapped_dev_base1 = _mapped_base1 + (dev_base1 & MAP_MASK);
-				gpio1_open = 1;
-				GPIO1 = (gpio_t *) _mapped_dev_base1;
-				DBG("%s: Memory mapped at address %p, %p, %p\n", fn, _mapped_base1, _mapped_dev_base1, GPIO1);
-			}
+/* Lock or unlock every GPIO a batch writes, plus CR in test mode, in offset order */
+void _write_lock_ops(zynq_dev_t *dev, const zynq_regop_t *ops, uint32_t count, int lock)
+{
+	uint32_t i, j;
+
+	if (!dev->threadsafe)
+	{
+		return;
+	}
 
-			/*** Memory map GPIO2 ***/
-			_mapped_base2 = mmap(0, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, dev_base2 & ~MAP_MASK);
-        
-			if (_mapped_base2 == (void *) -1) 
+	for (i = 0; i < dev->num_gpio; i++)
+	{
+		for (j = 0; j < count && ops[j].offset != i; j++)
+		{
+		}
+
+		if (j < count || (i == CR && dev->opmode))
+		{
+			if (lock)
 			{
-       				ERR("%s: Can't map the memory to user space...\n", fn);
-		        	gpio2_open = 0;
-				GPIO2 = NULL;
-				rv = -1;    			
+				_gpio_lock(&dev->gpio[i]);
 			}
-				
 			else
 			{
-	   			_mapped_dev_base2 = _mapped_base2 + (dev_base2 & MAP_MASK);			
-				gpio2_open = 1;
-				GPIO2 = (gpio_t *) _mapped_dev_base2;
-				DBG("%s: Memory mapped at address %p, %p, %p\n", fn, _mapped_base2, _mapped_dev_base2, GPIO2);
+				_gpio_unlock(&dev->gpio[i]);
 			}
-
 		}
-
 	}
+}
 
-	/* Error occurred during memory mapping any one of the GPIOs */
-	if (!gpio0_open || !gpio1_open || !gpio2_open)
+/* Data write followed, in test mode, by the clock strobe */
+int _write_clocked(zynq_dev_t *dev, const char *fn, uint32_t offset, uint32_t *data, uint32_t channel_mask)
+{
+	int rv = -1;
+
+	if ( (rv = _write(dev, fn, offset, data, channel_mask)) != 0)
 	{
-		_zynq_pl_open = 0;
+		ERR("%s: Error in _write() call, rv=%d...\n", fn, rv);
+		return rv;
 	}
 
-	/* No error, ZYNQ PL is now considered operational */
-	else
+	/* If test mode, need to generate clock signal */
+	if (dev->opmode)
 	{
-		_zynq_pl_open = 1;
+
+		if ( (rv = _sw_clock(dev, fn)) != 0)
+		{
+			ERR("%s: Error in _sw_clock() call, rv=%d...\n", fn, rv);
+			return rv;
+		}
+
 	}
 
-	return rv;
+	return 0;
 }
 
-int _pl_close(const char *fn)
+int _pl_program(const _backend_t *backend, const char *fn, const char *filename, uint32_t initmode)
 {
+	int rv = 0;
 
-	if (munmap(_mapped_base0, MAP_SIZE) == -1) 
-	{
-        	ERR("%s: GPIO0 - Can't unmap memory from user space...\n", fn);
-	        return -1;
-    	}
+	zynq_pl_stats_t stats;
 
-	if (munmap(_mapped_base1, MAP_SIZE) == -1) 
+	if (!backend->has_pl)
 	{
-        	ERR("%s: GPIO1 - Can't unmap memory from user space...\n", fn);
-	        return -1;
-    	}
+		DBG("%s: %s backend, nothing to program...\n", fn, backend->name);
+		return 0;
+	}
 
-	if (munmap(_mapped_base2, MAP_SIZE) == -1) 
+	if (filename == NULL)
 	{
-        	ERR("%s: GPIO2 - Can't unmap memory from user space...\n", fn);
-	        return -1;
-    	}
- 
-    	close(mem_fd);
-	
-	GPIO0 = NULL;
-	GPIO1 = NULL;
-	GPIO2 = NULL;
+		DBG("%s: filename==NULL, using default=%s\n", fn, DEFAULT_PL);
+		filename = DEFAULT_PL;
+	}
 
-	_zynq_pl_init = 0;
-	_zynq_pl_open = 0;
+	/* Skipped when the state file shows this image is still loaded */
+	if ( (rv = zynq_pl_program(filename, PL_XDEVCFG, PL_PROG_DONE, PL_STATE_FILE, PL_DONE_TIMEOUT_MS,
+		(initmode & INIT_FORCE_PROG) != 0, &stats)) != 0)
+	{
+		ERR("%s: ERROR programming the PL...\n", fn);
+		return rv;
+	}
 
-	DBG("%s: Unmap memory successful...\n", fn);
+	DBG("%s: %s %llu bytes in %llu us...\n", fn, stats.cached ? "Already loaded," : "Programmed",
+		(unsigned long long) stats.bytes, (unsigned long long) stats.total_ns / 1000);
 
 	return 0;
 }
 
-
-int zynq_set_debug_level(int debug)
+int _pl_check(const _backend_t *backend, const char *fn)
 {
-	dbg_lvl = debug;
-	return 0;
-}
 
-int zynq_get_debug_level()
-{
-	return dbg_lvl;
-}
+	char prog_done[80] = "";
 
+	int ret = 0;
 
-int zynq_init(uint32_t opmode, uint32_t initmode)
-{
-	char *fn = "zynq_init";
+	int plprogdone_fd = -1;
 
-	int rv = 0;
+	if (!backend->has_pl)
+	{
+		DBG("%s: %s backend, PL always programmed...\n", fn, backend->name);
+		return 0;
+	}
 
-	uint32_t data[MAX_CHANS];
+	DBG("%s: Opening PL fd=%s...\n", fn, PL_PROG_DONE);
 
-	DBG("%s: ", fn);
+	plprogdone_fd = open(PL_PROG_DONE, O_RDONLY);
+	if (plprogdone_fd == -1)
+	{
+       		ERR("%s: Can't open fd=%s...\n", fn, PL_PROG_DONE);
+        	return -1;
+	}
 
-	if (initmode & INIT_PROG_MODE)
+	ret = read(plprogdone_fd, prog_done, 1);
+	prog_done[ret > 0 ? ret : 0] = '\0';
+	DBG("%s: Closing PL fd=%s...\n", fn, PL_PROG_DONE);
+	close(plprogdone_fd);
+
+	if (prog_done[0] != '1')
 	{
+		ERR("%s: PL not programmed...\n", fn);
+		return -1;
+	}
 
-		if ( (rv = _pl_program(fn, (char *)DEFAULT_PL)) != 0)
-		{
-			ERR("%s: Error in _pl_program(%s) call, rv=%d...\n", 
-				fn, (char *)DEFAULT_PL, rv);
-			return rv;
-		}
+	else
+	{
+		DBG("%s: PL programmed...\n", fn);
+	}
+
+	return 0;
 
+}
+
+int _pl_open(zynq_dev_t *dev, const char *fn, const zynq_dev_cfg_t *cfg)
+{
+	off_t win_base, win_end, map_base;
+	uint32_t i;
 
+	/* Device already open */
+	if (dev->open)
+	{
+		ERR("%s: Device already opened...\n", fn);
+		return -1;
 	}
 
-	/* Memory map Zynq PL */
-	if (initmode & INIT_OPEN_MODE)
+	/* The register window spans every GPIO block of the design */
+	win_base = cfg->gpio[0].base;
+	win_end = cfg->gpio[0].base + sizeof(gpio_t);
+	for (i = 1; i < cfg->num_gpio; i++)
 	{
-		if ( (rv = _pl_check(fn)) != 0)
+		if (cfg->gpio[i].base < win_base)
 		{
-			ERR("%s: Error in _pl_check() call rv=%d...\n", fn, rv);
-			return rv;
+			win_base = cfg->gpio[i].base;
 		}
-
-		if ( (rv = _pl_open(fn)) != 0)
+		if (cfg->gpio[i].base + sizeof(gpio_t) > win_end)
 		{
-			ERR("%s: Error in _pl_open() call rv=%d...\n", fn, rv);
-			return rv;
+			win_end = cfg->gpio[i].base + sizeof(gpio_t);
 		}
-
 	}
 
-	if ((opmode == OP_TEST_MODE) && _zynq_pl_open)
+	/* Attempt to open the memory device */
+	if ( (dev->mem_fd = dev->backend->open(fn, cfg->path)) == -1)
 	{
+		return -1;
+	}
 
-		data[CH1_INDEX] = 0x00000000;
-		data[CH2_INDEX] = 0x00000000;
-		
-/*		if ( (rv = zynq_set_gpio_direction(CR, data, CH1_MASK|CH2_MASK)) != 0)*/
+	DBG("%s: %s backend opened...\n", fn, dev->backend->name);
+	_prof_mark(&_prof_init, "backend_open");
 
-		if ( (rv = _write_dir(fn, CR, data, CH1_MASK|CH2_MASK)) != 0)
-		{
-			ERR("%s: Error in zynq_set_gpio_direction() call, rv=%d...\n", fn, rv);
-			return rv;
-		}
-	
-		data[CH1_INDEX] = 0x00000000;
-		data[CH2_INDEX] = opmode;
-/*	data[CH2_INDEX] = 0x00000000;*/
+	/* Grow (never shrink) a simulated PL file to cover the window */
+	if (!dev->backend->has_pl && lseek(dev->mem_fd, 0, SEEK_END) < win_end - win_base &&
+		ftruncate(dev->mem_fd, win_end - win_base) == -1)
+	{
+		ERR("%s: Can't size simulated PL...\n", fn);
+		close(dev->mem_fd);
+		dev->mem_fd = -1;
+		return -1;
+	}
 
-		_opmode = opmode;
-		
-		if ( (rv = _write(fn, CR, data, CH1_MASK|CH2_MASK)) != 0)
-		{
-			ERR("%s: Error in _write() call, rv=%d...\n", fn, rv);
-			return rv;
-		}
+	map_base = dev->backend->offset(win_base);
 
+	for (i = 0; i < dev->num_gpio; i++)
+	{
+		dev->gpio[i].map_off = map_base + (cfg->gpio[i].base - win_base);
+		dev->gpio[i].chan_mask = cfg->gpio[i].num_chans > 1 ? CH1_MASK|CH2_MASK : CH1_MASK;
 	}
 
-	
-	/* Only set _zynq_pl_init if no errors occurrd */
-	if (rv != 0)
+	if (dev->lazy)
 	{
-		_zynq_pl_init = 0;
+		DBG("%s: %d GPIOs mapped on first use...\n", fn, dev->num_gpio);
+		dev->open = 1;
+		return 0;
 	}
-	
-	else
+
+	/* One mapping for every GPIO */
+	dev->mapped_size = ((map_base & MAP_MASK) + (win_end - win_base) + MAP_MASK) & ~MAP_MASK;
+	dev->mapped_base = mmap(0, dev->mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, dev->mem_fd, map_base & ~MAP_MASK);
+
+	if (dev->mapped_base == MAP_FAILED)
 	{
-		_zynq_pl_init = 1;
+		ERR("%s: Can't map the memory to user space...\n", fn);
+		dev->mapped_base = NULL;
+		dev->mapped_size = 0;
+		close(dev->mem_fd);
+		dev->mem_fd = -1;
+		return -1;
+	}
 
+	for (i = 0; i < dev->num_gpio; i++)
+	{
+		dev->gpio[i].regs = (volatile gpio_t *) ((char *) dev->mapped_base + (map_base & MAP_MASK) +
+			(cfg->gpio[i].base - win_base));
+		DBG("%s: GPIO%d (0x%8.8x) mapped at address %p\n", fn, i, cfg->gpio[i].base, dev->gpio[i].regs);
 	}
 
-	return rv;
+	_prof_mark(&_prof_init, "map");
 
-}
+	DBG("%s: FPGAID=%x...\n", fn, dev->gpio[ID_REV].regs->ch[CH1_INDEX].data);
+	DBG("%s: REV=%x...\n", fn, dev->gpio[ID_REV].regs->ch[CH2_INDEX].data);
 
+	/* No error, ZYNQ PL is now considered operational */
+	dev->open = 1;
 
-int zynq_set_gpio_direction(uint32_t offset, uint32_t *direction, uint32_t channel_mask)
+	return 0;
+}
+
+int _pl_close(zynq_dev_t *dev, const char *fn)
 {
-	char *fn = "zynq_set_gpio_direction";
+	uint32_t i;
 
-	if (_zynq_pl_open != 1) 
+	if (dev == NULL || !dev->open)
 	{
 		ERR("%s: Device not open...\n", fn);
 		return -1;
 	}
 
-	return _write_dir(fn, offset, direction, channel_mask);
-}
+	for (i = 0; i < dev->num_gpio; i++)
+	{
+		dev->gpio[i].regs = NULL;
 
-int zynq_get_gpio_direction(uint32_t offset, uint32_t *direction, uint32_t channel_mask)
-{
-	char *fn = "zynq_get_gpio_direction";
+		if (dev->gpio[i].map != NULL)
+		{
+			munmap(dev->gpio[i].map, dev->gpio[i].map_size);
+			dev->gpio[i].map = NULL;
+		}
+	}
 
-	if (_zynq_pl_open != 1) 
+	if (dev->mapped_base != NULL && munmap(dev->mapped_base, dev->mapped_size) == -1)
 	{
-		ERR("%s: Device not open...\n", fn);
+		ERR("%s: Can't unmap memory from user space...\n", fn);
 		return -1;
 	}
 
-	return _read_dir(fn, offset, direction, channel_mask);
-	
+	dev->mapped_base = NULL;
+	dev->mapped_size = 0;
+	_prof_mark(&_prof_close, "unmap");
+
+	close(dev->mem_fd);
+	dev->mem_fd = -1;
+	_prof_mark(&_prof_close, "backend_close");
+
+	dev->init = 0;
+	dev->open = 0;
+	dev->opmode = OP_NORMAL_MODE;
+
+	DBG("%s: Unmap memory successful...\n", fn);
+
+	return 0;
 }
 
-int zynq_write(uint32_t offset, uint32_t *data, uint32_t channel_mask)
+int _dev_init(zynq_dev_t *dev, const char *fn, uint32_t opmode)
 {
-	char *fn = "zynq_write";
+	int rv = 0;
 
-	int rv = -1;
+	uint32_t data[MAX_CHANS];
 
-	if (_zynq_pl_open != 1) 
-	{
-		ERR("%s: Device not open...\n", fn);
-		return -1;
-	}
-	
-	/* Verify data is not null */
-	if (data == NULL)
-	{
-		ERR("%s: Data not available to write...\n", fn);
-		return -1;
-	}
-	
-	if ( (rv = _write(fn, offset, data, channel_mask)) != 0)
+	if (opmode == OP_TEST_MODE)
 	{
-		ERR("%s: Error in _write() call, rv=%d...\n", fn, rv);
-		return rv;
-	}
 
-	/* If test mode, need to generate clock signal */
-	if (_opmode)
-	{
+		data[CH1_INDEX] = 0x00000000;
+		data[CH2_INDEX] = 0x00000000;
+
+/*		if ( (rv = zynq_set_gpio_direction(CR, data, CH1_MASK|CH2_MASK)) != 0)*/
 
-		if ( (rv = _sw_clock(fn)) != 0)
+		if ( (rv = _write_dir(dev, fn, CR, data, CH1_MASK|CH2_MASK)) != 0)
 		{
-			ERR("%s: Error in _sw_clock() call, rv=%d...\n", fn, rv);
+			ERR("%s: Error in zynq_set_gpio_direction() call, rv=%d...\n", fn, rv);
+			return rv;
+		}
+
+		data[CH1_INDEX] = 0x00000000;
+		data[CH2_INDEX] = opmode;
+/*	data[CH2_INDEX] = 0x00000000;*/
+
+		dev->opmode = opmode;
+
+		if ( (rv = _write(dev, fn, CR, data, CH1_MASK|CH2_MASK)) != 0)
+		{
+			ERR("%s: Error in _write() call, rv=%d...\n", fn, rv);
 			return rv;
 		}
 
 	}
 
+	/* Only reached if no errors occurred */
+	dev->init = 1;
+
 	return 0;
 }
 
-int zynq_write_lw(uint32_t offset, uint32_t *data, uint32_t channel_mask)
+zynq_dev_t * _dev_open(const char *fn, const zynq_dev_cfg_t *cfg, uint32_t opmode, uint32_t initmode)
 {
-	char *fn = "zynq_write_lw";
+	int rv = 0;
 
-	int rv = -1;
+	zynq_dev_t *dev;
 
-	uint32_t tmp_data[MAX_CHANS];
+	uint32_t i;
 
-	if (_zynq_pl_open != 1) 
+	if (cfg == NULL || cfg->num_gpio == 0 || cfg->gpio == NULL)
 	{
-		ERR("%s: Device not open...\n", fn);
-		return -1;
+		ERR("%s: Error, no GPIOs configured...\n", fn);
+		return NULL;
 	}
 
-	/* Verify data is not null */
-	if (data == NULL)
+	if (cfg->backend >= NUM_BACKENDS)
 	{
-		ERR("%s: Data not available to write...\n", fn);
-		return -1;
+		ERR("%s: Error, backend=%d out of range...\n", fn, cfg->backend);
+		return NULL;
 	}
 
-	/* Read current in gpio registers to tmp_data */
-	if ( (rv = _read(fn, offset, tmp_data, channel_mask)) != 0)
+	/* The broker owns the design, its GPIO layout replaces cfg->gpio */
+	if (cfg->backend == BACKEND_BROKER)
 	{
-		ERR("%s: Error in _read() call, rv=%d...\n", fn, rv);
-		return rv;
+		dev = _broker_connect(fn, cfg->path, opmode, initmode);
+		_prof_mark(&_prof_init, "broker_connect");
+		return dev;
 	}
 
-	/* Put current upper word data with lower word data into tmp_data */
-	tmp_data[CH1_INDEX] = (tmp_data[CH1_INDEX] & UW_MASK) | (data[CH1_INDEX] & LW_MASK);
-	tmp_data[CH2_INDEX] = (tmp_data[CH2_INDEX] & UW_MASK) | (data[CH2_INDEX] & LW_MASK);
+	/* The test mode clock is generated on the CR GPIO */
+	if (opmode == OP_TEST_MODE && cfg->num_gpio <= CR)
+	{
+		ERR("%s: Error, test mode needs a CR GPIO...\n", fn);
+		return NULL;
+	}
 
-	if ( (rv = _write(fn, offset, tmp_data, channel_mask)) != 0)
+	for (i = 0; i < cfg->num_gpio; i++)
 	{
-		ERR("%s: Error in _write() call, rv=%d...\n", fn, rv);
-		return rv;
+		if (cfg->gpio[i].num_chans < 1 || cfg->gpio[i].num_chans > MAX_CHANS)
+		{
+			ERR("%s: Error, GPIO%d num_chans=%d out of range...\n", fn, i, cfg->gpio[i].num_chans);
+			return NULL;
+		}
 	}
 
-	/* If test mode, need to generate clock signal */
-	if (_opmode)
+	if ( (dev = calloc(1, sizeof(*dev))) == NULL ||
+		(dev->gpio = calloc(cfg->num_gpio, sizeof(*dev->gpio))) == NULL)
+	{
+		ERR("%s: Can't allocate device...\n", fn);
+		free(dev);
+		return NULL;
+	}
+
+	dev->backend = &_backends[cfg->backend];
+	dev->mem_fd = -1;
+	dev->num_gpio = cfg->num_gpio;
+	dev->threadsafe = (initmode & INIT_THREADSAFE_MODE) != 0;
+	dev->lazy = (initmode & INIT_LAZY_MODE) != 0;
+
+	if (initmode & INIT_PROG_MODE)
 	{
 
-		DBG("%s: ", fn);
-		if ( (rv = _sw_clock(fn)) != 0)
+		if ( (rv = _pl_program(dev->backend, fn, cfg->bitstream, initmode)) != 0)
 		{
-			ERR("%s: Error in _sw_clock() call, rv=%d...\n", fn, rv);
-			return rv;
+			ERR("%s: Error in _pl_program(%s) call, rv=%d...\n",
+				fn, cfg->bitstream ? cfg->bitstream : DEFAULT_PL, rv);
 		}
 
+		_prof_mark(&_prof_init, "program");
 	}
-	
-	return 0;
 
-}
+	/* Memory map Zynq PL */
+	if (rv == 0 && (rv = _pl_check(dev->backend, fn)) != 0)
+	{
+		ERR("%s: Error in _pl_check() call rv=%d...\n", fn, rv);
+	}
 
-int zynq_write_uw(uint32_t offset, uint32_t *data, uint32_t channel_mask)
-{
-	char *fn = "zynq_write_uw";
+	_prof_mark(&_prof_init, "prog_done");
 
-	int rv = -1;
+	if (rv == 0 && (rv = _pl_open(dev, fn, cfg)) != 0)
+	{
+		ERR("%s: Error in _pl_open() call rv=%d...\n", fn, rv);
+	}
 
-	uint32_t tmp_data[MAX_CHANS];
+	if (rv == 0 && (initmode & INIT_SHADOW_MODE))
+	{
+		if ( (rv = _set_shadow(dev, fn, 1)) != 0)
+		{
+			ERR("%s: Error in _set_shadow() call rv=%d...\n", fn, rv);
+			_pl_close(dev, fn);
+		}
+
+		_prof_mark(&_prof_init, "shadow");
+	}
 
-	if (_zynq_pl_open != 1) 
+	if (rv == 0 && (rv = _dev_init(dev, fn, opmode)) != 0)
 	{
-		ERR("%s: Device not open...\n", fn);
-		return -1;
+		ERR("%s: Error in _dev_init() call rv=%d...\n", fn, rv);
+		_pl_close(dev, fn);
 	}
 
-	/* Verify data is not null */
-	if (data == NULL)
+	if (rv != 0)
 	{
-		ERR("%s: Data not available to write...\n", fn);
-		return -1;
+		free(dev->gpio);
+		free(dev);
+		return NULL;
 	}
 
-	/* Read current in gpio registers to tmp_data */
-	if ( (rv = _read(fn, offset, tmp_data, channel_mask)) != 0)
+	_prof_mark(&_prof_init, "dev_init");
+
+	if (_zynq_dbg_lvl & DEBUG)
 	{
-		ERR("%s: Error in _read() call, rv=%d...\n", fn, rv);
-		return rv;
+		_prof_print(stdout, fn, &_prof_init);
 	}
 
-	/* Put current upper word data with lower word data into tmp_data */
-	tmp_data[CH1_INDEX] = (data[CH1_INDEX] & UW_MASK) | (tmp_data[CH1_INDEX] & LW_MASK);
-	tmp_data[CH2_INDEX] = (data[CH2_INDEX] & UW_MASK) | (tmp_data[CH2_INDEX] & LW_MASK);
+	return dev;
+}
+
+int _dev_close(zynq_dev_t *dev, const char *fn)
+{
+	int rv = 0;
 
-	if ( (rv = _write(fn, offset, tmp_data, channel_mask)) != 0)
+	_prof_start(&_prof_close);
+
+	if (dev != NULL && dev->broker != NULL)
 	{
-		ERR("%s: Error in _write() call, rv=%d...\n", fn, rv);
-		return rv;
+		_broker_disconnect(dev);
+		_prof_mark(&_prof_close, "broker_disconnect");
 	}
 
-	/* If test mode, need to generate clock signal */
-	if (_opmode)
+	else if ( (rv = _pl_close(dev, fn)) != 0)
 	{
+		ERR("%s: Error in _pl_close() call, rv=%d...\n", fn, rv);
+		return rv;
+	}
 
-		if ( (rv = _sw_clock(fn)) != 0)
-		{
-			ERR("%s: Error in _sw_clock() call, rv=%d...\n", fn, rv);
-			return rv;
-		}
+	_trace_free(dev);
+	_stats_free(dev);
+	free(dev->gpio);
+	free(dev);
+
+	_prof_mark(&_prof_close, "free");
 
+	if (_zynq_dbg_lvl & DEBUG)
+	{
+		_prof_print(stdout, fn, &_prof_close);
 	}
 
 	return 0;
-
 }
 
+/* Top level operations, shared by the zynq_* and zynq_dev_* calls */
 
-int zynq_read(uint32_t offset, uint32_t *data, uint32_t channel_mask)
+int _zynq_set_gpio_direction(zynq_dev_t *dev, const char *fn, uint32_t offset, uint32_t *direction, uint32_t channel_mask)
 {
-	char *fn = "zynq_read";
-
 	int rv = -1;
-	
-	if (_zynq_pl_open != 1) 
+
+	if (_check_call(dev, fn, offset, direction, channel_mask) != 0)
 	{
-		ERR("%s: Device not open...\n", fn);
 		return -1;
 	}
 
-	if ( (rv = _read(fn, offset, data, channel_mask)) != 0)
+	if (dev->broker != NULL)
 	{
-		ERR("%s: Error in _read() call, rv=%d...\n", fn, rv);
-		return rv;
+		return _broker_call(dev, fn, BROKER_SET_DIR, offset, channel_mask, direction);
 	}
 
-	data[CH1_INDEX] = data[CH1_INDEX] & (UW_MASK | LW_MASK);
-	data[CH2_INDEX] = data[CH2_INDEX] & (UW_MASK | LW_MASK);
+	/* Keeps the tri shadow in step with concurrent tri bit operations */
+	_write_lock(dev, offset, 0);
+	rv = _write_dir(dev, fn, offset, direction, channel_mask);
+	_write_unlock(dev, offset, 0);
 
-	return 0;
+	return rv;
 }
 
-
-int zynq_read_lw(uint32_t offset, uint32_t *data, uint32_t channel_mask)
+int _zynq_get_gpio_direction(zynq_dev_t *dev, const char *fn, uint32_t offset, uint32_t *direction, uint32_t channel_mask)
 {
-	char *fn = "zynq_read_mask";
+	if (_check_call(dev, fn, offset, direction, channel_mask) != 0)
+	{
+		return -1;
+	}
 
-	int rv = -1;
+	if (dev->broker != NULL)
+	{
+		return _broker_call(dev, fn, BROKER_GET_DIR, offset, channel_mask, direction);
+	}
+
+	return _read_dir(dev, fn, offset, direction, channel_mask);
+
+}
 
+int _zynq_write(zynq_dev_t *dev, const char *fn, uint32_t offset, uint32_t *data, uint32_t channel_mask)
+{
+	int rv = -1;
 
-	if (_zynq_pl_open != 1) 
+	if (_check_call(dev, fn, offset, data, channel_mask) != 0)
 	{
-		ERR("%s: Device not open...\n", fn);
 		return -1;
 	}
 
-	if ( (rv = _read(fn, offset, data, channel_mask)) != 0)
+	if (dev->broker != NULL)
 	{
-		ERR("%s: Error in _read() call, rv=%d...\n", fn, rv);
-		return rv;
+		return _broker_call(dev, fn, BROKER_WRITE, offset, channel_mask, data);
 	}
 
-	data[CH1_INDEX] = data[CH1_INDEX] & LW_MASK;
-	data[CH2_INDEX] = data[CH2_INDEX] & LW_MASK;
-	
-	return 0;
+	_write_lock(dev, offset, 0);
+	rv = _write_clocked(dev, fn, offset, data, channel_mask);
+	_write_unlock(dev, offset, 0);
 
+	return rv;
 }
 
-int zynq_read_uw(uint32_t offset, uint32_t *data, uint32_t channel_mask)
+int _zynq_write_lw(zynq_dev_t *dev, const char *fn, uint32_t offset, uint32_t *data, uint32_t channel_mask)
 {
-	char *fn = "zynq_read_mask";
-
 	int rv = -1;
 
-	if (_zynq_pl_open != 1) 
+	uint32_t tmp_data[MAX_CHANS];
+
+	if (_check_call(dev, fn, offset, data, channel_mask) != 0)
 	{
-		ERR("%s: Device not open...\n", fn);
 		return -1;
 	}
 
-	if ( (rv = _read(fn, offset, data, channel_mask)) != 0)
+	if (dev->broker != NULL)
+	{
+		return _broker_call(dev, fn, BROKER_WRITE_LW, offset, channel_mask, data);
+	}
+
+	/* The read, merge and write must not interleave with another writer */
+	_write_lock(dev, offset, 0);
+
+	/* Read current in gpio registers to tmp_data */
+	if ( (rv = _read_current(dev, fn, offset, tmp_data, channel_mask)) != 0)
 	{
 		ERR("%s: Error in _read() call, rv=%d...\n", fn, rv);
-		return -1;
 	}
 
-	data[CH1_INDEX] = data[CH1_INDEX] & UW_MASK;
-	data[CH2_INDEX] = data[CH2_INDEX] & UW_MASK;
+	else
+	{
+		/* Put current upper word data with lower word data into tmp_data */
+		tmp_data[CH1_INDEX] = (tmp_data[CH1_INDEX] & UW_MASK) | (data[CH1_INDEX] & LW_MASK);
+		tmp_data[CH2_INDEX] = (tmp_data[CH2_INDEX] & UW_MASK) | (data[CH2_INDEX] & LW_MASK);
 
-	return 0;
+		rv = _write_clocked(dev, fn, offset, tmp_data, channel_mask);
+	}
+
+	_write_unlock(dev, offset, 0);
+
+	return rv;
 
 }
 
-int zynq_close()
+int _zynq_write_uw(zynq_dev_t *dev, const char *fn, uint32_t offset, uint32_t *data, uint32_t channel_mask)
 {
-	char *fn = "zynq_close";
+	int rv = -1;
 
-	int rv = 0;
+	uint32_t tmp_data[MAX_CHANS];
 
-	if ( (rv = _pl_close(fn)) != 0)
+	if (_check_call(dev, fn, offset, data, channel_mask) != 0)
 	{
-		ERR("%s: Error in _pl_close() call, rv=%d...\n", fn, rv);
+		return -1;
+	}
+
+	if (dev->broker != NULL)
+	{
+		return _broker_call(dev, fn, BROKER_WRITE_UW, offset, channel_mask, data);
+	}
+
+	/* The read, merge and write must not interleave with another writer */
+	_write_lock(dev, offset, 0);
+
+	/* Read current in gpio registers to tmp_data */
+	if ( (rv = _read_current(dev, fn, offset, tmp_data, channel_mask)) != 0)
+	{
+		ERR("%s: Error in _read() call, rv=%d...\n", fn, rv);
+	}
+
+	else
+	{
+		/* Put current lower word data with upper word data into tmp_data */
+		tmp_data[CH1_INDEX] = (data[CH1_INDEX] & UW_MASK) | (tmp_data[CH1_INDEX] & LW_MASK);
+		tmp_data[CH2_INDEX] = (data[CH2_INDEX] & UW_MASK) | (tmp_data[CH2_INDEX] & LW_MASK);
+
+		rv = _write_clocked(dev, fn, offset, tmp_data, channel_mask);
+	}
+
+	_write_unlock(dev, offset, 0);
+
+	return rv;
+
+}
+
+
+int _zynq_read(zynq_dev_t *dev, const char *fn, uint32_t offset, uint32_t *data, uint32_t channel_mask)
+{
+	int rv = -1;
+
+	if (_check_call(dev, fn, offset, data, channel_mask) != 0)
+	{
+		return -1;
+	}
+
+	if (dev->broker != NULL)
+	{
+		return _broker_call(dev, fn, BROKER_READ, offset, channel_mask, data);
+	}
+
+	if ( (rv = _read(dev, fn, offset, data, channel_mask)) != 0)
+	{
+		ERR("%s: Error in _read() call, rv=%d...\n", fn, rv);
+		return rv;
+	}
+
+	data[CH1_INDEX] = data[CH1_INDEX] & (UW_MASK | LW_MASK);
+	data[CH2_INDEX] = data[CH2_INDEX] & (UW_MASK | LW_MASK);
+
+	return 0;
+}
+
+
+int _zynq_read_lw(zynq_dev_t *dev, const char *fn, uint32_t offset, uint32_t *data, uint32_t channel_mask)
+{
+	int rv = -1;
+
+	if (_check_call(dev, fn, offset, data, channel_mask) != 0)
+	{
+		return -1;
+	}
+
+	if (dev->broker != NULL)
+	{
+		return _broker_call(dev, fn, BROKER_READ_LW, offset, channel_mask, data);
+	}
+
+	if ( (rv = _read(dev, fn, offset, data, channel_mask)) != 0)
+	{
+		ERR("%s: Error in _read() call, rv=%d...\n", fn, rv);
+		return rv;
+	}
+
+	data[CH1_INDEX] = data[CH1_INDEX] & LW_MASK;
+	data[CH2_INDEX] = data[CH2_INDEX] & LW_MASK;
+
+	return 0;
+
+}
+
+int _zynq_read_uw(zynq_dev_t *dev, const char *fn, uint32_t offset, uint32_t *data, uint32_t channel_mask)
+{
+	int rv = -1;
+
+	if (_check_call(dev, fn, offset, data, channel_mask) != 0)
+	{
+		return -1;
+	}
+
+	if (dev->broker != NULL)
+	{
+		return _broker_call(dev, fn, BROKER_READ_UW, offset, channel_mask, data);
+	}
+
+	if ( (rv = _read(dev, fn, offset, data, channel_mask)) != 0)
+	{
+		ERR("%s: Error in _read() call, rv=%d...\n", fn, rv);
+		return -1;
+	}
+
+	data[CH1_INDEX] = data[CH1_INDEX] & UW_MASK;
+	data[CH2_INDEX] = data[CH2_INDEX] & UW_MASK;
+
+	return 0;
+
+}
+
+/* Read-modify-write of the bits in mask, atomic with respect to other bit operations */
+int _zynq_modify_bits(zynq_dev_t *dev, const char *fn, uint32_t offset, uint32_t channel,
+	uint32_t tri, uint32_t op, uint32_t mask)
+{
+	int rv = -1;
+
+	uint32_t data[MAX_CHANS];
+
+	if (channel >= MAX_CHANS || _check_call(dev, fn, offset, data, 1 << channel) != 0 ||
+		offset >= dev->num_gpio)
+	{
+		ERR("%s: Error, invalid offset=%d or channel=%d...\n", fn, offset, channel);
+		return -1;
+	}
+
+	if (dev->broker != NULL)
+	{
+		data[CH1_INDEX] = mask;
+		return _broker_call(dev, fn, BROKER_BITS, offset, BROKER_BITS_ARG(channel, tri, op), data);
+	}
+
+	_write_lock(dev, offset, 1);
+
+	/* One bus read at most, none when the shadow holds the value */
+	if (tri)
+	{
+		rv = _read_dir(dev, fn, offset, data, 1 << channel);
+	}
+	else
+	{
+		rv = _read_current(dev, fn, offset, data, 1 << channel);
+	}
+
+	if (rv == 0)
+	{
+		switch (op)
+		{
+			case BITS_SET:
+				data[channel] |= mask;
+				break;
+			case BITS_CLEAR:
+				data[channel] &= ~mask;
+				break;
+			default:
+				data[channel] ^= mask;
+				break;
+		}
+
+		if (tri)
+		{
+			rv = _write_dir(dev, fn, offset, data, 1 << channel);
+		}
+		else
+		{
+			rv = _write(dev, fn, offset, data, 1 << channel);
+
+			/* If test mode, need to generate clock signal */
+			if (rv == 0 && dev->opmode)
+			{
+				rv = _sw_clock(dev, fn);
+			}
+		}
+	}
+
+	_write_unlock(dev, offset, 1);
+
+	if (rv != 0)
+	{
+		ERR("%s: Error updating offset=%d, channel=%d, rv=%d...\n", fn, offset, channel, rv);
+	}
+
+	return rv;
+}
+
+/* Check a whole batch up front so the apply loops need no checks */
+int _check_regops(zynq_dev_t *dev, const char *fn, const zynq_regop_t *ops, uint32_t count)
+{
+	uint32_t i;
+
+	if (dev == NULL || dev->open != 1)
+	{
+		ERR("%s: Device not open...\n", fn);
+		return -1;
+	}
+
+	if (ops == NULL && count != 0)
+	{
+		ERR("%s: Data not available...\n", fn);
+		return -1;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		if (ops[i].offset >= dev->num_gpio || ops[i].channel >= MAX_CHANS ||
+			!(dev->gpio[ops[i].offset].chan_mask & (1 << ops[i].channel)) ||
+			ops[i].field > FIELD_TRI || (dev->lazy && _get_gpio(dev, fn, ops[i].offset) == NULL))
+		{
+			ERR("%s: Error, entry %d offset=%d, channel=%d, field=%d not valid...\n",
+				fn, i, ops[i].offset, ops[i].channel, ops[i].field);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int _zynq_writev(zynq_dev_t *dev, const char *fn, const zynq_regop_t *ops, uint32_t count, uint32_t flags)
+{
+	int rv = 0;
+
+	const zynq_regop_t *op;
+
+	_gpio_entry_t *entry;
+
+	uint32_t *shadow;
+
+	uint32_t data_writes = 0;
+
+	uint32_t i;
+
+	if (_check_regops(dev, fn, ops, count) != 0)
+	{
+		return -1;
+	}
+
+	if (dev->broker != NULL)
+	{
+		ERR("%s: Not available through the broker...\n", fn);
+		return -1;
+	}
+
+	/* The whole batch, and its strobes, is one atomic update */
+	_write_lock_ops(dev, ops, count, 1);
+
+	for (i = 0; i < count && rv == 0; i++)
+	{
+		op = &ops[i];
+		entry = &dev->gpio[op->offset];
+		shadow = op->field == FIELD_TRI ? &entry->shadow_tri[op->channel] : &entry->shadow_data[op->channel];
+
+		if (!dev->shadow || *shadow != op->value)
+		{
+			DBG_HOT("%s: Writing to Offset %d, Channel %d, value=0x%8.8x...\n",
+				fn, op->offset, op->channel + 1, op->value);
+			/* channel_t is { data, tri }, field selects the register */
+			(&entry->regs->ch[op->channel].data)[op->field] = op->value;
+			TRACE(dev, op->offset, op->channel, TRACE_WRITE | TRACE_CALL | (op->field == FIELD_TRI ? TRACE_TRI : 0), op->value);
+		}
+		*shadow = op->value;
+
+		if (op->field == FIELD_DATA)
+		{
+			data_writes++;
+
+			/* If test mode, need to generate clock signal */
+			if (dev->opmode && !(flags & WRITEV_STROBE_END) && (rv = _sw_clock(dev, fn)) != 0)
+			{
+				ERR("%s: Error in _sw_clock() call, rv=%d...\n", fn, rv);
+			}
+		}
+	}
+
+	/* One clock for the whole batch */
+	if (rv == 0 && dev->opmode && (flags & WRITEV_STROBE_END) && data_writes && (rv = _sw_clock(dev, fn)) != 0)
+	{
+		ERR("%s: Error in _sw_clock() call, rv=%d...\n", fn, rv);
+	}
+
+	_write_lock_ops(dev, ops, count, 0);
+
+	return rv;
+}
+
+int _zynq_readv(zynq_dev_t *dev, const char *fn, zynq_regop_t *ops, uint32_t count)
+{
+	zynq_regop_t *op;
+
+	_gpio_entry_t *entry;
+
+	uint32_t i;
+
+	if (_check_regops(dev, fn, ops, count) != 0)
+	{
+		return -1;
+	}
+
+	if (dev->broker != NULL)
+	{
+		ERR("%s: Not available through the broker...\n", fn);
+		return -1;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		op = &ops[i];
+		entry = &dev->gpio[op->offset];
+
+		/* Direction is served from the shadow like zynq_get_gpio_direction() */
+		if (op->field == FIELD_TRI && dev->shadow)
+		{
+			op->value = entry->shadow_tri[op->channel];
+			continue;
+		}
+
+		op->value = (&entry->regs->ch[op->channel].data)[op->field];
+		TRACE(dev, op->offset, op->channel, TRACE_CALL | (op->field == FIELD_TRI ? TRACE_TRI : 0), op->value);
+		DBG_HOT("%s: Reading from Offset %d, Channel %d, value=0x%8.8x...\n",
+			fn, op->offset, op->channel + 1, op->value);
+	}
+
+	return 0;
+}
+
+int _zynq_write_stream(zynq_dev_t *dev, const char *fn, uint32_t offset, uint32_t channel,
+	const uint32_t *words, size_t n, uint32_t barrier_every, uint32_t flags, zynq_stream_stats_t *stats)
+{
+	volatile uint32_t *dr;
+
+	volatile uint32_t *clk = NULL;
+
+	uint64_t start, barriers = 0, mismatches = 0;
+
+	uint32_t since = 0;
+
+	uint32_t readback;
+
+	size_t i;
+
+	if (dev == NULL || dev->open != 1)
+	{
+		ERR("%s: Device not open...\n", fn);
+		return -1;
+	}
+
+	if (dev->broker != NULL)
+	{
+		ERR("%s: Not available through the broker...\n", fn);
+		return -1;
+	}
+
+	if (words == NULL && n != 0)
+	{
+		ERR("%s: Data not available...\n", fn);
+		return -1;
+	}
+
+	if (offset >= dev->num_gpio || _get_gpio(dev, fn, offset) == NULL ||
+		channel >= MAX_CHANS || !(dev->gpio[offset].chan_mask & (1 << channel)))
+	{
+		ERR("%s: Error, offset=%d, channel=%d not valid...\n", fn, offset, channel);
+		return -1;
+	}
+
+	if (dev->opmode)
+	{
+		if (CR >= dev->num_gpio || _get_gpio(dev, fn, CR) == NULL)
+		{
+			ERR("%s: Error, no clock register...\n", fn);
+			return -1;
+		}
+
+		clk = &dev->gpio[CR].regs->ch[CH1_INDEX].data;
+	}
+
+	dr = &dev->gpio[offset].regs->ch[channel].data;
+
+	DBG("%s: Streaming %lu words to offset=%d, channel=%d...\n", fn, (unsigned long) n, offset, channel + 1);
+
+	/* Other writers wait for the whole stream */
+	_write_lock(dev, offset, 0);
+
+	start = _now_ns();
+
+	/* Validated once, the loop is only the stores */
+	for (i = 0; i < n; i++)
+	{
+		*dr = words[i];
+		TRACE(dev, offset, channel, TRACE_WRITE | TRACE_CALL, words[i]);
+
+		/* Device writes stay ordered, so the strobe follows the data without a read */
+		if (clk != NULL)
+		{
+			*clk = 1;
+			TRACE(dev, CR, CH1_INDEX, TRACE_WRITE | TRACE_CALL, 1);
+			*clk = 0;
+			TRACE(dev, CR, CH1_INDEX, TRACE_WRITE | TRACE_CALL, 0);
+		}
+
+		if ((barrier_every && ++since == barrier_every) || i == n - 1)
+		{
+			since = 0;
+			barriers++;
+
+			/* A read of the device completes only after the posted writes */
+			readback = *dr;
+			TRACE(dev, offset, channel, TRACE_CALL, readback);
+
+			if (readback != words[i] && (flags & STREAM_VERIFY))
+			{
+				mismatches++;
+			}
+		}
+	}
+
+	if (n != 0)
+	{
+		dev->gpio[offset].shadow_data[channel] = words[n - 1];
+	}
+	if (clk != NULL)
+	{
+		dev->gpio[CR].shadow_data[CH1_INDEX] = 0;
+	}
+
+	_write_unlock(dev, offset, 0);
+
+	if (stats != NULL)
+	{
+		stats->words = n;
+		stats->barriers = barriers;
+		stats->mismatches = mismatches;
+		stats->elapsed_ns = _now_ns() - start;
+		stats->words_per_sec = stats->elapsed_ns ? n * 1e9 / stats->elapsed_ns : 0;
+	}
+
+	if (mismatches)
+	{
+		ERR("%s: %lu read-backs did not match...\n", fn, (unsigned long) mismatches);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int zynq_set_debug_level(int debug)
+{
+	_zynq_dbg_lvl = debug;
+	return 0;
+}
+
+int zynq_get_debug_level()
+{
+	return _zynq_dbg_lvl;
+}
+
+int zynq_set_backend(uint32_t backend, const char *path)
+{
+	char *fn = "zynq_set_backend";
+
+	if (backend >= NUM_BACKENDS)
+	{
+		ERR("%s: Error, backend=%d out of range...\n", fn, backend);
+		return -1;
+	}
+
+	/* The backend is bound to the mappings, only switch while closed */
+	if (_dev != NULL || __atomic_load_n(&_async_pending, __ATOMIC_ACQUIRE))
+	{
+		ERR("%s: Device already opened...\n", fn);
+		return -1;
+	}
+
+	if (path != NULL && strlen(path) >= sizeof(_backend_path))
+	{
+		ERR("%s: Error, path too long...\n", fn);
+		return -1;
+	}
+
+	_backend_id = backend;
+	strcpy(_backend_path, path != NULL ? path : "");
+
+	DBG("%s: Using %s backend, path=%s...\n", fn, _backends[backend].name, _backend_path);
+
+	return 0;
+}
+
+int zynq_get_backend()
+{
+	return _backend_id;
+}
+
+
+static int _init(const char *fn, uint32_t opmode, uint32_t initmode)
+{
+	int rv = 0;
+
+	zynq_dev_t *dev;
+
+	zynq_dev_cfg_t cfg;
+
+	DBG("%s: ", fn);
+
+	cfg.backend = _backend_id;
+	cfg.path = _backend_path;
+	cfg.bitstream = DEFAULT_PL;
+	cfg.num_gpio = NUM_GPIO;
+	cfg.gpio = _default_gpio;
+
+	_prof_start(&_prof_init);
+
+	if (initmode & INIT_PROG_MODE)
+	{
+
+		if ( (rv = _pl_program(&_backends[cfg.backend], fn, cfg.bitstream, initmode)) != 0)
+		{
+			ERR("%s: Error in _pl_program(%s) call, rv=%d...\n",
+				fn, cfg.bitstream, rv);
+			return rv;
+		}
+
+		_prof_mark(&_prof_init, "program");
+	}
+
+	/* Memory map Zynq PL */
+	if (initmode & INIT_OPEN_MODE)
+	{
+		/* Device already open */
+		if (_dev != NULL)
+		{
+			ERR("%s: Device already opened...\n", fn);
+			return -1;
+		}
+
+		if ( (dev = _dev_open(fn, &cfg, opmode, initmode & ~INIT_PROG_MODE)) == NULL)
+		{
+			ERR("%s: Error in _dev_open() call...\n", fn);
+			return -1;
+		}
+
+		/* Register calls of other threads may be polling for it */
+		__atomic_store_n(&_dev, dev, __ATOMIC_RELEASE);
+	}
+
+	return rv;
+
+}
+
+int zynq_init(uint32_t opmode, uint32_t initmode)
+{
+	char *fn = "zynq_init";
+
+	if (__atomic_load_n(&_async_pending, __ATOMIC_ACQUIRE))
+	{
+		ERR("%s: zynq_init_async() in progress...\n", fn);
+		return -1;
+	}
+
+	return _init(fn, opmode, initmode);
+}
+
+static void _init_release(zynq_init_handle_t *h)
+{
+	int refs;
+
+	pthread_mutex_lock(&_async_lock);
+	refs = --h->refs;
+	pthread_mutex_unlock(&_async_lock);
+
+	if (refs == 0)
+	{
+		free(h);
+	}
+}
+
+static void * _init_thread(void *arg)
+{
+	zynq_init_handle_t *h = arg;
+
+	int rv;
+
+	rv = _init("zynq_init_async", h->opmode, h->initmode);
+
+	/* Release the register calls first, the callback may make some */
+	pthread_mutex_lock(&_async_lock);
+	__atomic_store_n(&_async_pending, 0, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&_async_cond);
+	pthread_mutex_unlock(&_async_lock);
+
+	if (h->cb != NULL)
+	{
+		h->cb(rv, h->arg);
+	}
+
+	pthread_mutex_lock(&_async_lock);
+	h->rv = rv;
+	h->done = 1;
+	pthread_cond_broadcast(&_async_cond);
+	pthread_mutex_unlock(&_async_lock);
+
+	_init_release(h);
+
+	return NULL;
+}
+
+zynq_init_handle_t * zynq_init_async(uint32_t opmode, uint32_t initmode, zynq_init_cb_t cb, void *arg)
+{
+	char *fn = "zynq_init_async";
+
+	zynq_init_handle_t *h;
+
+	pthread_t thread;
+
+	if ( (h = calloc(1, sizeof(*h))) == NULL)
+	{
+		ERR("%s: Can't allocate handle...\n", fn);
+		return NULL;
+	}
+
+	h->opmode = opmode;
+	h->initmode = initmode;
+	h->cb = cb;
+	h->arg = arg;
+	h->refs = 2;
+
+	pthread_mutex_lock(&_async_lock);
+
+	if (_async_pending || __atomic_load_n(&_dev, __ATOMIC_ACQUIRE) != NULL)
+	{
+		pthread_mutex_unlock(&_async_lock);
+		ERR("%s: Device already opened or being opened...\n", fn);
+		free(h);
+		return NULL;
+	}
+
+	_async_pending = 1;
+	_async_block = (initmode & INIT_ASYNC_BLOCK) != 0;
+
+	if (pthread_create(&thread, NULL, _init_thread, h) != 0)
+	{
+		_async_pending = 0;
+		pthread_mutex_unlock(&_async_lock);
+		ERR("%s: Can't start init thread...\n", fn);
+		free(h);
+		return NULL;
+	}
+
+	pthread_mutex_unlock(&_async_lock);
+
+	pthread_detach(thread);
+
+	DBG("%s: Init started in the background...\n", fn);
+
+	return h;
+}
+
+int zynq_init_poll(zynq_init_handle_t *h)
+{
+	int done;
+
+	if (h == NULL)
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&_async_lock);
+	done = h->done;
+	pthread_mutex_unlock(&_async_lock);
+
+	return done;
+}
+
+int zynq_init_wait(zynq_init_handle_t *h)
+{
+	int rv;
+
+	if (h == NULL)
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&_async_lock);
+
+	while (!h->done)
+	{
+		pthread_cond_wait(&_async_cond, &_async_lock);
+	}
+
+	rv = h->rv;
+
+	pthread_mutex_unlock(&_async_lock);
+
+	_init_release(h);
+
+	return rv;
+}
+
+int zynq_set_gpio_direction(uint32_t offset, uint32_t *direction, uint32_t channel_mask)
+{
+	zynq_dev_t *dev = _cur_dev();
+
+	return STATS_CALL(dev, STATS_SET_DIR, offset,
+		_zynq_set_gpio_direction(dev, "zynq_set_gpio_direction", offset, direction, channel_mask));
+}
+
+int zynq_get_gpio_direction(uint32_t offset, uint32_t *direction, uint32_t channel_mask)
+{
+	zynq_dev_t *dev = _cur_dev();
+
+	return STATS_CALL(dev, STATS_GET_DIR, offset,
+		_zynq_get_gpio_direction(dev, "zynq_get_gpio_direction", offset, direction, channel_mask));
+}
+
+int zynq_write(uint32_t offset, uint32_t *data, uint32_t channel_mask)
+{
+	zynq_dev_t *dev = _cur_dev();
+
+	return STATS_CALL(dev, STATS_WRITE, offset,
+		_zynq_write(dev, "zynq_write", offset, data, channel_mask));
+}
+
+int zynq_write_lw(uint32_t offset, uint32_t *data, uint32_t channel_mask)
+{
+	zynq_dev_t *dev = _cur_dev();
+
+	return STATS_CALL(dev, STATS_WRITE_LW, offset,
+		_zynq_write_lw(dev, "zynq_write_lw", offset, data, channel_mask));
+}
+
+int zynq_write_uw(uint32_t offset, uint32_t *data, uint32_t channel_mask)
+{
+	zynq_dev_t *dev = _cur_dev();
+
+	return STATS_CALL(dev, STATS_WRITE_UW, offset,
+		_zynq_write_uw(dev, "zynq_write_uw", offset, data, channel_mask));
+}
+
+int zynq_read(uint32_t offset, uint32_t *data, uint32_t channel_mask)
+{
+	zynq_dev_t *dev = _cur_dev();
+
+	return STATS_CALL(dev, STATS_READ, offset,
+		_zynq_read(dev, "zynq_read", offset, data, channel_mask));
+}
+
+int zynq_read_lw(uint32_t offset, uint32_t *data, uint32_t channel_mask)
+{
+	zynq_dev_t *dev = _cur_dev();
+
+	return STATS_CALL(dev, STATS_READ_LW, offset,
+		_zynq_read_lw(dev, "zynq_read_lw", offset, data, channel_mask));
+}
+
+int zynq_read_uw(uint32_t offset, uint32_t *data, uint32_t channel_mask)
+{
+	zynq_dev_t *dev = _cur_dev();
+
+	return STATS_CALL(dev, STATS_READ_UW, offset,
+		_zynq_read_uw(dev, "zynq_read_uw", offset, data, channel_mask));
+}
+
+int zynq_set_bits(uint32_t offset, uint32_t channel, uint32_t mask)
+{
+	zynq_dev_t *dev = _cur_dev();
+
+	return STATS_CALL(dev, STATS_BITS, offset,
+		_zynq_modify_bits(dev, "zynq_set_bits", offset, channel, 0, BITS_SET, mask));
+}
+
+int zynq_clear_bits(uint32_t offset, uint32_t channel, uint32_t mask)
+{
+	zynq_dev_t *dev = _cur_dev();
+
+	return STATS_CALL(dev, STATS_BITS, offset,
+		_zynq_modify_bits(dev, "zynq_clear_bits", offset, channel, 0, BITS_CLEAR, mask));
+}
+
+int zynq_toggle_bits(uint32_t offset, uint32_t channel, uint32_t mask)
+{
+	zynq_dev_t *dev = _cur_dev();
+
+	return STATS_CALL(dev, STATS_BITS, offset,
+		_zynq_modify_bits(dev, "zynq_toggle_bits", offset, channel, 0, BITS_TOGGLE, mask));
+}
+
+int zynq_set_tri_bits(uint32_t offset, uint32_t channel, uint32_t mask)
+{
+	zynq_dev_t *dev = _cur_dev();
+
+	return STATS_CALL(dev, STATS_BITS, offset,
+		_zynq_modify_bits(dev, "zynq_set_tri_bits", offset, channel, 1, BITS_SET, mask));
+}
+
+int zynq_clear_tri_bits(uint32_t offset, uint32_t channel, uint32_t mask)
+{
+	zynq_dev_t *dev = _cur_dev();
+
+	return STATS_CALL(dev, STATS_BITS, offset,
+		_zynq_modify_bits(dev, "zynq_clear_tri_bits", offset, channel, 1, BITS_CLEAR, mask));
+}
+
+int zynq_toggle_tri_bits(uint32_t offset, uint32_t channel, uint32_t mask)
+{
+	zynq_dev_t *dev = _cur_dev();
+
+	return STATS_CALL(dev, STATS_BITS, offset,
+		_zynq_modify_bits(dev, "zynq_toggle_tri_bits", offset, channel, 1, BITS_TOGGLE, mask));
+}
+
+int zynq_writev(const zynq_regop_t *ops, uint32_t count, uint32_t flags)
+{
+	zynq_dev_t *dev = _cur_dev();
+
+	return STATS_CALL(dev, STATS_WRITEV, ops != NULL && count ? ops[0].offset : STATS_ALL,
+		_zynq_writev(dev, "zynq_writev", ops, count, flags));
+}
+
+int zynq_readv(zynq_regop_t *ops, uint32_t count)
+{
+	zynq_dev_t *dev = _cur_dev();
+
+	return STATS_CALL(dev, STATS_READV, ops != NULL && count ? ops[0].offset : STATS_ALL,
+		_zynq_readv(dev, "zynq_readv", ops, count));
+}
+
+int zynq_write_stream(uint32_t offset, uint32_t channel, const uint32_t *words, size_t n,
+	uint32_t barrier_every, uint32_t flags, zynq_stream_stats_t *stats)
+{
+	zynq_dev_t *dev = _cur_dev();
+
+	return STATS_CALL(dev, STATS_STREAM, offset,
+		_zynq_write_stream(dev, "zynq_write_stream", offset, channel, words, n, barrier_every, flags, stats));
+}
+
+int zynq_set_shadow(int enable)
+{
+	return _set_shadow(_cur_dev(), "zynq_set_shadow", enable);
+}
+
+int zynq_resync_shadow()
+{
+	char *fn = "zynq_resync_shadow";
+
+	zynq_dev_t *dev = _cur_dev();
+
+	if (dev == NULL || !dev->shadow)
+	{
+		ERR("%s: Shadow registers not enabled...\n", fn);
+		return -1;
+	}
+
+	return _shadow_load(dev, fn);
+}
+
+int zynq_close()
+{
+	char *fn = "zynq_close";
+
+	int rv = 0;
+
+	/* Let a pending zynq_init_async() finish, whatever INIT_ASYNC_BLOCK says */
+	pthread_mutex_lock(&_async_lock);
+
+	while (_async_pending)
+	{
+		pthread_cond_wait(&_async_cond, &_async_lock);
+	}
+
+	pthread_mutex_unlock(&_async_lock);
+
+	if ( (rv = _dev_close(_dev, fn)) != 0)
+	{
+		ERR("%s: Error in _dev_close() call, rv=%d...\n", fn, rv);
 		return rv;
 	}
+
+	_dev = NULL;
+
+	return 0;
+}
+
+int zynq_get_profile(zynq_profile_t *init, zynq_profile_t *close)
+{
+	if (init != NULL)
+	{
+		*init = _prof_init;
+	}
+
+	if (close != NULL)
+	{
+		*close = _prof_close;
+	}
+
+	return 0;
+}
+
+int zynq_dump_profile(FILE *fp)
+{
+	if (fp == NULL)
+	{
+		fp = stdout;
+	}
+
+	_prof_print(fp, "init", &_prof_init);
+	_prof_print(fp, "close", &_prof_close);
+
 	return 0;
 }
 
+/* Handle based calls, one zynq_dev_t per design image */
+
+zynq_dev_t * zynq_dev_open(const zynq_dev_cfg_t *cfg, uint32_t opmode, uint32_t initmode)
+{
+	_prof_start(&_prof_init);
+
+	return _dev_open("zynq_dev_open", cfg, opmode, initmode);
+}
+
+int zynq_dev_close(zynq_dev_t *dev)
+{
+	return _dev_close(dev, "zynq_dev_close");
+}
+
+int zynq_dev_set_gpio_direction(zynq_dev_t *dev, uint32_t offset, uint32_t *direction, uint32_t channel_mask)
+{
+	return STATS_CALL(dev, STATS_SET_DIR, offset,
+		_zynq_set_gpio_direction(dev, "zynq_dev_set_gpio_direction", offset, direction, channel_mask));
+}
+
+int zynq_dev_get_gpio_direction(zynq_dev_t *dev, uint32_t offset, uint32_t *direction, uint32_t channel_mask)
+{
+	return STATS_CALL(dev, STATS_GET_DIR, offset,
+		_zynq_get_gpio_direction(dev, "zynq_dev_get_gpio_direction", offset, direction, channel_mask));
+}
+
+int zynq_dev_write(zynq_dev_t *dev, uint32_t offset, uint32_t *data, uint32_t channel_mask)
+{
+	return STATS_CALL(dev, STATS_WRITE, offset,
+		_zynq_write(dev, "zynq_dev_write", offset, data, channel_mask));
+}
+
+int zynq_dev_write_lw(zynq_dev_t *dev, uint32_t offset, uint32_t *data, uint32_t channel_mask)
+{
+	return STATS_CALL(dev, STATS_WRITE_LW, offset,
+		_zynq_write_lw(dev, "zynq_dev_write_lw", offset, data, channel_mask));
+}
+
+int zynq_dev_write_uw(zynq_dev_t *dev, uint32_t offset, uint32_t *data, uint32_t channel_mask)
+{
+	return STATS_CALL(dev, STATS_WRITE_UW, offset,
+		_zynq_write_uw(dev, "zynq_dev_write_uw", offset, data, channel_mask));
+}
+
+int zynq_dev_read(zynq_dev_t *dev, uint32_t offset, uint32_t *data, uint32_t channel_mask)
+{
+	return STATS_CALL(dev, STATS_READ, offset,
+		_zynq_read(dev, "zynq_dev_read", offset, data, channel_mask));
+}
+
+int zynq_dev_read_lw(zynq_dev_t *dev, uint32_t offset, uint32_t *data, uint32_t channel_mask)
+{
+	return STATS_CALL(dev, STATS_READ_LW, offset,
+		_zynq_read_lw(dev, "zynq_dev_read_lw", offset, data, channel_mask));
+}
+
+int zynq_dev_read_uw(zynq_dev_t *dev, uint32_t offset, uint32_t *data, uint32_t channel_mask)
+{
+	return STATS_CALL(dev, STATS_READ_UW, offset,
+		_zynq_read_uw(dev, "zynq_dev_read_uw", offset, data, channel_mask));
+}
+
+int zynq_dev_set_shadow(zynq_dev_t *dev, int enable)
+{
+	return _set_shadow(dev, "zynq_dev_set_shadow", enable);
+}
+
+int zynq_dev_resync_shadow(zynq_dev_t *dev)
+{
+	char *fn = "zynq_dev_resync_shadow";
+
+	if (dev == NULL || !dev->shadow)
+	{
+		ERR("%s: Shadow registers not enabled...\n", fn);
+		return -1;
+	}
+
+	return _shadow_load(dev, fn);
+}
+
+int zynq_dev_set_bits(zynq_dev_t *dev, uint32_t offset, uint32_t channel, uint32_t mask)
+{
+	return STATS_CALL(dev, STATS_BITS, offset,
+		_zynq_modify_bits(dev, "zynq_dev_set_bits", offset, channel, 0, BITS_SET, mask));
+}
+
+int zynq_dev_clear_bits(zynq_dev_t *dev, uint32_t offset, uint32_t channel, uint32_t mask)
+{
+	return STATS_CALL(dev, STATS_BITS, offset,
+		_zynq_modify_bits(dev, "zynq_dev_clear_bits", offset, channel, 0, BITS_CLEAR, mask));
+}
+
+int zynq_dev_toggle_bits(zynq_dev_t *dev, uint32_t offset, uint32_t channel, uint32_t mask)
+{
+	return STATS_CALL(dev, STATS_BITS, offset,
+		_zynq_modify_bits(dev, "zynq_dev_toggle_bits", offset, channel, 0, BITS_TOGGLE, mask));
+}
+
+int zynq_dev_set_tri_bits(zynq_dev_t *dev, uint32_t offset, uint32_t channel, uint32_t mask)
+{
+	return STATS_CALL(dev, STATS_BITS, offset,
+		_zynq_modify_bits(dev, "zynq_dev_set_tri_bits", offset, channel, 1, BITS_SET, mask));
+}
+
+int zynq_dev_clear_tri_bits(zynq_dev_t *dev, uint32_t offset, uint32_t channel, uint32_t mask)
+{
+	return STATS_CALL(dev, STATS_BITS, offset,
+		_zynq_modify_bits(dev, "zynq_dev_clear_tri_bits", offset, channel, 1, BITS_CLEAR, mask));
+}
+
+int zynq_dev_toggle_tri_bits(zynq_dev_t *dev, uint32_t offset, uint32_t channel, uint32_t mask)
+{
+	return STATS_CALL(dev, STATS_BITS, offset,
+		_zynq_modify_bits(dev, "zynq_dev_toggle_tri_bits", offset, channel, 1, BITS_TOGGLE, mask));
+}
+
+int zynq_dev_writev(zynq_dev_t *dev, const zynq_regop_t *ops, uint32_t count, uint32_t flags)
+{
+	return STATS_CALL(dev, STATS_WRITEV, ops != NULL && count ? ops[0].offset : STATS_ALL,
+		_zynq_writev(dev, "zynq_dev_writev", ops, count, flags));
+}
+
+int zynq_dev_readv(zynq_dev_t *dev, zynq_regop_t *ops, uint32_t count)
+{
+	return STATS_CALL(dev, STATS_READV, ops != NULL && count ? ops[0].offset : STATS_ALL,
+		_zynq_readv(dev, "zynq_dev_readv", ops, count));
+}
 
+int zynq_dev_write_stream(zynq_dev_t *dev, uint32_t offset, uint32_t channel, const uint32_t *words, size_t n,
+	uint32_t barrier_every, uint32_t flags, zynq_stream_stats_t *stats)
+{
+	return STATS_CALL(dev, STATS_STREAM, offset,
+		_zynq_write_stream(dev, "zynq_dev_write_stream", offset, channel, words, n, barrier_every, flags, stats));
+}
 
+zynq_dev_t * zynq_get_dev()
+{
+	return _cur_dev();
+}
@@ -0,0 +1,344 @@
+/**********************************************************
+ *
+ *  Interrupt driven input change events.
+ *
+ *  The AXI GPIO raises its interrupt when an input of an
+ *  enabled channel changes.  Through a UIO device the
+ *  interrupt count is read from the fd, the ISR is
+ *  acknowledged and the interrupt unmasked by writing 1
+ *  to the fd.  Simulated devices get a fake UIO device,
+ *  an eventfd signalled by zynq_irq_raise().
+ *
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+
+#include "ZYNQ_private.h"
+#include "include/ZYNQ_irq.h"
+
+/* Bounds the reaction time of the callback thread to zynq_irq_close() */
+#define IRQ_WAIT_MS (100)
+
+struct zynq_irq {
+	zynq_dev_t *dev;
+	uint32_t offset;
+	uint32_t chan_mask;
+	/* UIO device, or eventfd of a fake one */
+	int fd;
+	int fake;
+	volatile gpio_t *regs;
+	/* UIO mapping, NULL when fake */
+	void *map;
+	/* Input values at the last interrupt */
+	uint32_t last[MAX_CHANS];
+	pthread_t thread;
+	int running;
+	int stop;
+	zynq_irq_cb_t cb;
+	void *arg;
+};
+
+/* Let the UIO driver deliver the next interrupt */
+static int _irq_unmask(zynq_irq_t *irq)
+{
+	uint32_t one = 1;
+
+	if (irq->fake)
+	{
+		return 0;
+	}
+
+	return write(irq->fd, &one, sizeof(one)) == sizeof(one) ? 0 : -1;
+}
+
+/* ISR bits are cleared by writing 1, the fake registers are plain memory */
+static void _irq_ack(zynq_irq_t *irq, uint32_t pending)
+{
+	if (irq->fake)
+	{
+		__atomic_fetch_and(&irq->regs->isr, ~pending, __ATOMIC_SEQ_CST);
+	}
+	else
+	{
+		irq->regs->isr = pending;
+	}
+}
+
+zynq_irq_t * zynq_irq_open(zynq_dev_t *dev, uint32_t offset, uint32_t channel_mask, const char *uio)
+{
+	char *fn = "zynq_irq_open";
+
+	zynq_irq_t *irq;
+
+	uint32_t ch;
+
+	if (dev == NULL || dev->open != 1 || dev->broker != NULL)
+	{
+		ERR("%s: Device not open...\n", fn);
+		return NULL;
+	}
+
+	if (offset >= dev->num_gpio || _get_gpio(dev, fn, offset) == NULL || channel_mask == 0 || (channel_mask & ~dev->gpio[offset].chan_mask))
+	{
+		ERR("%s: Error, offset=%d, channel_mask=0x%x not valid...\n", fn, offset, channel_mask);
+		return NULL;
+	}
+
+	if ( (irq = calloc(1, sizeof(*irq))) == NULL)
+	{
+		ERR("%s: Can't allocate interrupt...\n", fn);
+		return NULL;
+	}
+
+	irq->dev = dev;
+	irq->offset = offset;
+	irq->chan_mask = channel_mask;
+
+	if (!dev->backend->has_pl)
+	{
+		irq->fake = 1;
+		irq->regs = dev->gpio[offset].regs;
+
+		if ( (irq->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1)
+		{
+			ERR("%s: Can't create fake UIO eventfd...\n", fn);
+			free(irq);
+			return NULL;
+		}
+	}
+	else
+	{
+		if (uio == NULL || (irq->fd = open(uio, O_RDWR | O_CLOEXEC)) == -1)
+		{
+			ERR("%s: Can't open UIO device %s...\n", fn, uio ? uio : "(null)");
+			free(irq);
+			return NULL;
+		}
+
+		/* map0 of the UIO device is the GPIO register block */
+		if ( (irq->map = mmap(0, sizeof(gpio_t), PROT_READ | PROT_WRITE, MAP_SHARED, irq->fd, 0)) == MAP_FAILED)
+		{
+			ERR("%s: Can't map UIO device %s...\n", fn, uio);
+			close(irq->fd);
+			free(irq);
+			return NULL;
+		}
+
+		irq->regs = irq->map;
+	}
+
+	for (ch = 0; ch < MAX_CHANS; ch++)
+	{
+		if (channel_mask & (1 << ch))
+		{
+			irq->last[ch] = irq->regs->ch[ch].data;
+		}
+	}
+
+	/* Drop anything pending from before, then enable the channels */
+	_irq_ack(irq, irq->regs->isr);
+	irq->regs->ier = channel_mask;
+	irq->regs->gier = GIER_ENABLE;
+
+	if (_irq_unmask(irq) != 0)
+	{
+		ERR("%s: Can't unmask UIO interrupt...\n", fn);
+		zynq_irq_close(irq);
+		return NULL;
+	}
+
+	DBG("%s: %s interrupt on offset=%d, channel_mask=0x%x...\n", fn,
+		irq->fake ? "Fake UIO" : uio, offset, channel_mask);
+
+	return irq;
+}
+
+int zynq_irq_fd(zynq_irq_t *irq)
+{
+	return irq != NULL ? irq->fd : -1;
+}
+
+int zynq_irq_wait(zynq_irq_t *irq, int timeout_ms, uint32_t *changed, uint32_t *data)
+{
+	char *fn = "zynq_irq_wait";
+
+	struct pollfd pfd;
+
+	uint64_t count;
+
+	uint32_t pending, ch;
+
+	size_t size;
+
+	ssize_t n;
+
+	int rv;
+
+	if (irq == NULL || changed == NULL || data == NULL)
+	{
+		ERR("%s: Error, invalid arguments...\n", fn);
+		return -1;
+	}
+
+	pfd.fd = irq->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	if ( (rv = poll(&pfd, 1, timeout_ms)) <= 0)
+	{
+		return rv == 0 || errno == EINTR ? 0 : -1;
+	}
+
+	/* UIO counts are 4 bytes, eventfd counts 8 */
+	size = irq->fake ? sizeof(uint64_t) : sizeof(uint32_t);
+
+	if ( (n = read(irq->fd, &count, size)) != (ssize_t) size)
+	{
+		/* Interrupted, or another waiter took the event, as for poll() above */
+		if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		{
+			return 0;
+		}
+
+		ERR("%s: Error reading interrupt count, n=%d...\n", fn, (int) n);
+		return -1;
+	}
+
+	/* Acknowledge before sampling, a later change raises a new interrupt */
+	pending = irq->regs->isr & irq->chan_mask;
+	_irq_ack(irq, pending);
+
+	for (ch = 0; ch < MAX_CHANS; ch++)
+	{
+		changed[ch] = 0;
+		data[ch] = 0;
+
+		if (irq->chan_mask & (1 << ch))
+		{
+			data[ch] = irq->regs->ch[ch].data;
+			changed[ch] = data[ch] ^ irq->last[ch];
+			irq->last[ch] = data[ch];
+		}
+	}
+
+	DBG_HOT("%s: Offset %d, isr=0x%x, changed CH1=0x%8.8x...\n", fn, irq->offset, pending, changed[CH1_INDEX]);
+
+	if (_irq_unmask(irq) != 0)
+	{
+		ERR("%s: Can't unmask UIO interrupt...\n", fn);
+		return -1;
+	}
+
+	return 1;
+}
+
+static void * _irq_main(void *arg)
+{
+	zynq_irq_t *irq = arg;
+
+	uint32_t changed[MAX_CHANS], data[MAX_CHANS];
+
+	int rv;
+
+	while (!__atomic_load_n(&irq->stop, __ATOMIC_ACQUIRE))
+	{
+		if ( (rv = zynq_irq_wait(irq, IRQ_WAIT_MS, changed, data)) < 0)
+		{
+			ERR("zynq_irq: Error waiting for offset=%d, stopping...\n", irq->offset);
+			break;
+		}
+
+		if (rv > 0)
+		{
+			irq->cb(irq, changed, data, irq->arg);
+		}
+	}
+
+	return NULL;
+}
+
+int zynq_irq_start(zynq_irq_t *irq, zynq_irq_cb_t cb, void *arg)
+{
+	char *fn = "zynq_irq_start";
+
+	if (irq == NULL || cb == NULL || irq->running)
+	{
+		ERR("%s: Error, no interrupt or callback, or already started...\n", fn);
+		return -1;
+	}
+
+	irq->cb = cb;
+	irq->arg = arg;
+	irq->stop = 0;
+
+	if (pthread_create(&irq->thread, NULL, _irq_main, irq) != 0)
+	{
+		ERR("%s: Can't start interrupt thread...\n", fn);
+		return -1;
+	}
+
+	irq->running = 1;
+
+	return 0;
+}
+
+int zynq_irq_raise(zynq_irq_t *irq, uint32_t channel_mask)
+{
+	char *fn = "zynq_irq_raise";
+
+	uint64_t one = 1;
+
+	if (irq == NULL || !irq->fake)
+	{
+		ERR("%s: Error, not a fake UIO device...\n", fn);
+		return -1;
+	}
+
+	/* Latched like the hardware, signalled only when enabled */
+	__atomic_fetch_or(&irq->regs->isr, channel_mask & (CH1_MASK|CH2_MASK), __ATOMIC_SEQ_CST);
+
+	if ((irq->regs->gier & GIER_ENABLE) && (irq->regs->ier & channel_mask) &&
+		write(irq->fd, &one, sizeof(one)) != sizeof(one))
+	{
+		ERR("%s: Can't signal fake UIO eventfd...\n", fn);
+		return -1;
+	}
+
+	return 0;
+}
+
+int zynq_irq_close(zynq_irq_t *irq)
+{
+	if (irq == NULL)
+	{
+		return -1;
+	}
+
+	if (irq->running)
+	{
+		__atomic_store_n(&irq->stop, 1, __ATOMIC_RELEASE);
+		pthread_join(irq->thread, NULL);
+	}
+
+	irq->regs->ier = 0;
+	irq->regs->gier = 0;
+
+	if (irq->map != NULL)
+	{
+		munmap(irq->map, sizeof(gpio_t));
+	}
+
+	close(irq->fd);
+	free(irq);
+
+	return 0;
+}
@@ -0,0 +1,202 @@
+/**********************************************************
+ *
+ *  Asynchronous logger for the register access path.
+ *
+ *  In LOG_ASYNC_MODE the DBG_HOT messages are queued in
+ *  a lock-free ring and formatted by a background thread,
+ *  so debug logging does not change the access timing.
+ *
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "ZYNQ_private.h"
+
+/* Number of queued messages, must be a power of 2 */
+#define LOG_RING_SIZE (4096)
+#define LOG_RING_MASK (LOG_RING_SIZE - 1)
+
+/* Background thread poll period when the ring is empty */
+#define LOG_IDLE_NS (1000000)
+
+typedef struct {
+	/* Slot sequence, tells producer and consumer who owns the slot */
+	uint32_t seq;
+	const char *fmt;
+	const char *fn;
+	uint32_t a;
+	uint32_t b;
+	uint32_t c;
+} _log_rec_t;
+
+static _log_rec_t _log_ring[LOG_RING_SIZE];
+static uint32_t _log_head = 0;
+static uint32_t _log_tail = 0;
+static uint32_t _log_dropped = 0;
+
+static uint32_t _log_mode = LOG_SYNC_MODE;
+static int _log_running = 0;
+static pthread_t _log_thread;
+
+/* Multiple producer enqueue, drops the message when the ring is full */
+static void _log_put(const char *fmt, const char *fn, uint32_t a, uint32_t b, uint32_t c)
+{
+	_log_rec_t *rec;
+	uint32_t pos, seq;
+
+	pos = __atomic_load_n(&_log_head, __ATOMIC_RELAXED);
+
+	for (;;)
+	{
+		rec = &_log_ring[pos & LOG_RING_MASK];
+		seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+
+		if (seq == pos)
+		{
+			if (__atomic_compare_exchange_n(&_log_head, &pos, pos + 1, 1,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				break;
+			}
+		}
+		else if ((int32_t) (seq - pos) < 0)
+		{
+			__atomic_fetch_add(&_log_dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		else
+		{
+			pos = __atomic_load_n(&_log_head, __ATOMIC_RELAXED);
+		}
+	}
+
+	rec->fmt = fmt;
+	rec->fn = fn;
+	rec->a = a;
+	rec->b = b;
+	rec->c = c;
+
+	__atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/* Single consumer, returns the number of messages written */
+static int _log_drain(void)
+{
+	_log_rec_t *rec;
+	int n = 0;
+
+	for (;;)
+	{
+		rec = &_log_ring[_log_tail & LOG_RING_MASK];
+
+		if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != _log_tail + 1)
+		{
+			break;
+		}
+
+		printf(rec->fmt, rec->fn, rec->a, rec->b, rec->c);
+
+		__atomic_store_n(&rec->seq, _log_tail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+		_log_tail++;
+		n++;
+	}
+
+	if (n > 0)
+	{
+		fflush(stdout);
+	}
+
+	return n;
+}
+
+static void * _log_main(void *arg)
+{
+	struct timespec idle = { 0, LOG_IDLE_NS };
+
+	while (__atomic_load_n(&_log_running, __ATOMIC_ACQUIRE))
+	{
+		if (_log_drain() == 0)
+		{
+			nanosleep(&idle, NULL);
+		}
+	}
+
+	/* Flush whatever was queued before the stop */
+	_log_drain();
+
+	return NULL;
+}
+
+void _log_hot(const char *fmt, const char *fn, uint32_t a, uint32_t b, uint32_t c)
+{
+	if (__atomic_load_n(&_log_mode, __ATOMIC_RELAXED) == LOG_ASYNC_MODE)
+	{
+		_log_put(fmt, fn, a, b, c);
+	}
+	else
+	{
+		printf(fmt, fn, a, b, c);
+	}
+}
+
+int zynq_set_log_mode(uint32_t mode)
+{
+	char *fn = "zynq_set_log_mode";
+
+	uint32_t i;
+
+	if (mode != LOG_SYNC_MODE && mode != LOG_ASYNC_MODE)
+	{
+		ERR("%s: Error, mode=%d out of range...\n", fn, mode);
+		return -1;
+	}
+
+	if (mode == _log_mode)
+	{
+		return 0;
+	}
+
+	if (mode == LOG_ASYNC_MODE)
+	{
+		for (i = 0; i < LOG_RING_SIZE; i++)
+		{
+			_log_ring[i].seq = _log_tail + i;
+		}
+		_log_head = _log_tail;
+
+		_log_running = 1;
+		if (pthread_create(&_log_thread, NULL, _log_main, NULL) != 0)
+		{
+			ERR("%s: Can't start logger thread...\n", fn);
+			_log_running = 0;
+			return -1;
+		}
+
+		__atomic_store_n(&_log_mode, mode, __ATOMIC_RELEASE);
+	}
+	else
+	{
+		/* New messages go straight out, then the thread drains the rest */
+		__atomic_store_n(&_log_mode, mode, __ATOMIC_RELEASE);
+		__atomic_store_n(&_log_running, 0, __ATOMIC_RELEASE);
+		pthread_join(_log_thread, NULL);
+	}
+
+	DBG("%s: Log mode=%d...\n", fn, mode);
+
+	return 0;
+}
+
+int zynq_get_log_mode()
+{
+	return _log_mode;
+}
+
+uint32_t zynq_get_log_dropped()
+{
+	return __atomic_load_n(&_log_dropped, __ATOMIC_RELAXED);
+}
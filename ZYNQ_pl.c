@@ -0,0 +1,649 @@
+/**********************************************************
+ *
+ *  In-process bitstream loader.
+ *
+ *  Streams the bitstream into xdevcfg (or any file) with
+ *  sendfile(), falling back to large aligned write()s
+ *  where the target does not take sendfile(), then polls
+ *  prog_done.  The fpga_manager firmware interface is
+ *  given the file name instead, the kernel streams it.
+ *
+ *  zynq_pl_program() keeps the identity of the image it
+ *  last loaded in a state file and skips the load while
+ *  prog_done shows that image is still in the fabric.
+ *
+ *  zynq_pl_load_mem() writes an image already in memory,
+ *  see ZYNQ_slots.c.
+ *
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#include "ZYNQ_private.h"
+
+/* Bytes per sendfile() or write() */
+#define PL_CHUNK (1024 * 1024)
+/* Alignment of the write() fallback buffer */
+#define PL_ALIGN (4096)
+/* fpga_manager only loads from here */
+#define PL_FIRMWARE_DIR "/lib/firmware/"
+/* prog_done poll interval */
+#define PL_POLL_NS (1000000ULL)
+/* First word of a state file */
+#define PL_STATE_TAG "ZPL1"
+
+/* Copy src into dst, sendfile() while the target takes it */
+static int _pl_stream(const char *fn, int src, int dst, off_t size, zynq_pl_stats_t *stats)
+{
+	char *buf = NULL;
+
+	ssize_t n, w, done;
+
+	int use_sendfile = 1;
+
+	int rv = 0;
+
+	while (rv == 0)
+	{
+		if (use_sendfile)
+		{
+			if ( (n = sendfile(dst, src, NULL, PL_CHUNK)) >= 0)
+			{
+				stats->chunks += n > 0;
+				stats->bytes += n;
+				if (n == 0)
+				{
+					break;
+				}
+				continue;
+			}
+
+			/* Only give up on sendfile() before anything was sent */
+			if (stats->bytes != 0 || (errno != EINVAL && errno != ENOSYS))
+			{
+				ERR("%s: sendfile() failed after %llu bytes...\n", fn, (unsigned long long) stats->bytes);
+				rv = -1;
+				break;
+			}
+
+			DBG("%s: Target doesn't take sendfile(), using write()...\n", fn);
+			use_sendfile = 0;
+
+			if (posix_memalign((void **) &buf, PL_ALIGN, PL_CHUNK) != 0)
+			{
+				ERR("%s: Can't allocate %d byte buffer...\n", fn, PL_CHUNK);
+				return -1;
+			}
+		}
+
+		if ( (n = read(src, buf, PL_CHUNK)) <= 0)
+		{
+			rv = n < 0 ? -1 : 0;
+			break;
+		}
+
+		for (done = 0; done < n; done += w)
+		{
+			if ( (w = write(dst, buf + done, n - done)) <= 0)
+			{
+				ERR("%s: write() failed after %llu bytes...\n", fn, (unsigned long long) stats->bytes + done);
+				rv = -1;
+				break;
+			}
+			stats->chunks++;
+		}
+
+		stats->bytes += done;
+	}
+
+	free(buf);
+
+	if (rv == 0 && (off_t) stats->bytes != size)
+	{
+		ERR("%s: Streamed %llu of %lld bytes...\n", fn, (unsigned long long) stats->bytes, (long long) size);
+		rv = -1;
+	}
+
+	return rv;
+}
+
+/* 1 if prog_done (or a manager state file) reports done, 0 if not, -1 if unreadable */
+static int _pl_read_done(const char *prog_done, char *state, size_t size)
+{
+	ssize_t n;
+
+	int fd;
+
+	if ( (fd = open(prog_done, O_RDONLY | O_CLOEXEC)) == -1)
+	{
+		return -1;
+	}
+
+	n = read(fd, state, size - 1);
+	close(fd);
+	state[n > 0 ? n : 0] = '\0';
+	state[strcspn(state, "\n")] = '\0';
+
+	return state[0] == '1' || strncmp(state, "operating", 9) == 0;
+}
+
+/* Poll prog_done until it reports done */
+static int _pl_wait_done(const char *fn, const char *prog_done, uint32_t timeout_ms)
+{
+	char state[16];
+
+	struct timespec ts = { 0, PL_POLL_NS };
+
+	uint64_t deadline = _now_ns() + (uint64_t) timeout_ms * 1000000ULL;
+
+	int rv;
+
+	while ( (rv = _pl_read_done(prog_done, state, sizeof(state))) == 0)
+	{
+		if (_now_ns() >= deadline)
+		{
+			ERR("%s: PL not programmed, %s reads \"%s\"...\n", fn, prog_done, state);
+			return -1;
+		}
+
+		nanosleep(&ts, NULL);
+	}
+
+	if (rv < 0)
+	{
+		ERR("%s: Can't open fd=%s...\n", fn, prog_done);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Hand a /lib/firmware image to an fpga_manager by name */
+static int _pl_manager(const char *fn, const char *bitstream, const char *target)
+{
+	char path[256];
+
+	const char *name;
+
+	ssize_t len;
+
+	int fd;
+
+	if (strncmp(bitstream, PL_FIRMWARE_DIR, strlen(PL_FIRMWARE_DIR)) != 0)
+	{
+		ERR("%s: fpga_manager loads from %s only, not %s...\n", fn, PL_FIRMWARE_DIR, bitstream);
+		return -1;
+	}
+
+	name = bitstream + strlen(PL_FIRMWARE_DIR);
+
+	if (snprintf(path, sizeof(path), "%s/firmware", target) >= (int) sizeof(path) ||
+		(fd = open(path, O_WRONLY | O_CLOEXEC)) == -1)
+	{
+		ERR("%s: Can't open %s/firmware...\n", fn, target);
+		return -1;
+	}
+
+	len = strlen(name);
+
+	if (write(fd, name, len) != len)
+	{
+		ERR("%s: %s rejected %s...\n", fn, path, name);
+		close(fd);
+		return -1;
+	}
+
+	return close(fd);
+}
+
+/* Wait for prog_done after a load and fill in the remaining stats */
+static int _pl_finish(const char *fn, int rv, const char *prog_done, uint32_t timeout_ms, uint64_t t0, uint64_t t1,
+	zynq_pl_stats_t *stats)
+{
+	if (rv == 0 && prog_done != NULL)
+	{
+		rv = _pl_wait_done(fn, prog_done, timeout_ms);
+		stats->done_ns = _now_ns() - t1;
+	}
+
+	stats->total_ns = _now_ns() - t0;
+	stats->bytes_per_sec = stats->stream_ns + stats->close_ns ?
+		stats->bytes * 1e9 / (stats->stream_ns + stats->close_ns) : 0;
+
+	if (rv == 0)
+	{
+		DBG("%s: %llu bytes at %.1f MB/s, open %llu us, stream %llu us, close %llu us, prog_done %llu us...\n",
+			fn, (unsigned long long) stats->bytes, stats->bytes_per_sec / 1e6,
+			(unsigned long long) stats->open_ns / 1000, (unsigned long long) stats->stream_ns / 1000,
+			(unsigned long long) stats->close_ns / 1000, (unsigned long long) stats->done_ns / 1000);
+	}
+
+	return rv;
+}
+
+int zynq_pl_load(const char *bitstream, const char *target, const char *prog_done, uint32_t timeout_ms,
+	zynq_pl_stats_t *stats)
+{
+	char *fn = "zynq_pl_load";
+
+	zynq_pl_stats_t local;
+
+	struct stat st;
+
+	uint64_t t0, t1;
+
+	int src = -1, dst = -1;
+
+	int rv = 0;
+
+	if (stats == NULL)
+	{
+		stats = &local;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (bitstream == NULL)
+	{
+		ERR("%s: Error, no bitstream...\n", fn);
+		return -1;
+	}
+
+	if (target == NULL)
+	{
+		target = PL_XDEVCFG;
+	}
+
+	t0 = _now_ns();
+
+	if (stat(target, &st) == 0 && S_ISDIR(st.st_mode))
+	{
+		DBG("%s: Loading %s through %s...\n", fn, bitstream, target);
+
+		rv = _pl_manager(fn, bitstream, target);
+		t1 = _now_ns();
+		stats->stream_ns = t1 - t0;
+	}
+	else
+	{
+		if ( (src = open(bitstream, O_RDONLY | O_CLOEXEC)) == -1 || fstat(src, &st) != 0)
+		{
+			ERR("%s: Can't open bitstream %s...\n", fn, bitstream);
+			rv = -1;
+		}
+		/* Never created, a missing /dev/xdevcfg must not turn into a file */
+		else if ( (dst = open(target, O_WRONLY | O_TRUNC | O_CLOEXEC)) == -1)
+		{
+			ERR("%s: Can't open %s...\n", fn, target);
+			rv = -1;
+		}
+
+		t1 = _now_ns();
+		stats->open_ns = t1 - t0;
+
+		if (rv == 0)
+		{
+			DBG("%s: Streaming %lld bytes of %s into %s...\n", fn, (long long) st.st_size, bitstream, target);
+
+			rv = _pl_stream(fn, src, dst, st.st_size, stats);
+			stats->stream_ns = _now_ns() - t1;
+			t1 = _now_ns();
+		}
+
+		if (src != -1)
+		{
+			close(src);
+		}
+
+		if (dst != -1 && close(dst) != 0)
+		{
+			ERR("%s: Error closing %s...\n", fn, target);
+			rv = -1;
+		}
+
+		stats->close_ns = _now_ns() - t1;
+		t1 = _now_ns();
+	}
+
+	return _pl_finish(fn, rv, prog_done, timeout_ms, t0, t1, stats);
+}
+
+int zynq_pl_load_mem(const void *buf, size_t size, const char *target, const char *prog_done, uint32_t timeout_ms,
+	zynq_pl_stats_t *stats)
+{
+	char *fn = "zynq_pl_load_mem";
+
+	zynq_pl_stats_t local;
+
+	struct stat st;
+
+	ssize_t w;
+
+	uint64_t t0, t1;
+
+	int dst;
+
+	int rv = 0;
+
+	if (stats == NULL)
+	{
+		stats = &local;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (buf == NULL || size == 0)
+	{
+		ERR("%s: Error, no bitstream...\n", fn);
+		return -1;
+	}
+
+	if (target == NULL)
+	{
+		target = PL_XDEVCFG;
+	}
+
+	if (stat(target, &st) == 0 && S_ISDIR(st.st_mode))
+	{
+		ERR("%s: fpga_manager loads files only, not memory...\n", fn);
+		return -1;
+	}
+
+	t0 = _now_ns();
+
+	/* Never created, a missing /dev/xdevcfg must not turn into a file */
+	if ( (dst = open(target, O_WRONLY | O_TRUNC | O_CLOEXEC)) == -1)
+	{
+		ERR("%s: Can't open %s...\n", fn, target);
+		return -1;
+	}
+
+	t1 = _now_ns();
+	stats->open_ns = t1 - t0;
+
+	DBG("%s: Writing %llu bytes into %s...\n", fn, (unsigned long long) size, target);
+
+	/* Straight from the caller's buffer, no staging copy */
+	while (stats->bytes < size)
+	{
+		w = write(dst, (const char *) buf + stats->bytes,
+			size - stats->bytes < PL_CHUNK ? size - stats->bytes : PL_CHUNK);
+
+		if (w <= 0)
+		{
+			ERR("%s: write() failed after %llu bytes...\n", fn, (unsigned long long) stats->bytes);
+			rv = -1;
+			break;
+		}
+
+		stats->chunks++;
+		stats->bytes += w;
+	}
+
+	stats->stream_ns = _now_ns() - t1;
+	t1 = _now_ns();
+
+	if (close(dst) != 0)
+	{
+		ERR("%s: Error closing %s...\n", fn, target);
+		rv = -1;
+	}
+
+	stats->close_ns = _now_ns() - t1;
+	t1 = _now_ns();
+
+	return _pl_finish(fn, rv, prog_done, timeout_ms, t0, t1, stats);
+}
+
+/* FNV-1a 64, start from PL_HASH_INIT */
+uint64_t _pl_hash_mem(uint64_t h, const void *buf, size_t size)
+{
+	const uint8_t *p = buf;
+
+	size_t i;
+
+	for (i = 0; i < size; i++)
+	{
+		h = (h ^ p[i]) * 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+/* FNV-1a 64 of the whole file */
+static int _pl_hash(const char *fn, const char *path, uint64_t *hash)
+{
+	uint8_t *buf;
+
+	uint64_t h = PL_HASH_INIT;
+
+	ssize_t n;
+
+	int fd;
+
+	if ( (fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+	{
+		ERR("%s: Can't open bitstream %s...\n", fn, path);
+		return -1;
+	}
+
+	if ( (buf = malloc(PL_CHUNK)) == NULL)
+	{
+		ERR("%s: Can't allocate %d byte buffer...\n", fn, PL_CHUNK);
+		close(fd);
+		return -1;
+	}
+
+	while ( (n = read(fd, buf, PL_CHUNK)) > 0)
+	{
+		h = _pl_hash_mem(h, buf, n);
+	}
+
+	free(buf);
+	close(fd);
+
+	if (n < 0)
+	{
+		ERR("%s: Error reading bitstream %s...\n", fn, path);
+		return -1;
+	}
+
+	*hash = h;
+
+	return 0;
+}
+
+int _pl_ident(const char *path, _pl_ident_t *id)
+{
+	struct stat st;
+
+	if (stat(path, &st) != 0 || strlen(path) >= sizeof(id->path))
+	{
+		return -1;
+	}
+
+	memset(id, 0, sizeof(*id));
+	strcpy(id->path, path);
+	id->size = st.st_size;
+	id->mtime_ns = (uint64_t) st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+	id->ino = st.st_ino;
+
+	return 0;
+}
+
+static int _pl_state_read(const char *state_file, _pl_ident_t *id)
+{
+	char tag[8];
+
+	FILE *fp;
+
+	int n;
+
+	if ( (fp = fopen(state_file, "r")) == NULL)
+	{
+		return -1;
+	}
+
+	memset(id, 0, sizeof(*id));
+	n = fscanf(fp, "%7s %llx %llu %llu %llu %255[^\n]", tag, (unsigned long long *) &id->hash,
+		(unsigned long long *) &id->size, (unsigned long long *) &id->mtime_ns,
+		(unsigned long long *) &id->ino, id->path);
+	fclose(fp);
+
+	return n == 6 && strcmp(tag, PL_STATE_TAG) == 0 ? 0 : -1;
+}
+
+/* Replace the state file in one rename, a crash leaves the old or the new one */
+static int _pl_state_write(const char *fn, const char *state_file, const _pl_ident_t *id)
+{
+	char tmp[300];
+
+	FILE *fp;
+
+	int rv;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", state_file) >= (int) sizeof(tmp) || (fp = fopen(tmp, "w")) == NULL)
+	{
+		ERR("%s: Can't write %s...\n", fn, state_file);
+		return -1;
+	}
+
+	fprintf(fp, "%s %016llx %llu %llu %llu %s\n", PL_STATE_TAG, (unsigned long long) id->hash,
+		(unsigned long long) id->size, (unsigned long long) id->mtime_ns,
+		(unsigned long long) id->ino, id->path);
+
+	rv = fclose(fp);
+
+	if (rv != 0 || rename(tmp, state_file) != 0)
+	{
+		ERR("%s: Can't write %s...\n", fn, state_file);
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * 1 when state_file shows cur is still in the fabric, refreshing the
+ * recorded metadata for a copy of the same image.  Otherwise forgets the
+ * state, whatever is loaded is unknown until the load succeeds.
+ */
+static int _pl_loaded(const char *fn, const _pl_ident_t *cur, const _pl_ident_t *last, const char *prog_done,
+	const char *state_file, int force)
+{
+	char state[16];
+
+	if (!force && last != NULL && cur->hash == last->hash && cur->size == last->size &&
+		(prog_done == NULL || _pl_read_done(prog_done, state, sizeof(state)) == 1))
+	{
+		DBG("%s: %s (%016llx) already loaded, skipping...\n", fn, cur->path, (unsigned long long) cur->hash);
+
+		/* Keep the metadata shortcut working for a copy of the same image */
+		if (strcmp(cur->path, last->path) != 0 || cur->mtime_ns != last->mtime_ns || cur->ino != last->ino)
+		{
+			_pl_state_write(fn, state_file, cur);
+		}
+
+		return 1;
+	}
+
+	unlink(state_file);
+
+	return 0;
+}
+
+int zynq_pl_program(const char *bitstream, const char *target, const char *prog_done, const char *state_file,
+	uint32_t timeout_ms, int force, zynq_pl_stats_t *stats)
+{
+	char *fn = "zynq_pl_program";
+
+	zynq_pl_stats_t local;
+
+	_pl_ident_t cur, last;
+
+	uint64_t t0 = _now_ns(), hash_ns = 0;
+
+	int have_last, rv;
+
+	if (stats == NULL)
+	{
+		stats = &local;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (bitstream == NULL || state_file == NULL || _pl_ident(bitstream, &cur) != 0)
+	{
+		ERR("%s: Can't stat bitstream %s...\n", fn, bitstream ? bitstream : "(null)");
+		return -1;
+	}
+
+	have_last = _pl_state_read(state_file, &last) == 0;
+
+	/* Same file as last time, trust the recorded hash */
+	if (have_last && strcmp(cur.path, last.path) == 0 && cur.size == last.size &&
+		cur.mtime_ns == last.mtime_ns && cur.ino == last.ino)
+	{
+		cur.hash = last.hash;
+	}
+	else
+	{
+		if (_pl_hash(fn, bitstream, &cur.hash) != 0)
+		{
+			return -1;
+		}
+		hash_ns = _now_ns() - t0;
+	}
+
+	if (_pl_loaded(fn, &cur, have_last ? &last : NULL, prog_done, state_file, force))
+	{
+		stats->cached = 1;
+		rv = 0;
+	}
+	else if ( (rv = zynq_pl_load(bitstream, target, prog_done, timeout_ms, stats)) == 0)
+	{
+		_pl_state_write(fn, state_file, &cur);
+	}
+
+	stats->hash = cur.hash;
+	stats->hash_ns = hash_ns;
+	stats->total_ns = _now_ns() - t0;
+
+	return rv;
+}
+
+int _pl_program_mem(const char *fn, const _pl_ident_t *id, const void *buf, const char *target,
+	const char *prog_done, const char *state_file, uint32_t timeout_ms, int force, zynq_pl_stats_t *stats)
+{
+	_pl_ident_t last;
+
+	uint64_t t0 = _now_ns();
+
+	int rv;
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (_pl_loaded(fn, id, _pl_state_read(state_file, &last) == 0 ? &last : NULL, prog_done, state_file, force))
+	{
+		stats->cached = 1;
+		rv = 0;
+	}
+	else if ( (rv = zynq_pl_load_mem(buf, id->size, target, prog_done, timeout_ms, stats)) == 0)
+	{
+		_pl_state_write(fn, state_file, id);
+	}
+
+	stats->hash = id->hash;
+	stats->total_ns = _now_ns() - t0;
+
+	return rv;
+}
@@ -0,0 +1,266 @@
+/**********************************************************
+ *
+ *  Software change poller.
+ *
+ *  For designs without interrupt wiring, a library thread
+ *  samples the watched channels with one zynq_dev_readv()
+ *  and compares them against the previous sample.  Changed
+ *  bits accumulate until the application collects them, a
+ *  burst of changes signals the eventfd only once.  The
+ *  interval drops to the minimum (spinning when short)
+ *  after a change and doubles back to the maximum once the
+ *  inputs have been idle.
+ *
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "ZYNQ_private.h"
+#include "include/ZYNQ_poll.h"
+
+/* Intervals below this are busy waited rather than slept */
+#define POLL_SPIN_NS (50000ULL)
+
+struct zynq_poll {
+	zynq_dev_t *dev;
+	zynq_poll_cfg_t cfg;
+	zynq_poll_src_t srcs[POLL_MAX_SRCS];
+	zynq_regop_t ops[POLL_MAX_SRCS];
+	int fd;
+	pthread_t thread;
+	int stop;
+	/* Set by the poller when it signals the eventfd, cleared by the reader */
+	uint32_t pending;
+	uint32_t changed[POLL_MAX_SRCS];
+	uint32_t value[POLL_MAX_SRCS];
+	uint64_t samples;
+	uint64_t changes;
+	uint64_t wakeups;
+	uint64_t interval_ns;
+};
+
+static void * _poll_main(void *arg)
+{
+	zynq_poll_t *poll = arg;
+
+	const zynq_poll_cfg_t *cfg = &poll->cfg;
+
+	uint32_t prev[POLL_MAX_SRCS];
+
+	uint32_t diff, i, any;
+
+	uint64_t now, last_change = 0, interval, one = 1;
+
+	if (zynq_dev_readv(poll->dev, poll->ops, cfg->num_srcs) != 0)
+	{
+		ERR("zynq_poll: Error reading sources, stopping...\n");
+		return NULL;
+	}
+
+	for (i = 0; i < cfg->num_srcs; i++)
+	{
+		prev[i] = poll->ops[i].value & poll->srcs[i].mask;
+		__atomic_store_n(&poll->value[i], prev[i], __ATOMIC_RELAXED);
+	}
+
+	interval = cfg->max_interval_ns;
+
+	while (!__atomic_load_n(&poll->stop, __ATOMIC_ACQUIRE))
+	{
+		__atomic_store_n(&poll->interval_ns, interval, __ATOMIC_RELAXED);
+
+		if (_sleep_until(_now_ns() + interval, interval < POLL_SPIN_NS ? interval : 0, &poll->stop))
+		{
+			break;
+		}
+
+		if (zynq_dev_readv(poll->dev, poll->ops, cfg->num_srcs) != 0)
+		{
+			ERR("zynq_poll: Error reading sources, stopping...\n");
+			break;
+		}
+
+		now = _now_ns();
+		poll->samples++;
+		any = 0;
+
+		for (i = 0; i < cfg->num_srcs; i++)
+		{
+			diff = (poll->ops[i].value & poll->srcs[i].mask) ^ prev[i];
+			prev[i] ^= diff;
+
+			if (diff)
+			{
+				__atomic_store_n(&poll->value[i], prev[i], __ATOMIC_RELAXED);
+				__atomic_fetch_or(&poll->changed[i], diff, __ATOMIC_RELEASE);
+				any = 1;
+			}
+		}
+
+		if (any)
+		{
+			poll->changes++;
+			last_change = now;
+			interval = cfg->min_interval_ns;
+
+			/* Only the first change of a burst wakes the reader */
+			if (__atomic_exchange_n(&poll->pending, 1, __ATOMIC_ACQ_REL) == 0)
+			{
+				poll->wakeups++;
+				if (write(poll->fd, &one, sizeof(one)) != sizeof(one))
+				{
+					ERR("zynq_poll: Can't signal eventfd...\n");
+				}
+			}
+		}
+		else if (now - last_change > cfg->active_ns && interval < cfg->max_interval_ns)
+		{
+			interval = interval ? interval * 2 : 1000;
+			if (interval > cfg->max_interval_ns)
+			{
+				interval = cfg->max_interval_ns;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+zynq_poll_t * zynq_poll_start(zynq_dev_t *dev, const zynq_poll_cfg_t *cfg)
+{
+	char *fn = "zynq_poll_start";
+
+	zynq_poll_t *poll;
+
+	uint32_t i;
+
+	if (dev == NULL || cfg == NULL || cfg->srcs == NULL || cfg->num_srcs == 0 ||
+		cfg->num_srcs > POLL_MAX_SRCS || cfg->min_interval_ns > cfg->max_interval_ns)
+	{
+		ERR("%s: Error, invalid sources or intervals...\n", fn);
+		return NULL;
+	}
+
+	if ( (poll = calloc(1, sizeof(*poll))) == NULL)
+	{
+		ERR("%s: Can't allocate poller...\n", fn);
+		return NULL;
+	}
+
+	poll->dev = dev;
+	poll->cfg = *cfg;
+	memcpy(poll->srcs, cfg->srcs, cfg->num_srcs * sizeof(zynq_poll_src_t));
+	poll->cfg.srcs = poll->srcs;
+
+	for (i = 0; i < cfg->num_srcs; i++)
+	{
+		if (poll->srcs[i].mask == 0)
+		{
+			poll->srcs[i].mask = 0xffffffff;
+		}
+
+		poll->ops[i].offset = poll->srcs[i].offset;
+		poll->ops[i].channel = poll->srcs[i].channel;
+		poll->ops[i].field = FIELD_DATA;
+	}
+
+	/* Validates every source once, the poller reads them as a batch */
+	if (zynq_dev_readv(dev, poll->ops, cfg->num_srcs) != 0)
+	{
+		ERR("%s: Error, invalid sources...\n", fn);
+		free(poll);
+		return NULL;
+	}
+
+	if ( (poll->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1)
+	{
+		ERR("%s: Can't create eventfd...\n", fn);
+		free(poll);
+		return NULL;
+	}
+
+	if (pthread_create(&poll->thread, NULL, _poll_main, poll) != 0)
+	{
+		ERR("%s: Can't start poller thread...\n", fn);
+		close(poll->fd);
+		free(poll);
+		return NULL;
+	}
+
+	DBG("%s: Polling %d sources every %llu-%llu ns...\n", fn, cfg->num_srcs,
+		(unsigned long long) cfg->min_interval_ns, (unsigned long long) cfg->max_interval_ns);
+
+	return poll;
+}
+
+int zynq_poll_fd(zynq_poll_t *poll)
+{
+	return poll != NULL ? poll->fd : -1;
+}
+
+int zynq_poll_read(zynq_poll_t *poll, zynq_poll_event_t *ev)
+{
+	uint64_t count;
+
+	uint32_t i, any = 0;
+
+	if (poll == NULL || ev == NULL)
+	{
+		return -1;
+	}
+
+	/* Re-arm first, a change from now on signals again */
+	__atomic_store_n(&poll->pending, 0, __ATOMIC_SEQ_CST);
+	/* Drain the eventfd, EAGAIN when nothing was signalled */
+	while (read(poll->fd, &count, sizeof(count)) > 0)
+	{
+	}
+
+	memset(ev, 0, sizeof(*ev));
+
+	for (i = 0; i < poll->cfg.num_srcs; i++)
+	{
+		ev->changed[i] = __atomic_exchange_n(&poll->changed[i], 0, __ATOMIC_ACQUIRE);
+		ev->value[i] = __atomic_load_n(&poll->value[i], __ATOMIC_RELAXED);
+		any |= ev->changed[i];
+	}
+
+	return any != 0;
+}
+
+int zynq_poll_get_stats(zynq_poll_t *poll, zynq_poll_stats_t *stats)
+{
+	if (poll == NULL || stats == NULL)
+	{
+		return -1;
+	}
+
+	/* Unlocked snapshot */
+	stats->samples = poll->samples;
+	stats->changes = poll->changes;
+	stats->wakeups = poll->wakeups;
+	stats->interval_ns = __atomic_load_n(&poll->interval_ns, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+int zynq_poll_stop(zynq_poll_t *poll)
+{
+	if (poll == NULL)
+	{
+		return -1;
+	}
+
+	__atomic_store_n(&poll->stop, 1, __ATOMIC_RELEASE);
+	pthread_join(poll->thread, NULL);
+
+	close(poll->fd);
+	free(poll);
+
+	return 0;
+}
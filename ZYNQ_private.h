@@ -0,0 +1,281 @@
+#ifndef _ZYNQ_PRIVATE_H_
+#define _ZYNQ_PRIVATE_H_
+
+/*
+ * Internal definitions shared by the driver modules, not installed with
+ * include/ZYNQ_driver.h.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "include/ZYNQ_driver.h"
+#include "include/ZYNQ_trace.h"
+#include "include/ZYNQ_stats.h"
+
+/* Masks for testing log settings */
+#define ERROR (0x01)
+#define DEBUG (0x02)
+#define DIAG  (0x04)
+
+/*
+ * Compile-time log level, messages above it are removed from the build:
+ * 0 = none, 1 = ERR, 2 = ERR+DBG, 3 = ERR+DBG+DLOG.  Build with e.g.
+ * make DEFINES=-DZYNQ_LOG_LEVEL=1 to take the debug checks off the
+ * register access path entirely.
+ */
+#ifndef ZYNQ_LOG_LEVEL
+#define ZYNQ_LOG_LEVEL (3)
+#endif
+
+/*
+ * Call statistics, see ZYNQ_stats.c.  make DEFINES=-DZYNQ_STATS=0 removes
+ * them from the register calls.
+ */
+#ifndef ZYNQ_STATS
+#define ZYNQ_STATS (1)
+#endif
+
+/* Debug level, see zynq_set_debug_level() */
+extern int _zynq_dbg_lvl;
+
+/* Compiled out calls stay type checked but generate no code */
+#define _LOG_OFF(...) do { if (0) printf(__VA_ARGS__); } while (0)
+
+/* Macro to shorten log lines */
+#if ZYNQ_LOG_LEVEL >= 1
+#define ERR(...)  do { if (_zynq_dbg_lvl & ERROR) printf(__VA_ARGS__); } while (0)
+#else
+#define ERR(...)  _LOG_OFF(__VA_ARGS__)
+#endif
+
+#if ZYNQ_LOG_LEVEL >= 2
+#define DBG(...)  do { if (_zynq_dbg_lvl & DEBUG) printf(__VA_ARGS__); } while (0)
+/*
+ * Register access path messages, a fixed fn + three word signature so they
+ * can be queued and formatted later by the asynchronous logger.
+ */
+#define DBG_HOT(fmt, fn, a, b, c) \
+	do { if (__builtin_expect(_zynq_dbg_lvl & DEBUG, 0)) _log_hot(fmt, fn, a, b, c); } while (0)
+#else
+#define DBG(...)  _LOG_OFF(__VA_ARGS__)
+#define DBG_HOT(fmt, fn, a, b, c) _LOG_OFF(fmt, fn, a, b, c)
+#endif
+
+#if ZYNQ_LOG_LEVEL >= 3
+#define DLOG(...) do { if (_zynq_dbg_lvl & DIAG) printf(__VA_ARGS__); } while (0)
+#else
+#define DLOG(...) _LOG_OFF(__VA_ARGS__)
+#endif
+
+/* Trace ring, see ZYNQ_trace.c */
+typedef struct _trace _trace_t;
+typedef struct _broker_shm _broker_shm_t;
+/* Call statistics, see ZYNQ_stats.c */
+typedef struct _stats _stats_t;
+
+/* Requests forwarded to the broker, see ZYNQ_broker.c */
+#define BROKER_SET_DIR   (1)
+#define BROKER_GET_DIR   (2)
+#define BROKER_WRITE     (3)
+#define BROKER_WRITE_LW  (4)
+#define BROKER_WRITE_UW  (5)
+#define BROKER_READ      (6)
+#define BROKER_READ_LW   (7)
+#define BROKER_READ_UW   (8)
+#define BROKER_BITS      (9)	/* arg from BROKER_BITS_ARG(), data[CH1_INDEX] is the mask */
+
+#define BROKER_BITS_ARG(channel, tri, op)  ((channel) | ((tri) << 4) | ((op) << 8))
+#define BROKER_BITS_CHAN(arg)  ((arg) & 0xf)
+#define BROKER_BITS_TRI(arg)   (((arg) >> 4) & 0xf)
+#define BROKER_BITS_OP(arg)    (((arg) >> 8) & 0xf)
+
+/* Register backend, see zynq_set_backend() */
+typedef struct {
+	const char *name;
+	/* Open the file backing the registers, returns fd or -1 */
+	int (*open)(const char *fn, const char *path);
+	/* File offset of the register window starting at physical address win_base */
+	off_t (*offset)(off_t win_base);
+	/* Non-zero if the PL is real, i.e. xdevcfg and prog_done apply */
+	int has_pl;
+} _backend_t;
+
+/* One AXI GPIO instance of a device */
+typedef struct {
+	volatile gpio_t *regs;
+	/* CH1_MASK and, for dual channel instances, CH2_MASK */
+	uint32_t chan_mask;
+	/* Last value written to (or loaded from) each register */
+	uint32_t shadow_data[MAX_CHANS];
+	uint32_t shadow_tri[MAX_CHANS];
+	/* Serializes bit operations, and every writer in thread-safe mode */
+	uint32_t lock;
+	/* Serializes the first use mapping in lazy mode, taken with lock possibly held */
+	uint32_t map_lock;
+	/* Backend file offset of the GPIO block */
+	off_t map_off;
+	/* Own mapping in lazy mode, NULL until first use */
+	void *map;
+	size_t map_size;
+} _gpio_entry_t;
+
+/* Number of spins on a held GPIO lock before yielding the CPU */
+#define LOCK_SPINS (100)
+
+static inline void _spin_lock(uint32_t *lock)
+{
+	int spins = 0;
+
+	while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE))
+	{
+		while (__atomic_load_n(lock, __ATOMIC_RELAXED))
+		{
+			if (++spins >= LOCK_SPINS)
+			{
+				sched_yield();
+				spins = 0;
+			}
+		}
+	}
+}
+
+static inline void _spin_unlock(uint32_t *lock)
+{
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+static inline void _gpio_lock(_gpio_entry_t *entry)
+{
+	_spin_lock(&entry->lock);
+}
+
+static inline void _gpio_unlock(_gpio_entry_t *entry)
+{
+	_spin_unlock(&entry->lock);
+}
+
+struct zynq_dev {
+	const _backend_t *backend;
+	/* Memory file device backing the mapping */
+	int mem_fd;
+	/* Single mapping covering every GPIO of the device */
+	void *mapped_base;
+	size_t mapped_size;
+	/* GPIO table, indexed by offset */
+	uint32_t num_gpio;
+	_gpio_entry_t *gpio;
+	uint32_t opmode;
+	int open;
+	int init;
+	/* Serve direction queries and half word merges from the shadow registers */
+	int shadow;
+	/* Writers take the per-GPIO locks, see _write_lock() */
+	int threadsafe;
+	/* Each GPIO is mapped on first use, see _get_gpio() */
+	int lazy;
+	/* Broker client, every register call is forwarded, no mappings */
+	_broker_shm_t *broker;
+	/* Register access trace, NULL while not recording */
+	_trace_t *trace;
+	_trace_t *trace_ring;
+	/* Call statistics, NULL while not timing */
+	_stats_t *stats;
+	_stats_t *stats_buf;
+};
+
+static inline uint64_t _now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Lateness accumulator with power of 2 buckets */
+typedef struct {
+	uint64_t count;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint64_t sum_ns;
+	uint64_t bucket[64];
+} _lat_t;
+
+/* ZYNQ_driver.c */
+volatile gpio_t *_get_gpio(zynq_dev_t *dev, const char *fn, uint32_t offset);
+
+/* ZYNQ_pl.c */
+
+/* Time the PL gets to raise prog_done after the bitstream is loaded */
+#define PL_DONE_TIMEOUT_MS (1000)
+
+/* FNV-1a 64 offset basis, see _pl_hash_mem() */
+#define PL_HASH_INIT (0xcbf29ce484222325ULL)
+
+/* What the state file records about the last image programmed */
+typedef struct {
+	uint64_t hash;
+	uint64_t size;
+	uint64_t mtime_ns;
+	uint64_t ino;
+	char path[256];
+} _pl_ident_t;
+
+uint64_t _pl_hash_mem(uint64_t h, const void *buf, size_t size);
+int _pl_ident(const char *path, _pl_ident_t *id);
+/* zynq_pl_program() of an image already in memory, id describes its file */
+int _pl_program_mem(const char *fn, const _pl_ident_t *id, const void *buf, const char *target,
+	const char *prog_done, const char *state_file, uint32_t timeout_ms, int force, zynq_pl_stats_t *stats);
+
+/* ZYNQ_log.c */
+void _log_hot(const char *fmt, const char *fn, uint32_t a, uint32_t b, uint32_t c);
+
+/* ZYNQ_trace.c */
+void _trace_rec(_trace_t *trace, uint32_t offset, uint32_t chan, uint32_t flags, uint32_t value);
+void _trace_free(zynq_dev_t *dev);
+
+/* ZYNQ_stats.c */
+void _stats_rec(_stats_t *stats, uint32_t op, uint32_t offset, uint64_t ns, int rv);
+void _stats_free(zynq_dev_t *dev);
+
+/* ZYNQ_broker.c */
+zynq_dev_t *_broker_connect(const char *fn, const char *name, uint32_t opmode, uint32_t initmode);
+void _broker_disconnect(zynq_dev_t *dev);
+int _broker_call(zynq_dev_t *dev, const char *fn, uint32_t op, uint32_t offset, uint32_t arg, uint32_t *data);
+
+/* ZYNQ_seq.c */
+void _lat_add(_lat_t *lat, uint64_t ns);
+uint64_t _lat_pct(const _lat_t *lat, double pct);
+int _sleep_until(uint64_t deadline_ns, uint64_t spin_ns, const int *stop);
+int _set_rt_priority(const char *fn, int priority);
+
+/*
+ * Evaluate the register call call of dev, timed and counted as op at
+ * offset when the device is collecting statistics.  The load of stats is
+ * relaxed, no barrier while stopped, the counters are reached through it.
+ */
+#if ZYNQ_STATS
+#define STATS_CALL(dev, op, offset, call) \
+	({ \
+		_stats_t *_st = (dev) != NULL ? __atomic_load_n(&(dev)->stats, __ATOMIC_RELAXED) : NULL; \
+		uint64_t _st_t0 = __builtin_expect(_st != NULL, 0) ? _now_ns() : 0; \
+		int _st_rv = (call); \
+		if (__builtin_expect(_st != NULL, 0)) \
+			_stats_rec(_st, op, offset, _now_ns() - _st_t0, _st_rv); \
+		_st_rv; \
+	})
+#else
+#define STATS_CALL(dev, op, offset, call) (call)
+#endif
+
+/* Record one register access when the device is tracing, the ring is loaded once as in STATS_CALL() */
+#define TRACE(dev, offset, chan, flags, value) \
+	do { _trace_t *_tr = __atomic_load_n(&(dev)->trace, __ATOMIC_RELAXED); \
+		if (__builtin_expect(_tr != NULL, 0)) \
+			_trace_rec(_tr, offset, chan, flags, value); } while (0)
+
+#endif  /* _ZYNQ_PRIVATE_H_ */
@@ -0,0 +1,248 @@
+/**********************************************************
+ *
+ *  Register traffic replay.
+ *
+ *  Drives the records of a register access trace back
+ *  through the driver calls that produced them, with the
+ *  recorded gaps or back to back.  Against a simulated
+ *  mapping this gives a repeatable load on the write,
+ *  read and _sw_clock paths built from a real session.
+ *
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "ZYNQ_private.h"
+#include "include/ZYNQ_replay.h"
+
+int zynq_replay_load(const char *path, zynq_trace_rec_t **recs, uint32_t *count)
+{
+	char *fn = "zynq_replay_load";
+
+	FILE *fp;
+
+	zynq_trace_hdr_t hdr;
+
+	if (path == NULL || recs == NULL || count == NULL || (fp = fopen(path, "rb")) == NULL)
+	{
+		ERR("%s: Can't open %s...\n", fn, path ? path : "(null)");
+		return -1;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != TRACE_MAGIC ||
+		hdr.version != TRACE_VERSION || hdr.rec_size != sizeof(zynq_trace_rec_t))
+	{
+		ERR("%s: %s is not a version %d trace file...\n", fn, path, TRACE_VERSION);
+		fclose(fp);
+		return -1;
+	}
+
+	if ( (*recs = malloc((size_t) (hdr.count ? hdr.count : 1) * sizeof(zynq_trace_rec_t))) == NULL)
+	{
+		ERR("%s: Can't allocate %u records...\n", fn, hdr.count);
+		fclose(fp);
+		return -1;
+	}
+
+	if (fread(*recs, sizeof(zynq_trace_rec_t), hdr.count, fp) != hdr.count)
+	{
+		ERR("%s: %s truncated...\n", fn, path);
+		free(*recs);
+		*recs = NULL;
+		fclose(fp);
+		return -1;
+	}
+
+	fclose(fp);
+
+	*count = hdr.count;
+
+	DBG("%s: %u records from %s, %u older records lost when recorded...\n", fn, hdr.count, path, hdr.lost);
+
+	return 0;
+}
+
+/* Records of one call, only a two channel call leaves a second record without TRACE_CALL */
+static uint32_t _replay_span(const zynq_trace_rec_t *rec, uint32_t left)
+{
+	return left > 1 && !(rec[1].flags & TRACE_CALL) && rec[0].chan == CH1_INDEX && rec[1].chan == CH2_INDEX &&
+		rec[1].offset == rec[0].offset && (rec[1].flags | TRACE_CALL) == rec[0].flags ? 2 : 1;
+}
+
+/* The n records of one call through that call, 1 on a read mismatch */
+static int _replay_op(zynq_dev_t *dev, const zynq_trace_rec_t *rec, uint32_t n)
+{
+	uint32_t data[MAX_CHANS] = { 0, 0 };
+
+	uint32_t mask = 0, i;
+
+	int rv;
+
+	for (i = 0; i < n; i++)
+	{
+		data[rec[i].chan] = rec[i].value;
+		mask |= 1 << rec[i].chan;
+	}
+
+	if (rec->flags & TRACE_WRITE)
+	{
+		return rec->flags & TRACE_TRI ? zynq_dev_set_gpio_direction(dev, rec->offset, data, mask) :
+			zynq_dev_write(dev, rec->offset, data, mask);
+	}
+
+	if ( (rv = rec->flags & TRACE_TRI ? zynq_dev_get_gpio_direction(dev, rec->offset, data, mask) :
+		zynq_dev_read(dev, rec->offset, data, mask)) != 0)
+	{
+		return rv;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		if (data[rec[i].chan] != rec[i].value)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int zynq_replay_run(zynq_dev_t *dev, const zynq_trace_rec_t *recs, uint32_t count,
+	const zynq_replay_cfg_t *cfg, const int *stop, zynq_replay_stats_t *stats)
+{
+	char *fn = "zynq_replay_run";
+
+	const zynq_trace_rec_t *rec;
+
+	zynq_replay_cfg_t def;
+
+	struct sched_param sp;
+
+	_lat_t late, op;
+
+	uint64_t start, pass_start, deadline, t0, t1;
+
+	uint32_t i, n, pass, loops;
+
+	int policy, rv = 0;
+
+	if (dev == NULL || dev->open != 1 || stats == NULL || (recs == NULL && count != 0))
+	{
+		ERR("%s: Device not open or no records...\n", fn);
+		return -1;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		if (recs[i].chan >= MAX_CHANS || recs[i].offset >= dev->num_gpio)
+		{
+			ERR("%s: Error, record %u offset=%d, channel=%d not in this design...\n", fn, i,
+				recs[i].offset, recs[i].chan + 1);
+			return -1;
+		}
+	}
+
+	if (cfg == NULL)
+	{
+		memset(&def, 0, sizeof(def));
+		cfg = &def;
+	}
+
+	loops = cfg->loops ? cfg->loops : 1;
+
+	memset(stats, 0, sizeof(*stats));
+	memset(&late, 0, sizeof(late));
+	memset(&op, 0, sizeof(op));
+
+	pthread_getschedparam(pthread_self(), &policy, &sp);
+	_set_rt_priority(fn, cfg->rt_priority);
+
+	start = _now_ns();
+
+	for (pass = 0; pass < loops && rv == 0; pass++)
+	{
+		pass_start = _now_ns();
+
+		for (i = 0; i < count; i += n)
+		{
+			rec = &recs[i];
+			n = 1;
+
+			/* The write calls regenerate the CR strobe of a test mode device */
+			if (dev->opmode == OP_TEST_MODE && rec->offset == CR)
+			{
+				stats->clocks++;
+				continue;
+			}
+
+			if (cfg->flags & REPLAY_TIMED)
+			{
+				deadline = pass_start + (rec->ts_ns - recs[0].ts_ns);
+
+				if (_sleep_until(deadline, cfg->spin_ns, stop))
+				{
+					rv = 1;
+					break;
+				}
+
+				_lat_add(&late, _now_ns() - deadline);
+			}
+			else if (stop != NULL && (i & 0xff) == 0 && __atomic_load_n(stop, __ATOMIC_ACQUIRE))
+			{
+				rv = 1;
+				break;
+			}
+
+			/* Both channels in one call, as recorded, or a test mode device strobes twice */
+			n = _replay_span(rec, count - i);
+
+			t0 = _now_ns();
+			rv = _replay_op(dev, rec, n);
+			t1 = _now_ns();
+
+			if (rv < 0)
+			{
+				ERR("%s: Error replaying record %u, stopping...\n", fn, i);
+				stats->errors++;
+				break;
+			}
+
+			if (rv > 0)
+			{
+				if (stats->mismatches++ == 0)
+				{
+					stats->first_mismatch = i;
+				}
+				rv = 0;
+			}
+
+			_lat_add(&op, t1 - t0);
+			stats->ops += n;
+			stats->writes += (rec->flags & TRACE_WRITE) ? n : 0;
+			stats->reads += (rec->flags & TRACE_WRITE) ? 0 : n;
+			stats->strobes += dev->opmode == OP_TEST_MODE && (rec->flags & (TRACE_WRITE | TRACE_TRI)) == TRACE_WRITE;
+		}
+	}
+
+	stats->elapsed_ns = _now_ns() - start;
+
+	pthread_setschedparam(pthread_self(), policy, &sp);
+
+	stats->ops_per_sec = stats->elapsed_ns ? stats->ops * 1e9 / stats->elapsed_ns : 0;
+	stats->late_min_ns = late.min_ns;
+	stats->late_max_ns = late.max_ns;
+	stats->late_mean_ns = late.count ? late.sum_ns / late.count : 0;
+	stats->late_p99_ns = _lat_pct(&late, 99.0);
+	stats->op_mean_ns = op.count ? op.sum_ns / op.count : 0;
+	stats->op_p99_ns = _lat_pct(&op, 99.0);
+
+	DBG("%s: %llu ops, %llu mismatches in %llu ns...\n", fn, (unsigned long long) stats->ops,
+		(unsigned long long) stats->mismatches, (unsigned long long) stats->elapsed_ns);
+
+	/* A stop request is not an error */
+	return rv < 0 ? -1 : 0;
+}
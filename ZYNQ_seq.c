@@ -0,0 +1,312 @@
+/**********************************************************
+ *
+ *  Timed register sequence player.
+ *
+ *  Plays a table of {deadline, register writes} steps on
+ *  a dedicated thread.  Deadlines are absolute, so the
+ *  cost of each write never accumulates into drift, and
+ *  the lateness of every step is recorded.
+ *
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "ZYNQ_private.h"
+#include "include/ZYNQ_seq.h"
+
+/* Longest single sleep, bounds the reaction time to zynq_seq_stop() */
+#define SEQ_SLEEP_SLICE_NS (10000000ULL)
+
+struct zynq_seq {
+	zynq_dev_t *dev;
+	zynq_seq_cfg_t cfg;
+	pthread_t thread;
+	int stop;
+	int done;
+	uint64_t steps;
+	uint64_t passes;
+	uint64_t errors;
+	_lat_t late;
+};
+
+void _lat_add(_lat_t *lat, uint64_t ns)
+{
+	uint32_t b = 0;
+
+	if (lat->count == 0 || ns < lat->min_ns)
+	{
+		lat->min_ns = ns;
+	}
+	if (ns > lat->max_ns)
+	{
+		lat->max_ns = ns;
+	}
+
+	lat->count++;
+	lat->sum_ns += ns;
+
+	/* Bucket b holds values below 2^b */
+	while (b < 63 && (ns >> b) != 0)
+	{
+		b++;
+	}
+	lat->bucket[b]++;
+}
+
+uint64_t _lat_pct(const _lat_t *lat, double pct)
+{
+	uint64_t target, seen = 0;
+	uint32_t b;
+
+	if (lat->count == 0)
+	{
+		return 0;
+	}
+
+	target = (uint64_t) (lat->count * pct / 100.0 + 0.5);
+
+	for (b = 0; b < 64; b++)
+	{
+		seen += lat->bucket[b];
+		if (seen >= target && seen > 0)
+		{
+			/* Never report more than was actually seen */
+			return b == 0 ? 0 : ((1ULL << b) - 1 < lat->max_ns ? (1ULL << b) - 1 : lat->max_ns);
+		}
+	}
+
+	return lat->max_ns;
+}
+
+/*
+ * Sleep until an absolute CLOCK_MONOTONIC deadline, in slices so a stop
+ * request is noticed, busy waiting the last spin_ns.  Returns non-zero if
+ * stopped early.
+ */
+int _sleep_until(uint64_t deadline_ns, uint64_t spin_ns, const int *stop)
+{
+	struct timespec ts;
+	uint64_t now, wake;
+
+	for (;;)
+	{
+		if (stop != NULL && __atomic_load_n(stop, __ATOMIC_ACQUIRE))
+		{
+			return 1;
+		}
+
+		now = _now_ns();
+		if (now + spin_ns >= deadline_ns)
+		{
+			break;
+		}
+
+		wake = deadline_ns - spin_ns;
+		if (wake - now > SEQ_SLEEP_SLICE_NS)
+		{
+			wake = now + SEQ_SLEEP_SLICE_NS;
+		}
+
+		ts.tv_sec = wake / 1000000000ULL;
+		ts.tv_nsec = wake % 1000000000ULL;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	}
+
+	while (_now_ns() < deadline_ns)
+	{
+		/* Spin */
+	}
+
+	return 0;
+}
+
+int _set_rt_priority(const char *fn, int priority)
+{
+	struct sched_param sp;
+
+	if (priority <= 0)
+	{
+		return 0;
+	}
+
+	memset(&sp, 0, sizeof(sp));
+	sp.sched_priority = priority;
+
+	if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp) != 0)
+	{
+		ERR("%s: Can't set SCHED_FIFO priority %d, running unprioritized...\n", fn, priority);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void * _seq_main(void *arg)
+{
+	zynq_seq_t *seq = arg;
+
+	const zynq_seq_cfg_t *cfg = &seq->cfg;
+
+	const zynq_seq_step_t *step;
+
+	uint64_t start, deadline, late;
+
+	uint32_t i;
+
+	_set_rt_priority("zynq_seq", cfg->rt_priority);
+
+	start = _now_ns();
+
+	do
+	{
+		for (i = 0; i < cfg->num_steps; i++)
+		{
+			step = &cfg->steps[i];
+			deadline = start + seq->passes * cfg->period_ns + step->t_ns;
+
+			if (_sleep_until(deadline, cfg->spin_ns, &seq->stop))
+			{
+				goto out;
+			}
+
+			late = _now_ns() - deadline;
+
+			if (zynq_dev_writev(seq->dev, step->ops, step->count, cfg->writev_flags) != 0)
+			{
+				ERR("zynq_seq: Error writing step %d...\n", i);
+				seq->errors++;
+				goto out;
+			}
+
+			_lat_add(&seq->late, late);
+			seq->steps++;
+
+			if (cfg->on_step != NULL)
+			{
+				cfg->on_step(i, cfg->arg);
+			}
+		}
+
+		seq->passes++;
+
+	} while ((cfg->flags & SEQ_LOOP) && !__atomic_load_n(&seq->stop, __ATOMIC_ACQUIRE));
+
+out:
+	__atomic_store_n(&seq->done, 1, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+zynq_seq_t * zynq_seq_start(zynq_dev_t *dev, const zynq_seq_cfg_t *cfg)
+{
+	char *fn = "zynq_seq_start";
+
+	zynq_seq_t *seq;
+
+	uint32_t i;
+
+	if (dev == NULL || cfg == NULL || cfg->steps == NULL || cfg->num_steps == 0)
+	{
+		ERR("%s: Error, no device or steps...\n", fn);
+		return NULL;
+	}
+
+	for (i = 1; i < cfg->num_steps; i++)
+	{
+		if (cfg->steps[i].t_ns < cfg->steps[i - 1].t_ns)
+		{
+			ERR("%s: Error, step %d earlier than step %d...\n", fn, i, i - 1);
+			return NULL;
+		}
+	}
+
+	if ((cfg->flags & SEQ_LOOP) && cfg->period_ns < cfg->steps[cfg->num_steps - 1].t_ns)
+	{
+		ERR("%s: Error, period shorter than the table...\n", fn);
+		return NULL;
+	}
+
+	if ( (seq = calloc(1, sizeof(*seq))) == NULL)
+	{
+		ERR("%s: Can't allocate player...\n", fn);
+		return NULL;
+	}
+
+	seq->dev = dev;
+	seq->cfg = *cfg;
+
+	if (pthread_create(&seq->thread, NULL, _seq_main, seq) != 0)
+	{
+		ERR("%s: Can't start player thread...\n", fn);
+		free(seq);
+		return NULL;
+	}
+
+	DBG("%s: Playing %d steps%s...\n", fn, cfg->num_steps, (cfg->flags & SEQ_LOOP) ? " in a loop" : "");
+
+	return seq;
+}
+
+int zynq_seq_done(zynq_seq_t *seq)
+{
+	return __atomic_load_n(&seq->done, __ATOMIC_ACQUIRE);
+}
+
+int zynq_seq_get_stats(zynq_seq_t *seq, zynq_seq_stats_t *stats)
+{
+	if (seq == NULL || stats == NULL)
+	{
+		return -1;
+	}
+
+	/* Unlocked snapshot, exact once the player has finished */
+	stats->steps = seq->steps;
+	stats->passes = seq->passes;
+	stats->errors = seq->errors;
+	stats->late_min_ns = seq->late.min_ns;
+	stats->late_max_ns = seq->late.max_ns;
+	stats->late_mean_ns = seq->late.count ? seq->late.sum_ns / seq->late.count : 0;
+	stats->late_p99_ns = _lat_pct(&seq->late, 99.0);
+
+	return 0;
+}
+
+int zynq_seq_wait(zynq_seq_t *seq, zynq_seq_stats_t *stats)
+{
+	int rv;
+
+	if (seq == NULL)
+	{
+		return -1;
+	}
+
+	pthread_join(seq->thread, NULL);
+
+	if (stats != NULL)
+	{
+		zynq_seq_get_stats(seq, stats);
+	}
+
+	rv = seq->errors ? -1 : 0;
+
+	free(seq);
+
+	return rv;
+}
+
+int zynq_seq_stop(zynq_seq_t *seq, zynq_seq_stats_t *stats)
+{
+	if (seq == NULL)
+	{
+		return -1;
+	}
+
+	__atomic_store_n(&seq->stop, 1, __ATOMIC_RELEASE);
+
+	return zynq_seq_wait(seq, stats);
+}
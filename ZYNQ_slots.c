@@ -0,0 +1,324 @@
+/**********************************************************
+ *
+ *  Design slots, preloaded bitstreams switched by name.
+ *
+ *  Each image is read from storage once, into anonymous
+ *  memory that is locked so a switch never waits for the
+ *  SD card or for a page to come back from swap.  Where
+ *  RLIMIT_MEMLOCK is too small the image stays resident
+ *  but unlocked.  A switch writes the image straight from
+ *  that memory, see zynq_pl_load_mem().
+ *
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ZYNQ_private.h"
+#include "include/ZYNQ_slots.h"
+
+typedef struct {
+	char name[SLOT_NAME_MAX];
+	zynq_dev_cfg_t dev;
+	zynq_gpio_cfg_t *gpio;		/* Copy of the layout, dev.gpio points here */
+	char *path;			/* Copy of dev.path */
+	void *image;			/* NULL for a layout only slot */
+	int locked;
+	_pl_ident_t id;			/* File the image was read from and its hash */
+} _slot_t;
+
+struct zynq_slots {
+	char *target;
+	char *prog_done;
+	char *state_file;
+	uint32_t timeout_ms;
+	uint32_t num_slots;
+	_slot_t *slot;
+	_slot_t *cur;
+	zynq_dev_t *dev;		/* Opened by the last switch */
+};
+
+/* Read a whole bitstream into fresh anonymous memory and lock it */
+static int _slot_load(const char *fn, _slot_t *slot, const char *bitstream)
+{
+	size_t done = 0;
+
+	ssize_t n;
+
+	int fd;
+
+	if (_pl_ident(bitstream, &slot->id) != 0 || slot->id.size == 0)
+	{
+		ERR("%s: Can't stat bitstream %s...\n", fn, bitstream);
+		return -1;
+	}
+
+	if ( (fd = open(bitstream, O_RDONLY | O_CLOEXEC)) == -1)
+	{
+		ERR("%s: Can't open bitstream %s...\n", fn, bitstream);
+		return -1;
+	}
+
+	slot->image = mmap(NULL, slot->id.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (slot->image == MAP_FAILED)
+	{
+		ERR("%s: Can't allocate %llu bytes for %s...\n", fn, (unsigned long long) slot->id.size, bitstream);
+		slot->image = NULL;
+		close(fd);
+		return -1;
+	}
+
+	while (done < slot->id.size && (n = read(fd, (char *) slot->image + done, slot->id.size - done)) > 0)
+	{
+		done += n;
+	}
+
+	close(fd);
+
+	if (done != slot->id.size)
+	{
+		ERR("%s: Read %llu of %llu bytes of %s...\n", fn, (unsigned long long) done,
+			(unsigned long long) slot->id.size, bitstream);
+		return -1;
+	}
+
+	slot->locked = mlock(slot->image, slot->id.size) == 0;
+
+	if (!slot->locked)
+	{
+		DBG("%s: Can't lock %s in memory, RLIMIT_MEMLOCK too small?\n", fn, bitstream);
+	}
+
+	/* Hashed from memory, the file may change under us from now on */
+	slot->id.hash = _pl_hash_mem(PL_HASH_INIT, slot->image, slot->id.size);
+
+	DBG("%s: Slot %s, %llu bytes of %s (%016llx)%s...\n", fn, slot->name, (unsigned long long) slot->id.size,
+		bitstream, (unsigned long long) slot->id.hash, slot->locked ? " locked" : "");
+
+	return 0;
+}
+
+static _slot_t * _slot_find(zynq_slots_t *slots, const char *name)
+{
+	uint32_t i;
+
+	for (i = 0; name != NULL && i < slots->num_slots; i++)
+	{
+		if (strcmp(slots->slot[i].name, name) == 0)
+		{
+			return &slots->slot[i];
+		}
+	}
+
+	return NULL;
+}
+
+static char * _slot_strdup(const char *s, const char *def)
+{
+	return s != NULL ? strdup(s) : def != NULL ? strdup(def) : NULL;
+}
+
+zynq_slots_t * zynq_slots_open(const zynq_slots_cfg_t *cfg)
+{
+	char *fn = "zynq_slots_open";
+
+	zynq_slots_t *slots;
+
+	const zynq_slot_cfg_t *sc;
+
+	_slot_t *slot;
+
+	uint32_t i;
+
+	int rv = 0;
+
+	if (cfg == NULL || cfg->num_slots == 0 || cfg->slot == NULL)
+	{
+		ERR("%s: Error, no slots configured...\n", fn);
+		return NULL;
+	}
+
+	if ( (slots = calloc(1, sizeof(*slots))) == NULL ||
+		(slots->slot = calloc(cfg->num_slots, sizeof(_slot_t))) == NULL)
+	{
+		ERR("%s: Can't allocate %u slots...\n", fn, cfg->num_slots);
+		free(slots);
+		return NULL;
+	}
+
+	slots->num_slots = cfg->num_slots;
+	slots->timeout_ms = cfg->timeout_ms ? cfg->timeout_ms : PL_DONE_TIMEOUT_MS;
+	slots->target = _slot_strdup(cfg->target, PL_XDEVCFG);
+	slots->prog_done = _slot_strdup(cfg->prog_done, PL_PROG_DONE);
+	slots->state_file = _slot_strdup(cfg->state_file, PL_STATE_FILE);
+
+	if (slots->target == NULL || slots->prog_done == NULL || slots->state_file == NULL)
+	{
+		ERR("%s: Can't allocate slot paths...\n", fn);
+		rv = -1;
+	}
+
+	for (i = 0; i < cfg->num_slots && rv == 0; i++)
+	{
+		sc = &cfg->slot[i];
+		slot = &slots->slot[i];
+
+		if (sc->name == NULL || sc->name[0] == '\0' || strlen(sc->name) >= SLOT_NAME_MAX ||
+			sc->dev.num_gpio == 0 || sc->dev.gpio == NULL)
+		{
+			ERR("%s: Error, slot %u needs a name under %d characters and a GPIO layout...\n",
+				fn, i, SLOT_NAME_MAX);
+			rv = -1;
+			break;
+		}
+
+		if (_slot_find(slots, sc->name) != NULL)
+		{
+			ERR("%s: Error, slot %s configured twice...\n", fn, sc->name);
+			rv = -1;
+			break;
+		}
+
+		strcpy(slot->name, sc->name);
+		slot->dev = sc->dev;
+		slot->dev.bitstream = NULL;
+
+		if ( (slot->gpio = malloc(sc->dev.num_gpio * sizeof(zynq_gpio_cfg_t))) == NULL ||
+			(sc->dev.path != NULL && (slot->path = strdup(sc->dev.path)) == NULL))
+		{
+			ERR("%s: Can't allocate slot %s...\n", fn, sc->name);
+			rv = -1;
+			break;
+		}
+
+		memcpy(slot->gpio, sc->dev.gpio, sc->dev.num_gpio * sizeof(zynq_gpio_cfg_t));
+		slot->dev.gpio = slot->gpio;
+		slot->dev.path = slot->path;
+
+		if (sc->bitstream != NULL)
+		{
+			rv = _slot_load(fn, slot, sc->bitstream);
+		}
+	}
+
+	if (rv != 0)
+	{
+		zynq_slots_close(slots);
+		return NULL;
+	}
+
+	return slots;
+}
+
+zynq_dev_t * zynq_slots_switch(zynq_slots_t *slots, const char *name, uint32_t opmode, uint32_t initmode,
+	zynq_pl_stats_t *stats)
+{
+	char *fn = "zynq_slots_switch";
+
+	zynq_pl_stats_t local;
+
+	_slot_t *slot;
+
+	if (stats == NULL)
+	{
+		stats = &local;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (slots == NULL || (slot = _slot_find(slots, name)) == NULL)
+	{
+		ERR("%s: Error, no slot %s...\n", fn, name ? name : "(null)");
+		return NULL;
+	}
+
+	/* The old mappings don't survive the new design */
+	if (slots->dev != NULL)
+	{
+		zynq_dev_close(slots->dev);
+		slots->dev = NULL;
+	}
+
+	slots->cur = NULL;
+
+	if (slot->image != NULL && _pl_program_mem(fn, &slot->id, slot->image, slots->target,
+		slots->prog_done[0] != '\0' ? slots->prog_done : NULL,
+		slots->state_file, slots->timeout_ms, (initmode & INIT_FORCE_PROG) != 0, stats) != 0)
+	{
+		ERR("%s: ERROR programming slot %s...\n", fn, name);
+		return NULL;
+	}
+
+	if ( (slots->dev = zynq_dev_open(&slot->dev, opmode, initmode & ~INIT_PROG_MODE)) == NULL)
+	{
+		ERR("%s: Error opening slot %s...\n", fn, name);
+		return NULL;
+	}
+
+	slots->cur = slot;
+
+	DBG("%s: Switched to %s, %s in %llu us...\n", fn, name, stats->cached ? "already loaded" : "programmed",
+		(unsigned long long) stats->total_ns / 1000);
+
+	return slots->dev;
+}
+
+const char * zynq_slots_current(zynq_slots_t *slots)
+{
+	return slots != NULL && slots->cur != NULL ? slots->cur->name : NULL;
+}
+
+int zynq_slots_locked(zynq_slots_t *slots, const char *name)
+{
+	_slot_t *slot;
+
+	if (slots == NULL || (slot = _slot_find(slots, name)) == NULL)
+	{
+		return -1;
+	}
+
+	return slot->locked;
+}
+
+int zynq_slots_close(zynq_slots_t *slots)
+{
+	int rv = 0;
+
+	uint32_t i;
+
+	if (slots == NULL)
+	{
+		return -1;
+	}
+
+	if (slots->dev != NULL)
+	{
+		rv = zynq_dev_close(slots->dev);
+	}
+
+	for (i = 0; i < slots->num_slots; i++)
+	{
+		/* munmap() drops the lock as well */
+		if (slots->slot[i].image != NULL)
+		{
+			munmap(slots->slot[i].image, slots->slot[i].id.size);
+		}
+
+		free(slots->slot[i].gpio);
+		free(slots->slot[i].path);
+	}
+
+	free(slots->slot);
+	free(slots->target);
+	free(slots->prog_done);
+	free(slots->state_file);
+	free(slots);
+
+	return rv;
+}
@@ -0,0 +1,313 @@
+/**********************************************************
+ *
+ *  Per call latency statistics.
+ *
+ *  The register calls of a device that is collecting are
+ *  timed by STATS_CALL(), two clock reads, and the time
+ *  lands in a log-linear histogram of the entry point and
+ *  GPIO offset along with call and error counts.  Thread
+ *  safe devices count with atomic adds, others with plain
+ *  ones.
+ *
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ZYNQ_private.h"
+
+#define STATS_SUB (1U << STATS_SUB_BITS)
+
+struct _stats {
+	/* num_gpio + 1, the last row takes offsets out of range */
+	uint32_t rows;
+	int atomic;
+	zynq_op_stats_t op[];	/* [op * rows + offset] */
+};
+
+static const char *_stats_names[STATS_NUM_OPS] = {
+	"set_gpio_direction", "get_gpio_direction", "write", "write_lw", "write_uw",
+	"read", "read_lw", "read_uw", "bits", "writev", "readv", "write_stream",
+};
+
+static inline uint32_t _stats_bucket(uint64_t ns)
+{
+	uint32_t shift;
+
+	if (ns < STATS_SUB)
+	{
+		return ns;
+	}
+
+	if (ns >> STATS_MAX_BITS)
+	{
+		return STATS_BUCKETS - 1;
+	}
+
+	shift = 63 - __builtin_clzll(ns) - STATS_SUB_BITS;
+
+	return ((shift + 1) << STATS_SUB_BITS) + ((ns >> shift) & (STATS_SUB - 1));
+}
+
+/* Largest latency counted in bucket b */
+static uint64_t _stats_bucket_max(uint32_t b)
+{
+	uint32_t shift;
+
+	if (b < STATS_SUB)
+	{
+		return b;
+	}
+
+	shift = (b >> STATS_SUB_BITS) - 1;
+
+	return ((uint64_t) (STATS_SUB + (b & (STATS_SUB - 1))) << shift) + (1ULL << shift) - 1;
+}
+
+void _stats_rec(_stats_t *stats, uint32_t op, uint32_t offset, uint64_t ns, int rv)
+{
+	zynq_op_stats_t *s;
+
+	uint64_t max;
+
+	s = &stats->op[op * stats->rows + (offset < stats->rows - 1 ? offset : stats->rows - 1)];
+
+	if (!stats->atomic)
+	{
+		s->calls++;
+		s->errors += rv != 0;
+		s->total_ns += ns;
+		s->hist[_stats_bucket(ns)]++;
+		s->max_ns = ns > s->max_ns ? ns : s->max_ns;
+		return;
+	}
+
+	__atomic_fetch_add(&s->calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&s->total_ns, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&s->hist[_stats_bucket(ns)], 1, __ATOMIC_RELAXED);
+
+	if (rv != 0)
+	{
+		__atomic_fetch_add(&s->errors, 1, __ATOMIC_RELAXED);
+	}
+
+	max = __atomic_load_n(&s->max_ns, __ATOMIC_RELAXED);
+
+	while (ns > max && !__atomic_compare_exchange_n(&s->max_ns, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	{
+	}
+}
+
+void _stats_free(zynq_dev_t *dev)
+{
+	dev->stats = NULL;
+	free(dev->stats_buf);
+	dev->stats_buf = NULL;
+}
+
+int zynq_stats_start(zynq_dev_t *dev)
+{
+	char *fn = "zynq_stats_start";
+
+	_stats_t *stats;
+
+	uint32_t rows;
+
+	if (!ZYNQ_STATS)
+	{
+		ERR("%s: Statistics compiled out, see ZYNQ_STATS...\n", fn);
+		return -1;
+	}
+
+	if (dev == NULL || dev->open != 1)
+	{
+		ERR("%s: Device not open...\n", fn);
+		return -1;
+	}
+
+	if (dev->stats_buf == NULL)
+	{
+		rows = dev->num_gpio + 1;
+
+		if ( (stats = calloc(1, sizeof(*stats) + (size_t) STATS_NUM_OPS * rows * sizeof(zynq_op_stats_t))) == NULL)
+		{
+			ERR("%s: Can't allocate statistics...\n", fn);
+			return -1;
+		}
+
+		stats->rows = rows;
+		stats->atomic = dev->threadsafe;
+		dev->stats_buf = stats;
+	}
+
+	DBG("%s: Timing register calls...\n", fn);
+
+	__atomic_store_n(&dev->stats, dev->stats_buf, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+int zynq_stats_stop(zynq_dev_t *dev)
+{
+	char *fn = "zynq_stats_stop";
+
+	if (dev == NULL || dev->stats == NULL)
+	{
+		ERR("%s: Not collecting statistics...\n", fn);
+		return -1;
+	}
+
+	__atomic_store_n(&dev->stats, NULL, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+int zynq_get_stats(zynq_dev_t *dev, uint32_t op, uint32_t offset, zynq_op_stats_t *stats)
+{
+	char *fn = "zynq_get_stats";
+
+	const zynq_op_stats_t *s;
+
+	uint32_t first, last, i, b;
+
+	if (dev == NULL || dev->stats_buf == NULL || stats == NULL)
+	{
+		ERR("%s: No statistics collected...\n", fn);
+		return -1;
+	}
+
+	if (op >= STATS_NUM_OPS || (offset != STATS_ALL && offset >= dev->stats_buf->rows))
+	{
+		ERR("%s: Error, op=%u, offset=%u out of range...\n", fn, op, offset);
+		return -1;
+	}
+
+	first = offset == STATS_ALL ? 0 : offset;
+	last = offset == STATS_ALL ? dev->stats_buf->rows - 1 : offset;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (i = first; i <= last; i++)
+	{
+		s = &dev->stats_buf->op[op * dev->stats_buf->rows + i];
+
+		stats->calls += s->calls;
+		stats->errors += s->errors;
+		stats->total_ns += s->total_ns;
+		stats->max_ns = s->max_ns > stats->max_ns ? s->max_ns : stats->max_ns;
+
+		for (b = 0; b < STATS_BUCKETS; b++)
+		{
+			stats->hist[b] += s->hist[b];
+		}
+	}
+
+	return 0;
+}
+
+int zynq_reset_stats(zynq_dev_t *dev)
+{
+	char *fn = "zynq_reset_stats";
+
+	if (dev == NULL || dev->stats_buf == NULL)
+	{
+		ERR("%s: No statistics collected...\n", fn);
+		return -1;
+	}
+
+	memset(dev->stats_buf->op, 0, (size_t) STATS_NUM_OPS * dev->stats_buf->rows * sizeof(zynq_op_stats_t));
+
+	return 0;
+}
+
+uint64_t zynq_stats_pct(const zynq_op_stats_t *stats, double pct)
+{
+	uint64_t total = 0, want, seen = 0;
+
+	uint32_t b;
+
+	for (b = 0; b < STATS_BUCKETS; b++)
+	{
+		total += stats->hist[b];
+	}
+
+	if (total == 0)
+	{
+		return 0;
+	}
+
+	want = (uint64_t) (total * pct / 100.0);
+	want = want ? want : 1;
+
+	for (b = 0; b < STATS_BUCKETS - 1; b++)
+	{
+		if ( (seen += stats->hist[b]) >= want)
+		{
+			break;
+		}
+	}
+
+	/* Never report more than was seen */
+	return _stats_bucket_max(b) < stats->max_ns ? _stats_bucket_max(b) : stats->max_ns;
+}
+
+const char * zynq_stats_name(uint32_t op)
+{
+	return op < STATS_NUM_OPS ? _stats_names[op] : "unknown";
+}
+
+int zynq_dump_stats(zynq_dev_t *dev, FILE *fp)
+{
+	char *fn = "zynq_dump_stats";
+
+	char offset[12];
+
+	zynq_op_stats_t s;
+
+	uint32_t op, i;
+
+	if (dev == NULL || dev->stats_buf == NULL)
+	{
+		ERR("%s: No statistics collected...\n", fn);
+		return -1;
+	}
+
+	if (fp == NULL)
+	{
+		fp = stdout;
+	}
+
+	fprintf(fp, "%-20s %6s %12s %8s %9s %8s %8s %8s %10s\n",
+		"call", "offset", "calls", "errors", "mean_ns", "p50", "p99", "p99.9", "max");
+
+	for (op = 0; op < STATS_NUM_OPS; op++)
+	{
+		for (i = 0; i < dev->stats_buf->rows; i++)
+		{
+			zynq_get_stats(dev, op, i, &s);
+
+			if (s.calls == 0)
+			{
+				continue;
+			}
+
+			if (i < dev->stats_buf->rows - 1)
+			{
+				snprintf(offset, sizeof(offset), "%u", i);
+			}
+			else
+			{
+				strcpy(offset, "-");
+			}
+
+			fprintf(fp, "%-20s %6s %12llu %8llu %9.1f %8llu %8llu %8llu %10llu\n",
+				_stats_names[op], offset, (unsigned long long) s.calls, (unsigned long long) s.errors,
+				(double) s.total_ns / s.calls,
+				(unsigned long long) zynq_stats_pct(&s, 50), (unsigned long long) zynq_stats_pct(&s, 99),
+				(unsigned long long) zynq_stats_pct(&s, 99.9), (unsigned long long) s.max_ns);
+		}
+	}
+
+	return 0;
+}
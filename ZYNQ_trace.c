@@ -0,0 +1,255 @@
+/**********************************************************
+ *
+ *  Binary register access trace.
+ *
+ *  Every read and write of a tracing device is stored as
+ *  a 16 byte zynq_trace_rec_t in a lock-free ring that
+ *  keeps the newest records.  The ring can be dumped to a
+ *  file on demand or from a signal handler and decoded
+ *  with zynq_trace_decode.exe.
+ *
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ZYNQ_private.h"
+
+struct _trace {
+	/* Index of the next record, only ever incremented, 64 bits never wrap */
+	uint64_t head;
+	uint32_t mask;
+	/* Ring replaced by this one, other threads may still be recording into it */
+	struct _trace *prev;
+	zynq_trace_rec_t rec[];
+};
+
+/* Device and file used by the signal handler */
+static zynq_dev_t *_trace_sig_dev = NULL;
+static char _trace_sig_path[256];
+
+void _trace_rec(_trace_t *trace, uint32_t offset, uint32_t chan, uint32_t flags, uint32_t value)
+{
+	zynq_trace_rec_t *rec;
+	struct timespec ts;
+	uint64_t idx;
+
+	idx = __atomic_fetch_add(&trace->head, 1, __ATOMIC_RELAXED);
+	rec = &trace->rec[idx & trace->mask];
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	rec->ts_ns = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	rec->value = value;
+	rec->offset = offset;
+	rec->chan = chan;
+	rec->flags = flags;
+}
+
+/* Only async-signal-safe calls, shared by zynq_trace_dump() and the handler */
+static int _trace_write(int fd, _trace_t *trace)
+{
+	zynq_trace_hdr_t hdr;
+	uint64_t head;
+	uint32_t size, first, n1;
+	ssize_t len;
+
+	head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+	size = trace->mask + 1;
+
+	hdr.magic = TRACE_MAGIC;
+	hdr.version = TRACE_VERSION;
+	hdr.rec_size = sizeof(zynq_trace_rec_t);
+	hdr.count = head < size ? head : size;
+	hdr.lost = head - hdr.count > UINT32_MAX ? UINT32_MAX : head - hdr.count;
+
+	/* Oldest record first, the ring may wrap once */
+	first = (head - hdr.count) & trace->mask;
+	n1 = size - first < hdr.count ? size - first : hdr.count;
+
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+	{
+		return -1;
+	}
+
+	len = (ssize_t) n1 * sizeof(zynq_trace_rec_t);
+	if (write(fd, &trace->rec[first], len) != len)
+	{
+		return -1;
+	}
+
+	len = (ssize_t) (hdr.count - n1) * sizeof(zynq_trace_rec_t);
+	if (len > 0 && write(fd, &trace->rec[0], len) != len)
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+static void _trace_signal(int signo)
+{
+	int saved_errno = errno;
+	int fd;
+
+	if (_trace_sig_dev != NULL && _trace_sig_dev->trace_ring != NULL &&
+		(fd = open(_trace_sig_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) != -1)
+	{
+		_trace_write(fd, _trace_sig_dev->trace_ring);
+		close(fd);
+	}
+
+	errno = saved_errno;
+}
+
+void _trace_free(zynq_dev_t *dev)
+{
+	_trace_t *trace;
+
+	if (_trace_sig_dev == dev)
+	{
+		_trace_sig_dev = NULL;
+	}
+
+	dev->trace = NULL;
+
+	while ( (trace = dev->trace_ring) != NULL)
+	{
+		dev->trace_ring = trace->prev;
+		free(trace);
+	}
+}
+
+int zynq_trace_start(zynq_dev_t *dev, uint32_t num_recs)
+{
+	char *fn = "zynq_trace_start";
+
+	uint32_t size = 1;
+
+	if (dev == NULL || dev->open != 1)
+	{
+		ERR("%s: Device not open...\n", fn);
+		return -1;
+	}
+
+	if (num_recs == 0 || num_recs > 0x80000000)
+	{
+		ERR("%s: Error, num_recs=%u out of range...\n", fn, num_recs);
+		return -1;
+	}
+
+	while (size < num_recs)
+	{
+		size <<= 1;
+	}
+
+	/* Keep the previous ring, and its records, if it has the same size */
+	if (dev->trace_ring == NULL || dev->trace_ring->mask + 1 != size)
+	{
+		_trace_t *trace;
+
+		if ( (trace = calloc(1, sizeof(*trace) + size * sizeof(zynq_trace_rec_t))) == NULL)
+		{
+			ERR("%s: Can't allocate %u trace records...\n", fn, size);
+			return -1;
+		}
+
+		trace->mask = size - 1;
+
+		/* Freed on close only, a register call may still hold the old ring */
+		trace->prev = dev->trace_ring;
+		dev->trace_ring = trace;
+	}
+
+	DBG("%s: Tracing into %u records...\n", fn, size);
+
+	__atomic_store_n(&dev->trace, dev->trace_ring, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+int zynq_trace_stop(zynq_dev_t *dev)
+{
+	char *fn = "zynq_trace_stop";
+
+	if (dev == NULL || dev->trace == NULL)
+	{
+		ERR("%s: Not tracing...\n", fn);
+		return -1;
+	}
+
+	__atomic_store_n(&dev->trace, NULL, __ATOMIC_RELEASE);
+
+	DBG("%s: %llu records traced...\n", fn, (unsigned long long) dev->trace_ring->head);
+
+	return 0;
+}
+
+int zynq_trace_dump(zynq_dev_t *dev, const char *path)
+{
+	char *fn = "zynq_trace_dump";
+
+	int fd;
+
+	int rv;
+
+	if (dev == NULL || dev->trace_ring == NULL)
+	{
+		ERR("%s: No trace recorded...\n", fn);
+		return -1;
+	}
+
+	if ( (fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+	{
+		ERR("%s: Can't open %s...\n", fn, path);
+		return -1;
+	}
+
+	if ( (rv = _trace_write(fd, dev->trace_ring)) != 0)
+	{
+		ERR("%s: Error writing %s...\n", fn, path);
+	}
+
+	close(fd);
+
+	return rv;
+}
+
+int zynq_trace_dump_on_signal(zynq_dev_t *dev, int signo, const char *path)
+{
+	char *fn = "zynq_trace_dump_on_signal";
+
+	struct sigaction sa;
+
+	if (dev == NULL || path == NULL || strlen(path) >= sizeof(_trace_sig_path))
+	{
+		ERR("%s: Error, invalid device or path...\n", fn);
+		return -1;
+	}
+
+	_trace_sig_dev = NULL;
+	strcpy(_trace_sig_path, path);
+	_trace_sig_dev = dev;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = _trace_signal;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+
+	if (sigaction(signo, &sa, NULL) != 0)
+	{
+		ERR("%s: Can't install handler for signal %d...\n", fn, signo);
+		_trace_sig_dev = NULL;
+		return -1;
+	}
+
+	DBG("%s: Signal %d dumps trace to %s...\n", fn, signo, path);
+
+	return 0;
+}
@@ -0,0 +1,332 @@
+/**********************************************************
+ *
+ *  Software PWM / waveform generator.
+ *
+ *  Drives up to 32 bits on each channel of one GPIO, every
+ *  bit with its own period, duty and phase.  The engine
+ *  sleeps until the earliest pending edge, applies every
+ *  edge that is due and issues a single store of the
+ *  combined output word.  Edge lateness and the achieved
+ *  frequency are recorded per bit.
+ *
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "ZYNQ_private.h"
+#include "include/ZYNQ_wave.h"
+
+/* Run time state of one bit */
+typedef struct {
+	uint32_t toggles;	/* Zero for a constant level */
+	uint32_t high;
+	uint64_t next_ns;	/* Ideal time of the next edge */
+	uint64_t rise_ns;	/* Ideal time of the last rising edge */
+	uint64_t edges;
+	uint64_t rises;
+	uint64_t first_rise_ns;
+	uint64_t last_rise_ns;
+	_lat_t jitter;
+} _wave_state_t;
+
+struct zynq_wave {
+	zynq_dev_t *dev;
+	zynq_wave_cfg_t cfg;
+	zynq_wave_bit_t bits[WAVE_MAX_BITS];
+	_wave_state_t state[WAVE_MAX_BITS];
+	uint32_t drive[MAX_CHANS];
+	uint32_t chan_mask;
+	pthread_t thread;
+	int stop;
+	int done;
+	uint64_t stores;
+	uint64_t errors;
+};
+
+static void * _wave_main(void *arg)
+{
+	zynq_wave_t *wave = arg;
+
+	const zynq_wave_cfg_t *cfg = &wave->cfg;
+
+	const zynq_wave_bit_t *bit;
+
+	_wave_state_t *st;
+
+	uint32_t out[MAX_CHANS], prev[MAX_CHANS], level[MAX_CHANS];
+
+	uint32_t ch, i, mask;
+
+	uint64_t start, end, deadline, now;
+
+	_set_rt_priority("zynq_wave", cfg->rt_priority);
+
+	start = _now_ns();
+	end = cfg->duration_ns ? start + cfg->duration_ns : UINT64_MAX;
+
+	memset(level, 0, sizeof(level));
+
+	for (i = 0; i < cfg->num_bits; i++)
+	{
+		bit = &wave->bits[i];
+		st = &wave->state[i];
+
+		if (bit->high_ns >= bit->period_ns)
+		{
+			level[bit->channel] |= 1U << bit->bit;
+		}
+		else if (bit->high_ns > 0)
+		{
+			st->toggles = 1;
+			st->next_ns = start + bit->phase_ns;
+		}
+	}
+
+	for (ch = 0; ch < MAX_CHANS; ch++)
+	{
+		out[ch] = (cfg->idle[ch] & ~wave->drive[ch]) | level[ch];
+	}
+
+	mask = wave->chan_mask;
+
+	for (;;)
+	{
+		if (zynq_dev_write(wave->dev, cfg->offset, out, mask) != 0)
+		{
+			ERR("zynq_wave: Error writing 0x%8.8x 0x%8.8x...\n", out[CH1_INDEX], out[CH2_INDEX]);
+			wave->errors++;
+			break;
+		}
+
+		wave->stores++;
+
+		deadline = UINT64_MAX;
+		for (i = 0; i < cfg->num_bits; i++)
+		{
+			if (wave->state[i].toggles && wave->state[i].next_ns < deadline)
+			{
+				deadline = wave->state[i].next_ns;
+			}
+		}
+
+		/* No edge before the end, only wait for it (or a stop) */
+		if (deadline >= end)
+		{
+			_sleep_until(end, 0, &wave->stop);
+			break;
+		}
+
+		if (_sleep_until(deadline, cfg->spin_ns, &wave->stop))
+		{
+			break;
+		}
+
+		now = _now_ns();
+
+		memcpy(prev, out, sizeof(prev));
+
+		/* Every edge due by now goes out in this store */
+		for (i = 0; i < cfg->num_bits; i++)
+		{
+			bit = &wave->bits[i];
+			st = &wave->state[i];
+
+			if (!st->toggles || st->next_ns > now)
+			{
+				continue;
+			}
+
+			_lat_add(&st->jitter, now - st->next_ns);
+			st->edges++;
+
+			if (st->high)
+			{
+				out[bit->channel] &= ~(1U << bit->bit);
+				st->next_ns = st->rise_ns + bit->period_ns;
+			}
+			else
+			{
+				out[bit->channel] |= 1U << bit->bit;
+				st->rise_ns = st->next_ns;
+				st->next_ns = st->rise_ns + bit->high_ns;
+
+				if (st->rises++ == 0)
+				{
+					st->first_rise_ns = now;
+				}
+				st->last_rise_ns = now;
+			}
+
+			st->high = !st->high;
+		}
+
+		mask = 0;
+		for (ch = 0; ch < MAX_CHANS; ch++)
+		{
+			if (out[ch] != prev[ch])
+			{
+				mask |= 1 << ch;
+			}
+		}
+	}
+
+	__atomic_store_n(&wave->done, 1, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+zynq_wave_t * zynq_wave_start(zynq_dev_t *dev, const zynq_wave_cfg_t *cfg)
+{
+	char *fn = "zynq_wave_start";
+
+	zynq_wave_t *wave;
+
+	const zynq_wave_bit_t *bit;
+
+	uint32_t drive[MAX_CHANS] = { 0, 0 };
+
+	uint32_t chan_mask = 0;
+
+	uint32_t i;
+
+	if (dev == NULL || dev->open != 1 || cfg == NULL || cfg->bits == NULL ||
+		cfg->num_bits == 0 || cfg->num_bits > WAVE_MAX_BITS)
+	{
+		ERR("%s: Error, no device or bits...\n", fn);
+		return NULL;
+	}
+
+	if (cfg->offset >= dev->num_gpio)
+	{
+		ERR("%s: Error, offset=%d out of range...\n", fn, cfg->offset);
+		return NULL;
+	}
+
+	for (i = 0; i < cfg->num_bits; i++)
+	{
+		bit = &cfg->bits[i];
+
+		if (bit->channel >= MAX_CHANS || bit->bit > 31 ||
+			!(dev->gpio[cfg->offset].chan_mask & (1 << bit->channel)))
+		{
+			ERR("%s: Error, bit %d: channel=%d bit=%d invalid...\n", fn, i, bit->channel, bit->bit);
+			return NULL;
+		}
+
+		if (bit->period_ns == 0 || (drive[bit->channel] & (1U << bit->bit)))
+		{
+			ERR("%s: Error, bit %d: zero period or bit driven twice...\n", fn, i);
+			return NULL;
+		}
+
+		drive[bit->channel] |= 1U << bit->bit;
+		chan_mask |= 1 << bit->channel;
+	}
+
+	if ( (wave = calloc(1, sizeof(*wave))) == NULL)
+	{
+		ERR("%s: Can't allocate engine...\n", fn);
+		return NULL;
+	}
+
+	wave->dev = dev;
+	wave->cfg = *cfg;
+	memcpy(wave->bits, cfg->bits, cfg->num_bits * sizeof(zynq_wave_bit_t));
+	wave->cfg.bits = wave->bits;
+	memcpy(wave->drive, drive, sizeof(drive));
+	wave->chan_mask = chan_mask;
+
+	if (pthread_create(&wave->thread, NULL, _wave_main, wave) != 0)
+	{
+		ERR("%s: Can't start engine thread...\n", fn);
+		free(wave);
+		return NULL;
+	}
+
+	DBG("%s: Driving %d bits on offset=%d...\n", fn, cfg->num_bits, cfg->offset);
+
+	return wave;
+}
+
+int zynq_wave_done(zynq_wave_t *wave)
+{
+	return __atomic_load_n(&wave->done, __ATOMIC_ACQUIRE);
+}
+
+int zynq_wave_get_stats(zynq_wave_t *wave, zynq_wave_stats_t *stats)
+{
+	const _wave_state_t *st;
+
+	zynq_wave_bit_stats_t *bs;
+
+	uint32_t i;
+
+	if (wave == NULL || stats == NULL)
+	{
+		return -1;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+
+	/* Unlocked snapshot, exact once the engine has finished */
+	stats->stores = wave->stores;
+	stats->errors = wave->errors;
+	stats->num_bits = wave->cfg.num_bits;
+
+	for (i = 0; i < wave->cfg.num_bits; i++)
+	{
+		st = &wave->state[i];
+		bs = &stats->bit[i];
+
+		bs->edges = st->edges;
+		bs->jitter_min_ns = st->jitter.min_ns;
+		bs->jitter_max_ns = st->jitter.max_ns;
+		bs->jitter_mean_ns = st->jitter.count ? st->jitter.sum_ns / st->jitter.count : 0;
+		bs->jitter_p99_ns = _lat_pct(&st->jitter, 99.0);
+
+		if (st->rises > 1 && st->last_rise_ns > st->first_rise_ns)
+		{
+			bs->freq_hz = (st->rises - 1) * 1e9 / (st->last_rise_ns - st->first_rise_ns);
+		}
+	}
+
+	return 0;
+}
+
+int zynq_wave_wait(zynq_wave_t *wave, zynq_wave_stats_t *stats)
+{
+	int rv;
+
+	if (wave == NULL)
+	{
+		return -1;
+	}
+
+	pthread_join(wave->thread, NULL);
+
+	if (stats != NULL)
+	{
+		zynq_wave_get_stats(wave, stats);
+	}
+
+	rv = wave->errors ? -1 : 0;
+
+	free(wave);
+
+	return rv;
+}
+
+int zynq_wave_stop(zynq_wave_t *wave, zynq_wave_stats_t *stats)
+{
+	if (wave == NULL)
+	{
+		return -1;
+	}
+
+	__atomic_store_n(&wave->stop, 1, __ATOMIC_RELEASE);
+
+	return zynq_wave_wait(wave, stats);
+}
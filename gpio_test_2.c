@@ -2,8 +2,10 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <unistd.h>
 
 #include "include/ZYNQ_driver.h"
+#include "include/ZYNQ_wave.h"
 
 #define DEFAULT_PL (const char *) ("/store/mep/zynq_fpga_bin_files/Z_wrapper_atten3.bin")
 
@@ -22,16 +24,24 @@ int main()
 
 	uint32_t direction[MAX_CHANS];
 
-	uint32_t data[MAX_CHANS];
-
 	uint32_t channel_mask;
 
+	uint32_t i;
+
+	static const zynq_wave_bit_t bits[] = {
+		{ CH1_INDEX,  0, 1000000, 500000, 0 },
+		{ CH1_INDEX, 16, 4000000, 1000000, 0 },
+	};
+
+	zynq_wave_cfg_t cfg;
+
+	zynq_wave_stats_t stats;
+
+	zynq_wave_t *wave;
+
 	direction[0] = 0;
 	direction[1] = 0;
 
-	data[0] = 0x00010001;
-	data[1] = 0x00000000;
-
 	channel_mask = 1;
 
 	sprintf(filename, DEFAULT_PL);
@@ -73,26 +83,38 @@ int main()
 	printf("direction[0]=0x%8.8x, direction[1]=0x%8.8x...\n", direction[0], direction[1]);
 
 
-	printf("Starting loop...\n");
+	/* Bit 0 at 1 kHz 50%, bit 16 at 250 Hz 25% */
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.offset = DR;
+	cfg.bits = bits;
+	cfg.num_bits = sizeof(bits) / sizeof(bits[0]);
+
+	printf("Starting waveform...\n");
 
-	while (1)
+	if ( (wave = zynq_wave_start(zynq_get_dev(), &cfg)) == NULL)
 	{
-		data[0] = 0x00010001;
-		data[1] = 0x00000000;
+		printf("ERROR calling zynq_wave_start()...\n");
+	}
 
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
-		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-		}
+	while (wave != NULL && !zynq_wave_done(wave))
+	{
+		sleep(10);
 
-		data[0] = 0x00000000;
-		data[1] = 0x00000000;
+		zynq_wave_get_stats(wave, &stats);
 
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
+		for (i = 0; i < stats.num_bits; i++)
 		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
+			printf("bit %2d: %.3f Hz, edge jitter mean=%llu p99<=%llu max=%llu ns\n",
+				bits[i].bit, stats.bit[i].freq_hz,
+				(unsigned long long) stats.bit[i].jitter_mean_ns,
+				(unsigned long long) stats.bit[i].jitter_p99_ns,
+				(unsigned long long) stats.bit[i].jitter_max_ns);
 		}
-	
+	}
+
+	if (wave != NULL && (rv = zynq_wave_wait(wave, NULL)) != 0)
+	{
+		printf("ERROR writing waveform...\n");
 	}
 
 	if ( (rv = zynq_close() ) != 0 )
@@ -5,9 +5,50 @@
 #include <unistd.h>
 
 #include "include/ZYNQ_driver.h"
+#include "include/ZYNQ_seq.h"
 
 #define DEFAULT_PL (const char *) ("/store/mep/zynq_fpga_bin_files/Z_wrapper_atten3.bin")
 
+/* Time spent at each attenuation */
+#define DWELL_NS (10000000000ULL)
+
+typedef struct {
+	const char *label;
+	uint32_t data;
+} sweep_t;
+
+static const sweep_t sweep[] = {
+	{ "No attenuation",      0x00000000 },
+	{ "0.06 dB attenuation", 0x00010001 },
+	{ "0.13 dB attenuation", 0x00020002 },
+	{ "0.25 dB attenuation", 0x00040004 },
+	{ "0.5 dB attenuation",  0x00080008 },
+	{ "1.0 dB attenuation",  0x00100010 },
+	{ "2.0 dB attenuation",  0x00200020 },
+	{ "4.0 dB attenuation",  0x00400040 },
+	{ "8.0 dB attenuation",  0x00800080 },
+	{ "16.0 dB attenuation", 0x01000100 },
+	{ "32.0 dB attenuation", 0x02000200 },
+	{ "33.0 dB attenuation", 0x02100210 },
+	{ "34.0 dB attenuation", 0x02200220 },
+	{ "36.0 dB attenuation", 0x02400240 },
+	{ "40.0 dB attenuation", 0x02800280 },
+	{ "48.0 dB attenuation", 0x03000300 },
+	{ "50.0 dB attenuation", 0x03200320 },
+	{ "52.0 dB attenuation", 0x03400340 },
+	{ "56.0 dB attenuation", 0x03800380 },
+	{ "58.0 dB attenuation", 0x03a003a0 },
+	{ "60.0 dB attenuation", 0x03c003c0 },
+	{ "62.0 dB attenuation", 0x03e003e0 },
+};
+
+#define NUM_STEPS (sizeof(sweep) / sizeof(sweep[0]))
+
+static void print_step(uint32_t step, void *arg)
+{
+	printf("%s\n", sweep[step].label);
+}
+
 int main()
 {
 
@@ -15,22 +56,27 @@ int main()
 	
 	int debug = 1;
 
-	int err = 0;
-
 	char filename[255];
 
 	uint32_t direction[MAX_CHANS];
 
-	uint32_t data[MAX_CHANS];
-
 	uint32_t channel_mask;
 
+	uint32_t i;
+
+	zynq_regop_t ops[NUM_STEPS];
+
+	zynq_seq_step_t steps[NUM_STEPS];
+
+	zynq_seq_cfg_t cfg;
+
+	zynq_seq_stats_t stats;
+
+	zynq_seq_t *seq;
+
 	direction[0] = 0;
 	direction[1] = 0;
 
-	data[0] = 0x00010001;
-	data[1] = 0x00000000;
-
 	channel_mask = 0x1;
 
 	sprintf(filename, DEFAULT_PL);
@@ -57,229 +103,43 @@ int main()
 
 	printf("direction[0]=0x%8.8x, direction[1]=0x%8.8x...\n", direction[0], direction[1]);
 
-	while (!err) 
+	/* Attenuation sweep, played with absolute deadlines so the dwell does not drift */
+	for (i = 0; i < NUM_STEPS; i++)
 	{
+		ops[i].offset = DR;
+		ops[i].channel = CH1_INDEX;
+		ops[i].field = FIELD_DATA;
+		ops[i].value = sweep[i].data;
+
+		steps[i].t_ns = i * DWELL_NS;
+		steps[i].ops = &ops[i];
+		steps[i].count = 1;
+	}
 
-		printf("No attenuation\n");
-		data[0] = 0x00000000;
-		data[1] = 0x00000000;
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
-		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-			err = 1;
-		}
-		sleep(10);
-
-		printf("0.06 dB attenuation\n");
-		data[0] = 0x00010001;
-		data[1] = 0x00010001;
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
-		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-			err = 1;
-		}
-		sleep(10);
-
-		printf("0.13 dB attenuation\n");
-		data[0] = 0x00020002;
-		data[1] = 0x00020002;
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
-		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-			err = 1;
-		}
-		sleep(10);
-
-		printf("0.25 dB attenuation\n");
-		data[0] = 0x00040004;
-		data[1] = 0x00040004;
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
-		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-			err = 1;
-		}
-		sleep(10);
-
-		printf("0.5 dB attenuation\n");
-		data[0] = 0x00080008;
-		data[1] = 0x00080008;
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
-		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-			err = 1;
-		}
-		sleep(10);
-
-		printf("1.0 dB attenuation\n");
-		data[0] = 0x00100010;
-		data[1] = 0x00100010;
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
-		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-			err = 1;
-		}
-		sleep(10);
-
-		printf("2.0 dB attenuation\n");
-		data[0] = 0x00200020;
-		data[1] = 0x00200020;
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
-		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-			err = 1;
-		}
-		sleep(10);
-
-		printf("4.0 dB attenuation\n");
-		data[0] = 0x00400040;
-		data[1] = 0x00400040;
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
-		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-			err = 1;
-		}
-		sleep(10);
-
-		printf("8.0 dB attenuation\n");
-		data[0] = 0x00800080;
-		data[1] = 0x00800080;
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
-		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-			err = 1;
-		}
-		sleep(10);
-
-		printf("16.0 dB attenuation\n");
-		data[0] = 0x01000100;
-		data[1] = 0x01000100;
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
-		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-			err = 1;
-		}
-		sleep(10);
-
-		printf("32.0 dB attenuation\n");
-		data[0] = 0x02000200;
-		data[1] = 0x02000200;
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
-		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-			err = 1;
-		}
-		sleep(10);
-
-		printf("33.0 dB attenuation\n");
-		data[0] = 0x02100210;
-		data[1] = 0x02100210;
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
-		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-			err = 1;
-		}
-		sleep(10);
-
-		printf("34.0 dB attenuation\n");
-		data[0] = 0x02200220;
-		data[1] = 0x02200220;
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
-		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-			err = 1;
-		}
-		sleep(10);
-
-		printf("36.0 dB attenuation\n");
-		data[0] = 0x02400240;
-		data[1] = 0x02400240;
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
-		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-			err = 1;
-		}
-		sleep(10);
-
-		printf("40.0 dB attenuation\n");
-		data[0] = 0x02800280;
-		data[1] = 0x02800280;
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
-		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-			err = 1;
-		}
-		sleep(10);
-
-		printf("48.0 dB attenuation\n");
-		data[0] = 0x03000300;
-		data[1] = 0x03000300;
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
-		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-			err = 1;
-		}
-		sleep(10);
-
-		printf("50.0 dB attenuation\n");
-		data[0] = 0x03200320;
-		data[1] = 0x03200320;
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
-		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-			err = 1;
-		}
-		sleep(10);
-
-		printf("52.0 dB attenuation\n");
-		data[0] = 0x03400340;
-		data[1] = 0x03400340;
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
-		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-			err = 1;
-		}
-		sleep(10);
-
-		printf("56.0 dB attenuation\n");
-		data[0] = 0x03800380;
-		data[1] = 0x03800380;
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
-		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-			err = 1;
-		}
-		sleep(10);
-
-		printf("58.0 dB attenuation\n");
-		data[0] = 0x03a003a0;
-		data[1] = 0x03a003a0;
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
-		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-			err = 1;
-		}
-		sleep(10);
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.steps = steps;
+	cfg.num_steps = NUM_STEPS;
+	cfg.flags = SEQ_LOOP;
+	cfg.period_ns = NUM_STEPS * DWELL_NS;
+	cfg.on_step = print_step;
 
-		printf("60.0 dB attenuation\n");
-		data[0] = 0x03c003c0;
-		data[1] = 0x03c003c0;
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
-		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-			err = 1;
-		}
-		sleep(10);
+	if ( (seq = zynq_seq_start(zynq_get_dev(), &cfg)) == NULL)
+	{
+		printf("ERROR calling zynq_seq_start()...\n");
+	}
 
-		printf("62.0 dB attenuation\n");
-		data[0] = 0x03e003e0;
-		data[1] = 0x03e003e0;
-		if ( (rv = zynq_write(DR, data, channel_mask) ) != 0 )
+	else
+	{
+		/* Loops until a write fails */
+		if ( (rv = zynq_seq_wait(seq, &stats)) != 0)
 		{
-			printf("ERROR calling zynq_write(0x%8.8x)...\n", data[0]);
-			err = 1;
+			printf("ERROR calling zynq_write(0x%8.8x)...\n", sweep[stats.steps % NUM_STEPS].data);
 		}
-		sleep(10);
 
+		printf("%llu steps, lateness min=%llu mean=%llu p99<=%llu max=%llu ns\n",
+			(unsigned long long) stats.steps, (unsigned long long) stats.late_min_ns,
+			(unsigned long long) stats.late_mean_ns, (unsigned long long) stats.late_p99_ns,
+			(unsigned long long) stats.late_max_ns);
 	}
 
 	if ( (rv = zynq_close() ) != 0 )
@@ -0,0 +1,29 @@
+#ifndef _ZYNQ_BROKER_H_
+#define _ZYNQ_BROKER_H_
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "ZYNQ_driver.h"
+
+/* Shared memory name used when none is given */
+#define BROKER_DEFAULT_NAME (const char *) ("/zynq_broker")
+
+/*
+ * Serve the register calls of BACKEND_BROKER clients on dev through the
+ * shared memory ring name, created with permissions mode, until *stop is
+ * set (stop may be NULL).  Clients must open with the same opmode as dev.
+ * Batches, streams, shadow and trace calls are not forwarded.  The slot
+ * of a client that dies during a call is skipped, after about a second
+ * when it died right as it claimed the slot.
+ */
+int zynq_broker_serve(zynq_dev_t *dev, const char *name, uint32_t mode, const int *stop);
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+}
+#endif
+
+#endif  /* _ZYNQ_BROKER_H_ */
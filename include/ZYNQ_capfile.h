@@ -0,0 +1,116 @@
+#ifndef _ZYNQ_CAPFILE_H_
+#define _ZYNQ_CAPFILE_H_
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ZYNQ_capture.h"
+
+/*
+ * Change-only capture file.
+ *
+ * A zynq_capfile_hdr_t, then blocks of a zynq_capfile_blk_t and its
+ * payload.  The payload is a run of records, each standing for the
+ * unchanged samples since the previous record plus one sample at its
+ * timestamp:
+ *
+ *   varint (dt_ns << 5) | CAPFILE_IDLE? | change bits
+ *   varint idle          with CAPFILE_IDLE, unchanged samples before this one
+ *   varint xor           one per change bit, CH1 data, CH2 data, CH1 tri, CH2 tri
+ *
+ * dt_ns is from the previous record, values are XORed with the previous
+ * state.  A record without change bits closes an idle run at the end of
+ * a block.  Block headers carry the state and time the block starts from
+ * so decoding can start at any block.
+ */
+
+/* File identification */
+#define CAPFILE_MAGIC    (0x5041435a)	/* "ZCAP" little endian */
+#define CAPFILE_BLK_MAGIC (0x4b4c425a)	/* "ZBLK" little endian */
+#define CAPFILE_VERSION  (1)
+
+/* Record change bits */
+#define CAPFILE_CH1      (0x01)	/* CH1 data changed */
+#define CAPFILE_CH2      (0x02)	/* CH2 data changed */
+#define CAPFILE_TRI1     (0x04)	/* CH1 tri changed */
+#define CAPFILE_TRI2     (0x08)	/* CH2 tri changed */
+#define CAPFILE_IDLE     (0x10)	/* An idle count follows */
+
+/* Default block payload, bytes */
+#define CAPFILE_BLOCK_SIZE (65536)
+
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t hdr_size;
+	uint32_t block_size;	/* Largest payload of a block */
+	uint32_t offset;	/* GPIO captured */
+	uint32_t channel_mask;
+	uint32_t flags;		/* CAPTURE_TRI */
+	uint64_t interval_ns;	/* Sample period, 0 = back to back */
+} zynq_capfile_hdr_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t bytes;		/* Payload following this header */
+	uint32_t records;
+	uint32_t _pad;
+	uint64_t samples;	/* Samples the records stand for */
+	uint64_t base_ns;	/* Time of the last record before the block */
+	uint64_t last_ns;	/* Time of the last record in the block */
+	uint32_t data[MAX_CHANS];	/* State before the block */
+	uint32_t tri[MAX_CHANS];
+} zynq_capfile_blk_t;
+
+/* One decoded record */
+typedef struct {
+	uint64_t ts_ns;
+	uint32_t data[MAX_CHANS];	/* State from ts_ns on */
+	uint32_t tri[MAX_CHANS];
+	uint32_t changed;		/* CAPFILE_CH1 ... CAPFILE_TRI2, 0 ends an idle run */
+	uint64_t idle;			/* Unchanged samples before this one */
+} zynq_capfile_ev_t;
+
+typedef struct {
+	uint64_t samples;
+	uint64_t records;
+	uint64_t blocks;
+	uint64_t bytes;		/* File size */
+	double ratio;		/* Raw zynq_sample_t bytes per file byte */
+} zynq_capfile_stats_t;
+
+typedef struct zynq_capfile zynq_capfile_t;
+typedef struct zynq_capfile_reader zynq_capfile_reader_t;
+
+/*
+ * Create path for samples captured with cfg, block_size 0 for the
+ * default.  Full blocks are written by a background thread.
+ */
+zynq_capfile_t *zynq_capfile_open(const char *path, const zynq_capture_cfg_t *cfg, uint32_t block_size);
+/*
+ * Encode n samples, oldest first.  Only blocks when every block buffer
+ * waits for the disk, the capture ring keeps the sampler going meanwhile.
+ */
+int zynq_capfile_write(zynq_capfile_t *cf, const zynq_sample_t *samples, size_t n);
+/* Drain cap into cf until the capture is done, or stops it once *stop is set */
+int zynq_capfile_record(zynq_capfile_t *cf, zynq_capture_t *cap, const int *stop);
+/* Flush the last block and close, stats may be NULL */
+int zynq_capfile_close(zynq_capfile_t *cf, zynq_capfile_stats_t *stats);
+
+zynq_capfile_reader_t *zynq_capfile_reader_open(const char *path);
+const zynq_capfile_hdr_t *zynq_capfile_reader_hdr(zynq_capfile_reader_t *rd);
+/* Decode up to max records, 0 at the end of the file, -1 on a corrupt file */
+int zynq_capfile_read(zynq_capfile_reader_t *rd, zynq_capfile_ev_t *ev, int max);
+/* Continue from the first record at or after ts_ns */
+int zynq_capfile_seek(zynq_capfile_reader_t *rd, uint64_t ts_ns);
+int zynq_capfile_reader_close(zynq_capfile_reader_t *rd);
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+}
+#endif
+
+#endif  /* _ZYNQ_CAPFILE_H_ */
@@ -0,0 +1,67 @@
+#ifndef _ZYNQ_CAPTURE_H_
+#define _ZYNQ_CAPTURE_H_
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ZYNQ_driver.h"
+
+/* Flags for zynq_capture_cfg_t */
+#define CAPTURE_TRI  (0x1)	/* Also sample the tri registers */
+
+/* One sample, 24 bytes */
+typedef struct {
+	uint64_t ts_ns;			/* CLOCK_MONOTONIC */
+	uint32_t data[MAX_CHANS];	/* Channels outside channel_mask read as 0 */
+	uint32_t tri[MAX_CHANS];	/* With CAPTURE_TRI, otherwise 0 */
+} zynq_sample_t;
+
+typedef struct {
+	uint32_t offset;		/* GPIO sampled */
+	uint32_t channel_mask;		/* CH1_MASK and/or CH2_MASK */
+	uint32_t flags;			/* CAPTURE_TRI */
+	uint32_t ring_size;		/* Samples, rounded up to a power of 2 */
+	uint64_t max_samples;		/* Stop after this many samples, 0 = no limit */
+	uint64_t duration_ns;		/* Stop after this long, 0 = no limit */
+	uint64_t interval_ns;		/* Sample period, 0 = back to back */
+	int cpu;			/* Pin the sampler to this CPU, -1 = any */
+	int rt_priority;		/* SCHED_FIFO priority of the sampler, 0 = inherit */
+} zynq_capture_cfg_t;
+
+typedef struct {
+	uint64_t samples;		/* Stored in the ring */
+	uint64_t dropped;		/* Taken while the ring was full */
+	uint64_t elapsed_ns;
+	double rate_hz;			/* Samples taken (stored or dropped) per second */
+	uint64_t max_gap_ns;		/* Longest time between two samples */
+} zynq_capture_stats_t;
+
+typedef struct zynq_capture zynq_capture_t;
+
+/*
+ * Sample cfg->offset into a preallocated ring on a dedicated thread until
+ * max_samples, duration_ns or zynq_capture_stop().  The GPIO is validated
+ * once, samples are plain register loads and are not traced.
+ */
+zynq_capture_t *zynq_capture_start(zynq_dev_t *dev, const zynq_capture_cfg_t *cfg);
+/* Take up to max samples out of the ring, oldest first, never blocks */
+size_t zynq_capture_read(zynq_capture_t *cap, zynq_sample_t *samples, size_t max);
+/* Non-zero once the sampler has stopped */
+int zynq_capture_done(zynq_capture_t *cap);
+int zynq_capture_get_stats(zynq_capture_t *cap, zynq_capture_stats_t *stats);
+/* Wait for a count or time limit, the ring stays readable */
+int zynq_capture_wait(zynq_capture_t *cap);
+/* Stop sampling now, the ring stays readable */
+int zynq_capture_stop(zynq_capture_t *cap);
+/* Stop if needed and free the ring */
+int zynq_capture_close(zynq_capture_t *cap);
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+}
+#endif
+
+#endif  /* _ZYNQ_CAPTURE_H_ */
@@ -24,7 +24,7 @@ extern "C" {
 #define CH1_INDEX (0)
 #define CH2_INDEX (1)
 
-/* Number of GPIOs in design */
+/* Number of GPIOs in the default design, see zynq_dev_open() for others */
 #define NUM_GPIO (3)
 
 /* Xilinx GPIO core supports upto 2 Channels */
@@ -33,11 +33,40 @@ extern "C" {
 /* Define initialization mode masks */
 #define INIT_PROG_MODE    (0x1)
 #define INIT_OPEN_MODE    (0x2)
+#define INIT_SHADOW_MODE  (0x4)	/* Keep a shadow copy of the registers, see zynq_set_shadow() */
+#define INIT_THREADSAFE_MODE  (0x8)	/* Register calls may be made from several threads, see zynq_init() */
+#define INIT_FORCE_PROG   (0x10)	/* With INIT_PROG_MODE, program even if the image is already loaded */
+#define INIT_LAZY_MODE    (0x20)	/* Map each GPIO on first use instead of at open */
+#define INIT_ASYNC_BLOCK  (0x40)	/* Register calls wait for a pending zynq_init_async() instead of failing */
+
+/* Logging modes for register access messages, see zynq_set_log_mode() */
+#define LOG_SYNC_MODE   (0)
+#define LOG_ASYNC_MODE  (1)
+
+/* Register backends, see zynq_set_backend() */
+#define BACKEND_DEVMEM  (0)
+#define BACKEND_SIM     (1)
+#define BACKEND_BROKER  (2)	/* Forward to zynq_broker.exe, path is its shared memory name */
 
 /* Define operating modes */
 #define OP_NORMAL_MODE  (0)
 #define OP_TEST_MODE    (1)
 
+/* Bit operations, see zynq_set_bits() */
+#define BITS_SET     (0)
+#define BITS_CLEAR   (1)
+#define BITS_TOGGLE  (2)
+
+/* Register fields for zynq_regop_t */
+#define FIELD_DATA   (0)
+#define FIELD_TRI    (1)
+
+/* Flags for zynq_writev() */
+#define WRITEV_STROBE_END  (0x1)	/* Test mode: one clock after the batch, not one per data write */
+
+/* Flags for zynq_write_stream() */
+#define STREAM_VERIFY  (0x1)	/* Barriers read the data register back and compare */
+
 /* GPIO register offsets */
 #define ID_REV       (0)
 #define CR	     (1)
@@ -48,9 +77,17 @@ typedef struct {
 	uint32_t tri;
 } channel_t;
 
+/* AXI GPIO interrupt registers, see zynq_irq_open() */
+#define GIER_ENABLE  (0x80000000)	/* Global interrupt enable */
+
 typedef struct {
-	channel_t ch[MAX_CHANS];
-	uint32_t _unused[1020];
+	channel_t ch[MAX_CHANS];	/* 0x000 */
+	uint32_t _unused0[67];
+	uint32_t gier;			/* 0x11C, GIER_ENABLE */
+	uint32_t isr;			/* 0x120, CH1_MASK|CH2_MASK pending, write 1 to clear */
+	uint32_t _unused1;
+	uint32_t ier;			/* 0x128, CH1_MASK|CH2_MASK enabled */
+	uint32_t _unused2[949];
 } gpio_t;
 
 /* Modify the Zynq MMAP data structure as needed */
@@ -58,10 +95,113 @@ typedef struct {
 	gpio_t gpio[NUM_GPIO];
 } zynq_mmap_t;
 
+/* One register access of a zynq_writev()/zynq_readv() batch */
+typedef struct {
+	uint32_t offset;
+	uint32_t channel;	/* CH1_INDEX or CH2_INDEX */
+	uint32_t field;		/* FIELD_DATA or FIELD_TRI */
+	uint32_t value;
+} zynq_regop_t;
+
+/* Result of a zynq_write_stream() */
+typedef struct {
+	uint64_t words;			/* Words written (and strobed in test mode) */
+	uint64_t barriers;		/* Read-backs issued */
+	uint64_t mismatches;		/* STREAM_VERIFY read-backs that differed */
+	uint64_t elapsed_ns;
+	double words_per_sec;
+} zynq_stream_stats_t;
+
+/* Targets of zynq_pl_load() */
+#define PL_XDEVCFG       (const char *) ("/dev/xdevcfg")
+#define PL_FPGA_MANAGER  (const char *) ("/sys/class/fpga_manager/fpga0")
+/* Location in MicroZed Linux of xdevcfg char device, prog_done */
+#define PL_PROG_DONE     (const char *) ("/sys/dev/char/249:0/device/prog_done")
+/* Identity of the last image programmed, on tmpfs so a power cycle forgets it */
+#define PL_STATE_FILE    (const char *) ("/var/run/zynq_pl.state")
+
+/* Result of a zynq_pl_load() */
+typedef struct {
+	uint64_t bytes;			/* Bitstream bytes streamed */
+	uint64_t chunks;		/* sendfile() or write() calls */
+	uint64_t open_ns;		/* Opening the bitstream and the target */
+	uint64_t stream_ns;		/* Streaming the bitstream */
+	uint64_t close_ns;		/* Closing the target, xdevcfg finishes the load here */
+	uint64_t done_ns;		/* Waiting for prog_done */
+	uint64_t total_ns;
+	double bytes_per_sec;		/* Over stream_ns + close_ns */
+	uint64_t hash_ns;		/* Hashing the image, 0 when its metadata matched */
+	uint64_t hash;			/* FNV-1a 64 of the image */
+	uint32_t cached;		/* Non-zero if the image was already loaded */
+} zynq_pl_stats_t;
+
+/* Phase timings of an open or close, see zynq_get_profile() */
+#define PROFILE_MAX_PHASES (8)
+
+typedef struct {
+	const char *name;
+	uint64_t ns;
+} zynq_phase_t;
+
+typedef struct {
+	uint64_t start_ns;		/* CLOCK_MONOTONIC */
+	uint64_t total_ns;
+	uint32_t num_phases;
+	zynq_phase_t phase[PROFILE_MAX_PHASES];
+} zynq_profile_t;
+
+/* Completion of a zynq_init_async() */
+typedef struct zynq_init_handle zynq_init_handle_t;
+typedef void (*zynq_init_cb_t)(int rv, void *arg);
+
+/* Opaque device handle, one per design image, see zynq_dev_open() */
+typedef struct zynq_dev zynq_dev_t;
+
+/* One AXI GPIO instance of a design */
+typedef struct {
+	uint32_t base;		/* Physical base address */
+	uint32_t num_chans;	/* 1 or MAX_CHANS */
+} zynq_gpio_cfg_t;
+
+/* Design description passed to zynq_dev_open(), GPIO offsets index gpio[] */
+typedef struct {
+	uint32_t backend;		/* BACKEND_DEVMEM or BACKEND_SIM */
+	const char *path;		/* Backend file, NULL for the default */
+	const char *bitstream;		/* Used with INIT_PROG_MODE, NULL for the default */
+	uint32_t num_gpio;
+	const zynq_gpio_cfg_t *gpio;
+} zynq_dev_cfg_t;
+
 /* Add top level function prototypes here */
 int zynq_set_debug_level(int debug);
 int zynq_get_debug_level();
+/* Switch modes while no other thread is accessing registers */
+int zynq_set_log_mode(uint32_t mode);
+int zynq_get_log_mode();
+uint32_t zynq_get_log_dropped();
+int zynq_set_backend(uint32_t backend, const char *path);
+int zynq_get_backend();
+/*
+ * With INIT_THREADSAFE_MODE the register calls of one device may be made
+ * from several threads at once.  Reads take no lock.  Each write, half
+ * word merge, bit operation, batch or stream holds the lock of the GPIOs
+ * it writes, and in test mode the CR lock as well, so a write and its
+ * strobe are never interleaved with another writer.  Threads writing
+ * different GPIOs in normal mode never contend.  Open, close, shadow,
+ * trace and log mode changes must still not race with register calls.
+ */
 int zynq_init(uint32_t opmode, uint32_t initmode);
+/*
+ * zynq_init() on a background thread.  Until it completes the register
+ * calls fail as if the device were closed, or wait for it with
+ * INIT_ASYNC_BLOCK.  cb, if not NULL, is called on that thread with the
+ * zynq_init() result.  Every handle must be released by zynq_init_wait().
+ */
+zynq_init_handle_t *zynq_init_async(uint32_t opmode, uint32_t initmode, zynq_init_cb_t cb, void *arg);
+/* 1 once the init (and its callback) has completed, 0 while it runs */
+int zynq_init_poll(zynq_init_handle_t *h);
+/* Wait for completion, release h and return the zynq_init() result */
+int zynq_init_wait(zynq_init_handle_t *h);
 int zynq_set_gpio_direction(uint32_t channel_number, uint32_t *direction, uint32_t channel_mask);
 int zynq_get_gpio_direction(uint32_t channel_number, uint32_t *direction, uint32_t channel_mask);
 int zynq_write(uint32_t offset, uint32_t *data, uint32_t channel_mask);
@@ -70,7 +210,100 @@ int zynq_write_uw(uint32_t offset, uint32_t *data, uint32_t channel_mask);
 int zynq_read(uint32_t offset, uint32_t *data, uint32_t channel_mask);
 int zynq_read_lw(uint32_t offset, uint32_t *data, uint32_t channel_mask);
 int zynq_read_uw(uint32_t offset, uint32_t *data, uint32_t channel_mask);
+/*
+ * Set, clear or toggle the bits in mask on one channel (CH1_INDEX or
+ * CH2_INDEX) of the data or tri register.  Atomic with respect to other
+ * bit operations on the same GPIO, one read and one write over the bus,
+ * or a single write with the shadow registers enabled.
+ */
+int zynq_set_bits(uint32_t offset, uint32_t channel, uint32_t mask);
+int zynq_clear_bits(uint32_t offset, uint32_t channel, uint32_t mask);
+int zynq_toggle_bits(uint32_t offset, uint32_t channel, uint32_t mask);
+int zynq_set_tri_bits(uint32_t offset, uint32_t channel, uint32_t mask);
+int zynq_clear_tri_bits(uint32_t offset, uint32_t channel, uint32_t mask);
+int zynq_toggle_tri_bits(uint32_t offset, uint32_t channel, uint32_t mask);
+/*
+ * Apply a batch of register writes, or fill in the values of a batch of
+ * reads, in order.  The whole batch is validated before any register is
+ * touched.
+ */
+int zynq_writev(const zynq_regop_t *ops, uint32_t count, uint32_t flags);
+int zynq_readv(zynq_regop_t *ops, uint32_t count);
+/*
+ * Push n words into the data register of one channel (CH1_INDEX or
+ * CH2_INDEX), in test mode each followed by a single CR strobe.  Posted
+ * writes are flushed with a read-back every barrier_every words (0 = only
+ * after the last word).  stats may be NULL.
+ */
+int zynq_write_stream(uint32_t offset, uint32_t channel, const uint32_t *words, size_t n,
+	uint32_t barrier_every, uint32_t flags, zynq_stream_stats_t *stats);
+/*
+ * Shadow registers: writes of an unchanged value are skipped, direction
+ * queries and zynq_write_lw/uw merges are served from memory.  Only valid
+ * while this process is the sole writer, resync after anything else may
+ * have touched the registers.
+ */
+int zynq_set_shadow(int enable);
+int zynq_resync_shadow();
 int zynq_close();
+/*
+ * Phase timings of the last zynq_init()/zynq_dev_open() and of the last
+ * zynq_close()/zynq_dev_close() in this process, either may be NULL.
+ * With debugging on they are also printed as each call returns.
+ */
+int zynq_get_profile(zynq_profile_t *init, zynq_profile_t *close);
+/* Print both profiles to fp, stdout when NULL */
+int zynq_dump_profile(FILE *fp);
+/*
+ * Program the PL without a shell.  target is a device or file the
+ * bitstream is streamed into (NULL for PL_XDEVCFG, an existing regular
+ * file or FIFO works for testing), or an fpga_manager directory such as
+ * PL_FPGA_MANAGER, which loads bitstream from /lib/firmware by name.
+ * When prog_done is not NULL it must read '1' (or the manager's state
+ * "operating") within timeout_ms afterwards.  stats may be NULL.
+ */
+int zynq_pl_load(const char *bitstream, const char *target, const char *prog_done, uint32_t timeout_ms,
+	zynq_pl_stats_t *stats);
+/*
+ * zynq_pl_load() unless prog_done reads done and state_file records the
+ * same image (path, size, mtime and inode, or else content hash) as the
+ * last one programmed.  force always programs.  state_file is rewritten
+ * after each successful load and removed before any load is attempted.
+ */
+int zynq_pl_program(const char *bitstream, const char *target, const char *prog_done, const char *state_file,
+	uint32_t timeout_ms, int force, zynq_pl_stats_t *stats);
+/*
+ * zynq_pl_load() of an image already in memory, written straight from
+ * buf.  Not for PL_FPGA_MANAGER, which only loads files.
+ */
+int zynq_pl_load_mem(const void *buf, size_t size, const char *target, const char *prog_done, uint32_t timeout_ms,
+	zynq_pl_stats_t *stats);
+
+/* Handle based calls, same semantics as the calls above */
+zynq_dev_t *zynq_dev_open(const zynq_dev_cfg_t *cfg, uint32_t opmode, uint32_t initmode);
+int zynq_dev_close(zynq_dev_t *dev);
+int zynq_dev_set_gpio_direction(zynq_dev_t *dev, uint32_t offset, uint32_t *direction, uint32_t channel_mask);
+int zynq_dev_get_gpio_direction(zynq_dev_t *dev, uint32_t offset, uint32_t *direction, uint32_t channel_mask);
+int zynq_dev_write(zynq_dev_t *dev, uint32_t offset, uint32_t *data, uint32_t channel_mask);
+int zynq_dev_write_lw(zynq_dev_t *dev, uint32_t offset, uint32_t *data, uint32_t channel_mask);
+int zynq_dev_write_uw(zynq_dev_t *dev, uint32_t offset, uint32_t *data, uint32_t channel_mask);
+int zynq_dev_read(zynq_dev_t *dev, uint32_t offset, uint32_t *data, uint32_t channel_mask);
+int zynq_dev_read_lw(zynq_dev_t *dev, uint32_t offset, uint32_t *data, uint32_t channel_mask);
+int zynq_dev_read_uw(zynq_dev_t *dev, uint32_t offset, uint32_t *data, uint32_t channel_mask);
+int zynq_dev_set_bits(zynq_dev_t *dev, uint32_t offset, uint32_t channel, uint32_t mask);
+int zynq_dev_clear_bits(zynq_dev_t *dev, uint32_t offset, uint32_t channel, uint32_t mask);
+int zynq_dev_toggle_bits(zynq_dev_t *dev, uint32_t offset, uint32_t channel, uint32_t mask);
+int zynq_dev_set_tri_bits(zynq_dev_t *dev, uint32_t offset, uint32_t channel, uint32_t mask);
+int zynq_dev_clear_tri_bits(zynq_dev_t *dev, uint32_t offset, uint32_t channel, uint32_t mask);
+int zynq_dev_toggle_tri_bits(zynq_dev_t *dev, uint32_t offset, uint32_t channel, uint32_t mask);
+int zynq_dev_writev(zynq_dev_t *dev, const zynq_regop_t *ops, uint32_t count, uint32_t flags);
+int zynq_dev_readv(zynq_dev_t *dev, zynq_regop_t *ops, uint32_t count);
+int zynq_dev_write_stream(zynq_dev_t *dev, uint32_t offset, uint32_t channel, const uint32_t *words, size_t n,
+	uint32_t barrier_every, uint32_t flags, zynq_stream_stats_t *stats);
+int zynq_dev_set_shadow(zynq_dev_t *dev, int enable);
+int zynq_dev_resync_shadow(zynq_dev_t *dev);
+/* Device opened by zynq_init(), NULL while closed */
+zynq_dev_t *zynq_get_dev();
 
 #if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
 }
@@ -0,0 +1,42 @@
+#ifndef _ZYNQ_IRQ_H_
+#define _ZYNQ_IRQ_H_
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "ZYNQ_driver.h"
+
+typedef struct zynq_irq zynq_irq_t;
+
+/* Called on the interrupt thread, changed and data are indexed by channel */
+typedef void (*zynq_irq_cb_t)(zynq_irq_t *irq, const uint32_t *changed, const uint32_t *data, void *arg);
+
+/*
+ * Interrupt on input changes of the channels in channel_mask of GPIO
+ * offset, through the UIO device uio (e.g. "/dev/uio0") mapping that
+ * GPIO.  On a simulated device uio is ignored and a fake UIO device, an
+ * eventfd over the simulated registers, is signalled by zynq_irq_raise().
+ */
+zynq_irq_t *zynq_irq_open(zynq_dev_t *dev, uint32_t offset, uint32_t channel_mask, const char *uio);
+int zynq_irq_close(zynq_irq_t *irq);
+/* Readable when an interrupt is pending, for poll()/epoll, then call zynq_irq_wait() */
+int zynq_irq_fd(zynq_irq_t *irq);
+/*
+ * Wait up to timeout_ms (-1 forever) for an interrupt, acknowledge it and
+ * fill the changed bits and new values of each channel.  Returns 1 on an
+ * interrupt, 0 on a timeout and -1 on an error.
+ */
+int zynq_irq_wait(zynq_irq_t *irq, int timeout_ms, uint32_t *changed, uint32_t *data);
+/* Call cb for every interrupt from a thread until zynq_irq_close() */
+int zynq_irq_start(zynq_irq_t *irq, zynq_irq_cb_t cb, void *arg);
+/* Fake UIO only: flag the channels in channel_mask as changed */
+int zynq_irq_raise(zynq_irq_t *irq, uint32_t channel_mask);
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+}
+#endif
+
+#endif  /* _ZYNQ_IRQ_H_ */
@@ -0,0 +1,57 @@
+#ifndef _ZYNQ_POLL_H_
+#define _ZYNQ_POLL_H_
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "ZYNQ_driver.h"
+
+#define POLL_MAX_SRCS (16)
+
+/* Bits of one GPIO channel to watch */
+typedef struct {
+	uint32_t offset;
+	uint32_t channel;		/* CH1_INDEX or CH2_INDEX */
+	uint32_t mask;			/* Bits compared, 0 = all */
+} zynq_poll_src_t;
+
+typedef struct {
+	const zynq_poll_src_t *srcs;
+	uint32_t num_srcs;		/* Up to POLL_MAX_SRCS */
+	uint64_t min_interval_ns;	/* Sample interval after a change, 0 = back to back */
+	uint64_t max_interval_ns;	/* Interval the poller backs off to when idle */
+	uint64_t active_ns;		/* Stay at min_interval_ns this long after a change */
+} zynq_poll_cfg_t;
+
+/* Changes coalesced since the previous zynq_poll_read(), indexed like cfg->srcs */
+typedef struct {
+	uint32_t changed[POLL_MAX_SRCS];
+	uint32_t value[POLL_MAX_SRCS];	/* Latest sample */
+} zynq_poll_event_t;
+
+typedef struct {
+	uint64_t samples;
+	uint64_t changes;		/* Samples that differed from the previous one */
+	uint64_t wakeups;		/* eventfd signals, one per burst of changes */
+	uint64_t interval_ns;		/* Current sample interval */
+} zynq_poll_stats_t;
+
+typedef struct zynq_poll zynq_poll_t;
+
+/* Sample cfg->srcs on a library thread, cfg->srcs is copied */
+zynq_poll_t *zynq_poll_start(zynq_dev_t *dev, const zynq_poll_cfg_t *cfg);
+/* eventfd, readable while changes are pending, for poll()/epoll */
+int zynq_poll_fd(zynq_poll_t *poll);
+/* Collect pending changes, returns 1 if any bit changed, 0 if none (a wakeup may be spurious) */
+int zynq_poll_read(zynq_poll_t *poll, zynq_poll_event_t *ev);
+int zynq_poll_get_stats(zynq_poll_t *poll, zynq_poll_stats_t *stats);
+int zynq_poll_stop(zynq_poll_t *poll);
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+}
+#endif
+
+#endif  /* _ZYNQ_POLL_H_ */
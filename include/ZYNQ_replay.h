@@ -0,0 +1,59 @@
+#ifndef _ZYNQ_REPLAY_H_
+#define _ZYNQ_REPLAY_H_
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "ZYNQ_driver.h"
+#include "ZYNQ_trace.h"
+
+/* Flags for zynq_replay_cfg_t */
+#define REPLAY_TIMED  (0x1)	/* Keep the recorded gaps, otherwise as fast as possible */
+
+typedef struct {
+	uint32_t flags;			/* REPLAY_TIMED */
+	uint32_t loops;			/* Passes over the records, 0 = 1 */
+	uint64_t spin_ns;		/* Busy wait this long before each op when timed */
+	int rt_priority;		/* SCHED_FIFO priority of the caller while replaying, 0 = inherit */
+} zynq_replay_cfg_t;
+
+typedef struct {
+	uint64_t ops;			/* Records replayed */
+	uint64_t writes;
+	uint64_t reads;
+	uint64_t clocks;		/* CR records skipped, a test mode device clocks itself */
+	uint64_t strobes;		/* CR strobes the replayed writes issued, 4 CR records each */
+	uint64_t errors;		/* Failed driver calls, replay stops at the first */
+	uint64_t mismatches;		/* Reads not returning the recorded value */
+	uint64_t first_mismatch;	/* Record index of the first one */
+	uint64_t elapsed_ns;
+	double ops_per_sec;
+	/* Lateness against the recorded timing, REPLAY_TIMED only */
+	uint64_t late_min_ns;
+	uint64_t late_max_ns;
+	uint64_t late_mean_ns;
+	uint64_t late_p99_ns;		/* Upper bound, power of 2 resolution */
+	/* Time spent in each driver call */
+	uint64_t op_mean_ns;
+	uint64_t op_p99_ns;
+} zynq_replay_stats_t;
+
+/* Read a trace file written by zynq_trace_dump(), free *recs when done */
+int zynq_replay_load(const char *path, zynq_trace_rec_t **recs, uint32_t *count);
+/*
+ * Drive recs through the driver calls that made them: zynq_dev_write(),
+ * zynq_dev_read() and the direction calls.  Reads are compared with the
+ * recorded values.  Runs on the caller's thread until the end, an error
+ * or *stop (may be NULL).
+ */
+int zynq_replay_run(zynq_dev_t *dev, const zynq_trace_rec_t *recs, uint32_t count,
+	const zynq_replay_cfg_t *cfg, const int *stop, zynq_replay_stats_t *stats);
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+}
+#endif
+
+#endif  /* _ZYNQ_REPLAY_H_ */
@@ -0,0 +1,62 @@
+#ifndef _ZYNQ_SEQ_H_
+#define _ZYNQ_SEQ_H_
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "ZYNQ_driver.h"
+
+/* Flags for zynq_seq_cfg_t */
+#define SEQ_LOOP  (0x1)		/* Replay the table until zynq_seq_stop() */
+
+/* One step of a sequence, its writes are applied with zynq_dev_writev() */
+typedef struct {
+	uint64_t t_ns;			/* Deadline relative to the start of the pass */
+	const zynq_regop_t *ops;
+	uint32_t count;
+} zynq_seq_step_t;
+
+typedef struct {
+	const zynq_seq_step_t *steps;	/* Sorted by t_ns */
+	uint32_t num_steps;
+	uint32_t flags;			/* SEQ_LOOP */
+	uint32_t writev_flags;		/* Passed to zynq_dev_writev() */
+	uint64_t period_ns;		/* Pass length when looping, at least the last t_ns */
+	uint64_t spin_ns;		/* Busy wait this long before each deadline, 0 = sleep only */
+	int rt_priority;		/* SCHED_FIFO priority of the player, 0 = inherit */
+	/* Called on the player thread after each step, may be NULL */
+	void (*on_step)(uint32_t step, void *arg);
+	void *arg;
+} zynq_seq_cfg_t;
+
+/* Lateness of each step's writes with respect to its deadline */
+typedef struct {
+	uint64_t steps;			/* Steps played */
+	uint64_t passes;		/* Complete passes over the table */
+	uint64_t errors;		/* Failed zynq_dev_writev() calls, playing stops at the first */
+	uint64_t late_min_ns;
+	uint64_t late_max_ns;
+	uint64_t late_mean_ns;
+	uint64_t late_p99_ns;		/* Upper bound, power of 2 resolution */
+} zynq_seq_stats_t;
+
+typedef struct zynq_seq zynq_seq_t;
+
+/* Start playing cfg on a dedicated thread, the table must outlive the player */
+zynq_seq_t *zynq_seq_start(zynq_dev_t *dev, const zynq_seq_cfg_t *cfg);
+/* Non-zero once the player has finished or stopped on an error */
+int zynq_seq_done(zynq_seq_t *seq);
+int zynq_seq_get_stats(zynq_seq_t *seq, zynq_seq_stats_t *stats);
+/* Wait for the end of the table (or an error), fill stats and free the player */
+int zynq_seq_wait(zynq_seq_t *seq, zynq_seq_stats_t *stats);
+/* Stop at the next step, fill stats and free the player */
+int zynq_seq_stop(zynq_seq_t *seq, zynq_seq_stats_t *stats);
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+}
+#endif
+
+#endif  /* _ZYNQ_SEQ_H_ */
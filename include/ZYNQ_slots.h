@@ -0,0 +1,63 @@
+#ifndef _ZYNQ_SLOTS_H_
+#define _ZYNQ_SLOTS_H_
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "ZYNQ_driver.h"
+
+/*
+ * Design slots.
+ *
+ * A set of PL designs, each a bitstream and the GPIO layout it brings up,
+ * read once into locked memory.  Switching to a slot closes the device of
+ * the previous one, writes the preloaded image to the configuration port
+ * and opens the new layout, so no file is read after zynq_slots_open().
+ * The state file of zynq_pl_program() is kept up to date, a switch to the
+ * image already in the fabric only reopens the device.
+ */
+
+/* Longest slot name, with the terminator */
+#define SLOT_NAME_MAX (32)
+
+typedef struct {
+	const char *name;
+	const char *bitstream;		/* NULL for a layout only slot, nothing to program */
+	zynq_dev_cfg_t dev;		/* Layout of the design, dev.bitstream is not used */
+} zynq_slot_cfg_t;
+
+typedef struct {
+	const char *target;		/* NULL for PL_XDEVCFG */
+	const char *prog_done;		/* NULL for PL_PROG_DONE, "" to not wait for it */
+	const char *state_file;		/* NULL for PL_STATE_FILE */
+	uint32_t timeout_ms;		/* prog_done wait, 0 for the driver's default */
+	uint32_t num_slots;
+	const zynq_slot_cfg_t *slot;
+} zynq_slots_cfg_t;
+
+typedef struct zynq_slots zynq_slots_t;
+
+/* Read every bitstream of cfg into locked memory, the configuration is copied */
+zynq_slots_t *zynq_slots_open(const zynq_slots_cfg_t *cfg);
+/*
+ * Close the device of the current slot, program the image of slot name
+ * unless it is already loaded (INIT_FORCE_PROG loads anyway) and open its
+ * layout with opmode and initmode.  stats may be NULL.  Not thread-safe,
+ * the returned device is closed by the next switch or zynq_slots_close().
+ */
+zynq_dev_t *zynq_slots_switch(zynq_slots_t *slots, const char *name, uint32_t opmode, uint32_t initmode,
+	zynq_pl_stats_t *stats);
+/* Name of the slot last switched to, NULL before the first switch */
+const char *zynq_slots_current(zynq_slots_t *slots);
+/* 1 if the image of slot name is held in locked memory, 0 if only resident, -1 if unknown */
+int zynq_slots_locked(zynq_slots_t *slots, const char *name);
+int zynq_slots_close(zynq_slots_t *slots);
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+}
+#endif
+
+#endif  /* _ZYNQ_SLOTS_H_ */
@@ -0,0 +1,77 @@
+#ifndef _ZYNQ_STATS_H_
+#define _ZYNQ_STATS_H_
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "ZYNQ_driver.h"
+
+/*
+ * Per call latency statistics.
+ *
+ * While started, every register call of a device is timed and counted
+ * per entry point and per GPIO offset.  zynq_foo() and zynq_dev_foo()
+ * share a counter.  Batches count under the offset of their first op,
+ * calls with an offset out of range under offset num_gpio.  Build with
+ * make DEFINES=-DZYNQ_STATS=0 to take the timing off the register calls
+ * entirely, zynq_stats_start() then fails.
+ */
+
+/* Entry points */
+#define STATS_SET_DIR   (0)	/* zynq_set_gpio_direction() */
+#define STATS_GET_DIR   (1)	/* zynq_get_gpio_direction() */
+#define STATS_WRITE     (2)
+#define STATS_WRITE_LW  (3)
+#define STATS_WRITE_UW  (4)
+#define STATS_READ      (5)
+#define STATS_READ_LW   (6)
+#define STATS_READ_UW   (7)
+#define STATS_BITS      (8)	/* zynq_set/clear/toggle_bits() and the _tri_ variants */
+#define STATS_WRITEV    (9)
+#define STATS_READV     (10)
+#define STATS_STREAM    (11)	/* zynq_write_stream() */
+#define STATS_NUM_OPS   (12)
+
+/*
+ * Log-linear histogram: 2^STATS_SUB_BITS buckets per power of two, exact
+ * below 2^STATS_SUB_BITS ns, everything from 2^STATS_MAX_BITS ns (about
+ * a minute) on in the last bucket.  Bucket widths stay within 25% of the
+ * latency they hold.
+ */
+#define STATS_SUB_BITS  (2)
+#define STATS_MAX_BITS  (36)
+#define STATS_BUCKETS   ((STATS_MAX_BITS - STATS_SUB_BITS + 1) << STATS_SUB_BITS)
+
+/* Every offset, see zynq_get_stats() */
+#define STATS_ALL       (0xffffffff)
+
+typedef struct {
+	uint64_t calls;
+	uint64_t errors;		/* Calls returning non-zero */
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint64_t hist[STATS_BUCKETS];
+} zynq_op_stats_t;
+
+/* Start timing the calls of dev, counts survive a stop and start until reset */
+int zynq_stats_start(zynq_dev_t *dev);
+int zynq_stats_stop(zynq_dev_t *dev);
+/* Copy the counters of op at offset, STATS_ALL sums every offset */
+int zynq_get_stats(zynq_dev_t *dev, uint32_t op, uint32_t offset, zynq_op_stats_t *stats);
+/* Zero every counter, calls in flight on other threads may be lost */
+int zynq_reset_stats(zynq_dev_t *dev);
+/* Table of each op and offset called, fp NULL for stdout */
+int zynq_dump_stats(zynq_dev_t *dev, FILE *fp);
+/* Upper bound of the latency below which pct percent of the calls fell */
+uint64_t zynq_stats_pct(const zynq_op_stats_t *stats, double pct);
+const char *zynq_stats_name(uint32_t op);
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+}
+#endif
+
+#endif  /* _ZYNQ_STATS_H_ */
@@ -0,0 +1,51 @@
+#ifndef _ZYNQ_TRACE_H_
+#define _ZYNQ_TRACE_H_
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "ZYNQ_driver.h"
+
+/* Trace record flags */
+#define TRACE_WRITE  (0x01)	/* Write, otherwise read */
+#define TRACE_TRI    (0x02)	/* Tri (direction) register, otherwise data */
+#define TRACE_CALL   (0x04)	/* First record of a register call, the rest of the call follows */
+
+/* Trace file identification */
+#define TRACE_MAGIC    (0x4354525a)	/* "ZTRC" little endian */
+#define TRACE_VERSION  (2)
+
+/* One register access, 16 bytes */
+typedef struct {
+	uint64_t ts_ns;		/* CLOCK_MONOTONIC timestamp */
+	uint32_t value;		/* Value written or read */
+	uint16_t offset;	/* GPIO offset */
+	uint8_t chan;		/* CH1_INDEX or CH2_INDEX */
+	uint8_t flags;		/* TRACE_WRITE | TRACE_TRI | TRACE_CALL */
+} zynq_trace_rec_t;
+
+/* Trace file header, followed by count records oldest first */
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t rec_size;
+	uint32_t count;
+	uint32_t lost;		/* Older records overwritten in the ring */
+} zynq_trace_hdr_t;
+
+/* Start recording into a ring of num_recs records (rounded up to a power of 2) */
+int zynq_trace_start(zynq_dev_t *dev, uint32_t num_recs);
+int zynq_trace_stop(zynq_dev_t *dev);
+/* Write the ring to a trace file, works while recording or after a stop */
+int zynq_trace_dump(zynq_dev_t *dev, const char *path);
+/* Dump the ring to path whenever signal signo arrives, e.g. SIGUSR1 */
+int zynq_trace_dump_on_signal(zynq_dev_t *dev, int signo, const char *path);
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+}
+#endif
+
+#endif  /* _ZYNQ_TRACE_H_ */
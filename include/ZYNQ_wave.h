@@ -0,0 +1,67 @@
+#ifndef _ZYNQ_WAVE_H_
+#define _ZYNQ_WAVE_H_
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "ZYNQ_driver.h"
+
+/* Up to 32 bits on each channel */
+#define WAVE_MAX_BITS (32 * MAX_CHANS)
+
+/* One output bit, high for high_ns at the start of every period */
+typedef struct {
+	uint32_t channel;		/* CH1_INDEX or CH2_INDEX */
+	uint32_t bit;			/* 0 - 31 */
+	uint64_t period_ns;
+	uint64_t high_ns;		/* 0 = always low, >= period_ns = always high */
+	uint64_t phase_ns;		/* Delay of the first rising edge */
+} zynq_wave_bit_t;
+
+typedef struct {
+	uint32_t offset;		/* GPIO driven, its data register must be set as output */
+	const zynq_wave_bit_t *bits;
+	uint32_t num_bits;
+	uint32_t idle[MAX_CHANS];	/* Value of the bits not driven by the engine */
+	uint64_t duration_ns;		/* Stop after this long, 0 = until zynq_wave_stop() */
+	uint64_t spin_ns;		/* Busy wait this long before each edge, 0 = sleep only */
+	int rt_priority;		/* SCHED_FIFO priority of the engine, 0 = inherit */
+} zynq_wave_cfg_t;
+
+/* Achieved output of one bit, jitter is each edge's lateness */
+typedef struct {
+	uint64_t edges;
+	double freq_hz;			/* From the first to the last rising edge */
+	uint64_t jitter_min_ns;
+	uint64_t jitter_max_ns;
+	uint64_t jitter_mean_ns;
+	uint64_t jitter_p99_ns;		/* Upper bound, power of 2 resolution */
+} zynq_wave_bit_stats_t;
+
+typedef struct {
+	uint64_t stores;		/* Register writes, one per tick */
+	uint64_t errors;		/* Failed writes, the engine stops at the first */
+	uint32_t num_bits;
+	zynq_wave_bit_stats_t bit[WAVE_MAX_BITS];	/* In cfg->bits order */
+} zynq_wave_stats_t;
+
+typedef struct zynq_wave zynq_wave_t;
+
+/* Start generating cfg on a dedicated thread, cfg->bits is copied */
+zynq_wave_t *zynq_wave_start(zynq_dev_t *dev, const zynq_wave_cfg_t *cfg);
+/* Non-zero once duration_ns has elapsed or a write failed */
+int zynq_wave_done(zynq_wave_t *wave);
+int zynq_wave_get_stats(zynq_wave_t *wave, zynq_wave_stats_t *stats);
+/* Wait for duration_ns to elapse (or an error), fill stats and free the engine */
+int zynq_wave_wait(zynq_wave_t *wave, zynq_wave_stats_t *stats);
+/* Stop at the next edge, fill stats and free the engine */
+int zynq_wave_stop(zynq_wave_t *wave, zynq_wave_stats_t *stats);
+
+#if defined(_LANGUAGE_C_PLUS_PLUS) || defined(__cplusplus)
+}
+#endif
+
+#endif  /* _ZYNQ_WAVE_H_ */
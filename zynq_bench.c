@@ -0,0 +1,334 @@
+/**********************************************************
+ *
+ *  Microbenchmark for the ZYNQ_driver public API.
+ *
+ *  Runs every call for each operating mode and channel
+ *  mask against the simulated PL (or /dev/mem with -d)
+ *  and reports ops/sec, ns/op and p50/p99/p99.9 latency.
+ *
+ *  Usage: zynq_bench.exe [-n iterations] [-s sim_file] [-d] [-c] [-t] [-w] [-l] [-z] [-p] [-i]
+ *
+ *  -t records every access in the trace ring while timing,
+ *  -w enables the shadow registers, -l the thread-safe mode,
+ *  -z maps each GPIO on first use, -p prints the init/close
+ *  phase profile of each pass, -i collects the per call
+ *  statistics while timing and prints them after each pass.
+ *
+ **********************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "include/ZYNQ_driver.h"
+#include "include/ZYNQ_trace.h"
+#include "include/ZYNQ_stats.h"
+
+#define DEFAULT_ITERATIONS (200000)
+
+typedef int (*bench_fn_t)(uint32_t offset, uint32_t *data, uint32_t channel_mask);
+
+typedef struct {
+	const char *name;
+	bench_fn_t call;
+	uint32_t offset;
+} bench_t;
+
+static const bench_t benches[] = {
+	{ "zynq_write",              zynq_write,              DR },
+	{ "zynq_write_lw",           zynq_write_lw,           DR },
+	{ "zynq_write_uw",           zynq_write_uw,           DR },
+	{ "zynq_read",               zynq_read,               DR },
+	{ "zynq_read_lw",            zynq_read_lw,            DR },
+	{ "zynq_read_uw",            zynq_read_uw,            DR },
+	{ "zynq_set_gpio_direction", zynq_set_gpio_direction, DR },
+	{ "zynq_get_gpio_direction", zynq_get_gpio_direction, DR },
+};
+
+#define NUM_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a;
+	uint32_t y = *(const uint32_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const uint32_t *sorted, uint32_t n, double p)
+{
+	uint32_t i = (uint32_t) (p * (n - 1) + 0.5);
+
+	return sorted[i];
+}
+
+/* Median cost of the timestamp pair, subtracted from every latency sample */
+static uint32_t timer_overhead(uint32_t *lat, uint32_t iterations)
+{
+	uint64_t t0;
+	uint32_t i;
+
+	for (i = 0; i < iterations; i++)
+	{
+		t0 = now_ns();
+		lat[i] = (uint32_t) (now_ns() - t0);
+	}
+
+	qsort(lat, iterations, sizeof(lat[0]), cmp_u32);
+
+	return percentile(lat, iterations, 0.50);
+}
+
+static int run_bench(const bench_t *b, uint32_t opmode, uint32_t channel_mask,
+	uint32_t iterations, uint32_t *lat, uint32_t overhead, int csv)
+{
+	uint32_t data[MAX_CHANS];
+	uint64_t start, end, t0, t1;
+	double total_ns;
+	uint32_t i;
+
+	data[CH1_INDEX] = 0x00010001;
+	data[CH2_INDEX] = 0x00020002;
+
+	/* Warm up the mapping and caches */
+	for (i = 0; i < 1000; i++)
+	{
+		if (b->call(b->offset, data, channel_mask) != 0)
+		{
+			printf("ERROR calling %s()...\n", b->name);
+			return -1;
+		}
+	}
+
+	/* Throughput, untimed calls back to back */
+	start = now_ns();
+	for (i = 0; i < iterations; i++)
+	{
+		data[CH1_INDEX] = i;
+		b->call(b->offset, data, channel_mask);
+	}
+	end = now_ns();
+	total_ns = (double) (end - start);
+
+	/* Latency, every call timed individually */
+	for (i = 0; i < iterations; i++)
+	{
+		data[CH1_INDEX] = i;
+		t0 = now_ns();
+		b->call(b->offset, data, channel_mask);
+		t1 = now_ns();
+		lat[i] = (uint32_t) (t1 - t0);
+		lat[i] = lat[i] > overhead ? lat[i] - overhead : 0;
+	}
+
+	qsort(lat, iterations, sizeof(lat[0]), cmp_u32);
+
+	printf(csv ? "%s,%s,%u,%.0f,%.1f,%u,%u,%u\n" :
+		"%-24s %-6s 0x%x %12.0f %9.1f %8u %8u %8u\n",
+		b->name, opmode == OP_TEST_MODE ? "test" : "normal", channel_mask,
+		iterations / (total_ns / 1e9), total_ns / iterations,
+		percentile(lat, iterations, 0.50),
+		percentile(lat, iterations, 0.99),
+		percentile(lat, iterations, 0.999));
+
+	return 0;
+}
+
+/* Throughput of zynq_write_stream(), one barrier per 64 words */
+static int run_stream(uint32_t opmode, uint32_t *words, uint32_t iterations, int csv)
+{
+	zynq_stream_stats_t stats;
+	uint32_t i;
+
+	for (i = 0; i < iterations; i++)
+	{
+		words[i] = i;
+	}
+
+	if (zynq_write_stream(DR, CH1_INDEX, words, iterations, 64, 0, &stats) != 0)
+	{
+		printf("ERROR calling zynq_write_stream()...\n");
+		return -1;
+	}
+
+	printf(csv ? "%s,%s,%u,%.0f,%.1f,,,\n" :
+		"%-24s %-6s 0x%x %12.0f %9.1f %8s %8s %8s\n",
+		"zynq_write_stream", opmode == OP_TEST_MODE ? "test" : "normal", CH1_MASK,
+		stats.words_per_sec, (double) stats.elapsed_ns / iterations, "-", "-", "-");
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int rv = 0;
+
+	int opt;
+
+	int csv = 0;
+
+	int trace = 0;
+
+	int profile = 0;
+
+	int stats = 0;
+
+	uint32_t initmode = INIT_OPEN_MODE;
+
+	uint32_t backend = BACKEND_SIM;
+
+	const char *sim_path = NULL;
+
+	uint32_t iterations = DEFAULT_ITERATIONS;
+
+	uint32_t opmodes[] = { OP_NORMAL_MODE, OP_TEST_MODE };
+
+	uint32_t masks[] = { CH1_MASK, CH2_MASK, CH1_MASK | CH2_MASK };
+
+	uint32_t direction[MAX_CHANS] = { 0, 0 };
+
+	uint32_t *lat;
+
+	uint32_t overhead;
+
+	uint32_t m, c, b;
+
+	while ( (opt = getopt(argc, argv, "n:s:dctwlzpi")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n':
+				iterations = strtoul(optarg, NULL, 0);
+				break;
+			case 's':
+				sim_path = optarg;
+				break;
+			case 'd':
+				backend = BACKEND_DEVMEM;
+				break;
+			case 'c':
+				csv = 1;
+				break;
+			case 't':
+				trace = 1;
+				break;
+			case 'w':
+				initmode |= INIT_SHADOW_MODE;
+				break;
+			case 'l':
+				initmode |= INIT_THREADSAFE_MODE;
+				break;
+			case 'z':
+				initmode |= INIT_LAZY_MODE;
+				break;
+			case 'p':
+				profile = 1;
+				break;
+			case 'i':
+				stats = 1;
+				break;
+			default:
+				printf("Usage: %s [-n iterations] [-s sim_file] [-d] [-c] [-t] [-w] [-l] [-z] [-p] [-i]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (iterations == 0 || (lat = malloc(iterations * sizeof(*lat))) == NULL)
+	{
+		printf("ERROR allocating %u latency samples...\n", iterations);
+		return 1;
+	}
+
+	if ( (rv = zynq_set_backend(backend, sim_path)) != 0)
+	{
+		printf("ERROR calling zynq_set_backend()...\n");
+		return 1;
+	}
+
+	overhead = timer_overhead(lat, iterations);
+
+	if (!csv)
+	{
+		printf("Timer overhead %u ns subtracted from latencies\n\n", overhead);
+	}
+
+	printf(csv ? "call,opmode,mask,ops_per_sec,ns_per_op,p50_ns,p99_ns,p999_ns\n" :
+		"%-24s %-6s %-3s %12s %9s %8s %8s %8s\n",
+		"call", "opmode", "mask", "ops/sec", "ns/op", "p50", "p99", "p99.9");
+
+	for (m = 0; m < sizeof(opmodes) / sizeof(opmodes[0]) && rv == 0; m++)
+	{
+		if ( (rv = zynq_init(opmodes[m], initmode)) != 0)
+		{
+			printf("ERROR calling zynq_init()...\n");
+			break;
+		}
+
+		if (trace && (rv = zynq_trace_start(zynq_get_dev(), 65536)) != 0)
+		{
+			printf("ERROR calling zynq_trace_start()...\n");
+			zynq_close();
+			break;
+		}
+
+		if (stats && (rv = zynq_stats_start(zynq_get_dev())) != 0)
+		{
+			printf("ERROR calling zynq_stats_start()...\n");
+			zynq_close();
+			break;
+		}
+
+		/* Data register drives outputs on both channels */
+		zynq_set_gpio_direction(DR, direction, CH1_MASK | CH2_MASK);
+
+		for (b = 0; b < NUM_BENCHES && rv == 0; b++)
+		{
+			for (c = 0; c < sizeof(masks) / sizeof(masks[0]) && rv == 0; c++)
+			{
+				rv = run_bench(&benches[b], opmodes[m], masks[c], iterations, lat,
+					overhead, csv);
+			}
+		}
+
+		if (rv == 0)
+		{
+			rv = run_stream(opmodes[m], lat, iterations, csv);
+		}
+
+		if (stats && !csv)
+		{
+			printf("\n");
+			zynq_dump_stats(zynq_get_dev(), stdout);
+			printf("\n");
+		}
+
+		if (zynq_close() != 0)
+		{
+			printf("ERROR calling zynq_close()...\n");
+			rv = -1;
+		}
+
+		if (profile && !csv)
+		{
+			printf("\n");
+			zynq_dump_profile(stdout);
+			printf("\n");
+		}
+	}
+
+	free(lat);
+
+	return rv != 0;
+}
@@ -0,0 +1,115 @@
+/**********************************************************
+ *
+ *  Register broker daemon.
+ *
+ *  Owns the mappings of the default design and serves the
+ *  register calls of BACKEND_BROKER clients until SIGINT
+ *  or SIGTERM.  Only the broker needs access to /dev/mem.
+ *
+ *  Usage: zynq_broker.exe [-s sim_file] [-t] [-p] [-n name] [-m mode] [-v]
+ *
+ *  -s serves the simulated PL instead of /dev/mem, -t runs
+ *  in test mode, -p programs the PL first, -m sets the
+ *  permissions of the shared memory (default 0660).
+ *
+ **********************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "include/ZYNQ_driver.h"
+#include "include/ZYNQ_broker.h"
+
+static int stop = 0;
+
+static void on_signal(int signo)
+{
+	__atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+}
+
+int main(int argc, char **argv)
+{
+	int rv = 0;
+
+	int opt;
+
+	uint32_t opmode = OP_NORMAL_MODE;
+
+	uint32_t initmode = INIT_OPEN_MODE;
+
+	uint32_t backend = BACKEND_DEVMEM;
+
+	uint32_t mode = 0660;
+
+	const char *sim_path = NULL;
+
+	const char *name = BROKER_DEFAULT_NAME;
+
+	struct sigaction sa;
+
+	while ( (opt = getopt(argc, argv, "s:tpn:m:v")) != -1)
+	{
+		switch (opt)
+		{
+			case 's':
+				backend = BACKEND_SIM;
+				sim_path = optarg;
+				break;
+			case 't':
+				opmode = OP_TEST_MODE;
+				break;
+			case 'p':
+				initmode |= INIT_PROG_MODE;
+				break;
+			case 'n':
+				name = optarg;
+				break;
+			case 'm':
+				mode = strtoul(optarg, NULL, 8);
+				break;
+			case 'v':
+				zynq_set_debug_level(1);
+				break;
+			default:
+				printf("Usage: %s [-s sim_file] [-t] [-p] [-n name] [-m mode] [-v]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if ( (rv = zynq_set_backend(backend, sim_path)) != 0)
+	{
+		printf("ERROR calling zynq_set_backend()...\n");
+		return 1;
+	}
+
+	if ( (rv = zynq_init(opmode, initmode)) != 0)
+	{
+		printf("ERROR calling zynq_init()...\n");
+		return 1;
+	}
+
+	printf("Serving %s, %s mode...\n", name, opmode == OP_TEST_MODE ? "test" : "normal");
+
+	if ( (rv = zynq_broker_serve(zynq_get_dev(), name, mode, &stop)) != 0)
+	{
+		printf("ERROR calling zynq_broker_serve()...\n");
+	}
+
+	if (zynq_close() != 0)
+	{
+		printf("ERROR calling zynq_close()...\n");
+		rv = -1;
+	}
+
+	return rv != 0;
+}
@@ -0,0 +1,164 @@
+/**********************************************************
+ *
+ *  Logic analyzer capture to a change-only file.
+ *
+ *  Samples one GPIO until the count or time limit, SIGINT
+ *  or SIGTERM and writes the changes to capture_file for
+ *  zynq_capture_decode.exe.
+ *
+ *  Usage: zynq_capture.exe [-s sim_file] [-o offset] [-c channel_mask] [-T]
+ *                          [-i interval_ns] [-d duration_ms] [-n samples]
+ *                          [-C cpu] [-p rt_priority] capture_file
+ *
+ *  -T also records the tri registers.
+ *
+ **********************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "include/ZYNQ_driver.h"
+#include "include/ZYNQ_capture.h"
+#include "include/ZYNQ_capfile.h"
+
+static int stop = 0;
+
+static void on_signal(int signo)
+{
+	__atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+}
+
+int main(int argc, char **argv)
+{
+	int rv = 0;
+
+	int opt;
+
+	uint32_t backend = BACKEND_DEVMEM;
+
+	const char *sim_path = NULL;
+
+	zynq_capture_cfg_t cfg;
+
+	zynq_capture_stats_t stats;
+
+	zynq_capfile_stats_t fstats;
+
+	zynq_capfile_t *cf;
+
+	zynq_capture_t *cap;
+
+	struct sigaction sa;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.offset = DR;
+	cfg.channel_mask = CH1_MASK;
+	cfg.ring_size = 1 << 20;
+	cfg.cpu = -1;
+
+	while ( (opt = getopt(argc, argv, "s:o:c:Ti:d:n:C:p:")) != -1)
+	{
+		switch (opt)
+		{
+			case 's':
+				backend = BACKEND_SIM;
+				sim_path = optarg;
+				break;
+			case 'o':
+				cfg.offset = strtoul(optarg, NULL, 0);
+				break;
+			case 'c':
+				cfg.channel_mask = strtoul(optarg, NULL, 0);
+				break;
+			case 'T':
+				cfg.flags |= CAPTURE_TRI;
+				break;
+			case 'i':
+				cfg.interval_ns = strtoull(optarg, NULL, 0);
+				break;
+			case 'd':
+				cfg.duration_ns = strtoull(optarg, NULL, 0) * 1000000ULL;
+				break;
+			case 'n':
+				cfg.max_samples = strtoull(optarg, NULL, 0);
+				break;
+			case 'C':
+				cfg.cpu = atoi(optarg);
+				break;
+			case 'p':
+				cfg.rt_priority = atoi(optarg);
+				break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+
+	if (optind != argc - 1)
+	{
+		printf("Usage: %s [-s sim_file] [-o offset] [-c channel_mask] [-T] [-i interval_ns]\n"
+			"       [-d duration_ms] [-n samples] [-C cpu] [-p rt_priority] capture_file\n", argv[0]);
+		return 1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if (zynq_set_backend(backend, sim_path) != 0 || zynq_init(OP_NORMAL_MODE, INIT_OPEN_MODE | INIT_SHADOW_MODE) != 0)
+	{
+		printf("ERROR calling zynq_init()...\n");
+		return 1;
+	}
+
+	if ( (cf = zynq_capfile_open(argv[optind], &cfg, 0)) == NULL)
+	{
+		printf("ERROR opening %s...\n", argv[optind]);
+		zynq_close();
+		return 1;
+	}
+
+	if ( (cap = zynq_capture_start(zynq_get_dev(), &cfg)) == NULL)
+	{
+		printf("ERROR calling zynq_capture_start()...\n");
+		zynq_capfile_close(cf, NULL);
+		zynq_close();
+		return 1;
+	}
+
+	if ( (rv = zynq_capfile_record(cf, cap, &stop)) != 0)
+	{
+		printf("ERROR writing %s...\n", argv[optind]);
+	}
+
+	zynq_capture_get_stats(cap, &stats);
+
+	if (zynq_capfile_close(cf, &fstats) != 0)
+	{
+		printf("ERROR closing %s...\n", argv[optind]);
+		rv = -1;
+	}
+
+	printf("%llu samples at %.0f/s, %llu dropped, max gap %.3f us\n",
+		(unsigned long long) stats.samples, stats.rate_hz, (unsigned long long) stats.dropped,
+		stats.max_gap_ns / 1e3);
+	printf("%llu records in %llu blocks, %llu bytes, %.1fx smaller than raw samples\n",
+		(unsigned long long) fstats.records, (unsigned long long) fstats.blocks,
+		(unsigned long long) fstats.bytes, fstats.ratio);
+
+	zynq_capture_close(cap);
+
+	if (zynq_close() != 0)
+	{
+		printf("ERROR calling zynq_close()...\n");
+		rv = -1;
+	}
+
+	return rv != 0;
+}
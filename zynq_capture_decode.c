@@ -0,0 +1,104 @@
+/**********************************************************
+ *
+ *  Decoder for change-only capture files written by
+ *  zynq_capture.exe or zynq_capfile_write().
+ *
+ *  Usage: zynq_capture_decode.exe capture_file [from_us]
+ *
+ *  Prints one line per change of the CH1/CH2 words, from
+ *  from_us into the capture when given.
+ *
+ **********************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "include/ZYNQ_capfile.h"
+
+#define EVENTS (1024)
+
+int main(int argc, char **argv)
+{
+	zynq_capfile_reader_t *rd;
+
+	const zynq_capfile_hdr_t *hdr;
+
+	static zynq_capfile_ev_t ev[EVENTS];
+
+	uint64_t first_ns = 0, samples = 0, records = 0;
+
+	int n, i, tri;
+
+	if (argc != 2 && argc != 3)
+	{
+		printf("Usage: %s capture_file [from_us]\n", argv[0]);
+		return 1;
+	}
+
+	if ( (rd = zynq_capfile_reader_open(argv[1])) == NULL)
+	{
+		printf("ERROR %s is not a capture file...\n", argv[1]);
+		return 1;
+	}
+
+	hdr = zynq_capfile_reader_hdr(rd);
+	tri = (hdr->flags & CAPTURE_TRI) != 0;
+
+	/* Times are relative to the first record */
+	if ( (n = zynq_capfile_read(rd, ev, 1)) == 1)
+	{
+		first_ns = ev[0].ts_ns;
+	}
+
+	if (n < 0 || zynq_capfile_seek(rd, first_ns + (argc == 3 ? strtoull(argv[2], NULL, 0) * 1000ULL : 0)) != 0)
+	{
+		printf("ERROR reading %s...\n", argv[1]);
+		zynq_capfile_reader_close(rd);
+		return 1;
+	}
+
+	printf("# offset %u, channel_mask 0x%x, interval %llu ns\n", hdr->offset, hdr->channel_mask,
+		(unsigned long long) hdr->interval_ns);
+	printf("# %14s %10s  ch1         ch2%s\n", "time_us", "idle", tri ? "         tri1        tri2" : "");
+
+	while ( (n = zynq_capfile_read(rd, ev, EVENTS)) > 0)
+	{
+		for (i = 0; i < n; i++)
+		{
+			samples += ev[i].idle + 1;
+			records++;
+
+			if (ev[i].changed == 0)
+			{
+				printf("%16.3f %10llu  (unchanged)\n", (ev[i].ts_ns - first_ns) / 1e3,
+					(unsigned long long) ev[i].idle + 1);
+				continue;
+			}
+
+			printf("%16.3f %10llu  0x%8.8x  0x%8.8x", (ev[i].ts_ns - first_ns) / 1e3,
+				(unsigned long long) ev[i].idle, ev[i].data[0], ev[i].data[1]);
+
+			if (tri)
+			{
+				printf("  0x%8.8x  0x%8.8x", ev[i].tri[0], ev[i].tri[1]);
+			}
+
+			printf("\n");
+		}
+	}
+
+	if (n < 0)
+	{
+		printf("ERROR %s is corrupt after %llu records...\n", argv[1], (unsigned long long) records);
+		zynq_capfile_reader_close(rd);
+		return 1;
+	}
+
+	printf("# %llu records, %llu samples\n", (unsigned long long) records, (unsigned long long) samples);
+
+	zynq_capfile_reader_close(rd);
+
+	return 0;
+}
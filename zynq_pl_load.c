@@ -0,0 +1,106 @@
+/**********************************************************
+ *
+ *  Programs the PL and reports the load phases.
+ *
+ *  Usage: zynq_pl_load.exe [-d prog_done] [-w timeout_ms] [-n] [-s state_file] [-f] [-v]
+ *                          bitstream [target]
+ *
+ *  target defaults to /dev/xdevcfg, an fpga_manager
+ *  directory loads a /lib/firmware image by name.  Any
+ *  existing file or FIFO works as a target for testing,
+ *  -n then skips the prog_done check.  With -s the load
+ *  is skipped while state_file shows the same image is
+ *  still loaded, -f loads anyway.
+ *
+ **********************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "include/ZYNQ_driver.h"
+
+int main(int argc, char **argv)
+{
+	int rv = 0;
+
+	int opt;
+
+	const char *prog_done = PL_PROG_DONE;
+
+	uint32_t timeout_ms = 1000;
+
+	const char *state_file = NULL;
+
+	int force = 0;
+
+	zynq_pl_stats_t stats;
+
+	while ( (opt = getopt(argc, argv, "d:w:ns:fv")) != -1)
+	{
+		switch (opt)
+		{
+			case 'd':
+				prog_done = optarg;
+				break;
+			case 'w':
+				timeout_ms = strtoul(optarg, NULL, 0);
+				break;
+			case 'n':
+				prog_done = NULL;
+				break;
+			case 's':
+				state_file = optarg;
+				break;
+			case 'f':
+				force = 1;
+				break;
+			case 'v':
+				zynq_set_debug_level(1);
+				break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+
+	if (optind != argc - 1 && optind != argc - 2)
+	{
+		printf("Usage: %s [-d prog_done] [-w timeout_ms] [-n] [-s state_file] [-f] [-v]\n"
+			"       bitstream [target]\n", argv[0]);
+		return 1;
+	}
+
+	if (state_file != NULL)
+	{
+		rv = zynq_pl_program(argv[optind], optind + 1 < argc ? argv[optind + 1] : NULL,
+			prog_done, state_file, timeout_ms, force, &stats);
+	}
+	else
+	{
+		rv = zynq_pl_load(argv[optind], optind + 1 < argc ? argv[optind + 1] : NULL,
+			prog_done, timeout_ms, &stats);
+	}
+
+	if (rv != 0)
+	{
+		printf("ERROR programming the PL...\n");
+	}
+
+	if (stats.cached)
+	{
+		printf("Image %016llx already loaded, skipped in %.3f ms (hash %.3f ms)\n",
+			(unsigned long long) stats.hash, stats.total_ns / 1e6, stats.hash_ns / 1e6);
+		return rv != 0;
+	}
+
+	printf("%llu bytes in %llu chunks, %.1f MB/s\n", (unsigned long long) stats.bytes,
+		(unsigned long long) stats.chunks, stats.bytes_per_sec / 1e6);
+	printf("open %.3f ms, stream %.3f ms, close %.3f ms, prog_done %.3f ms, total %.3f ms\n",
+		stats.open_ns / 1e6, stats.stream_ns / 1e6, stats.close_ns / 1e6, stats.done_ns / 1e6,
+		stats.total_ns / 1e6);
+
+	return rv != 0;
+}
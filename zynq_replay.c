@@ -0,0 +1,144 @@
+/**********************************************************
+ *
+ *  Replays a register access trace through the driver.
+ *
+ *  Usage: zynq_replay.exe [-s sim_file] [-t] [-T] [-S spin_ns] [-n loops] [-p rt_priority] trace_file
+ *
+ *  -s replays against the simulated PL instead of /dev/mem,
+ *  -t opens the design in test mode, -T keeps the recorded
+ *  timing instead of running as fast as possible, busy
+ *  waiting the last spin_ns before each op.
+ *
+ **********************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "include/ZYNQ_driver.h"
+#include "include/ZYNQ_replay.h"
+
+static int stop = 0;
+
+static void on_signal(int signo)
+{
+	__atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+}
+
+int main(int argc, char **argv)
+{
+	int rv = 0;
+
+	int opt;
+
+	uint32_t opmode = OP_NORMAL_MODE;
+
+	uint32_t backend = BACKEND_DEVMEM;
+
+	const char *sim_path = NULL;
+
+	zynq_trace_rec_t *recs;
+
+	uint32_t count;
+
+	zynq_replay_cfg_t cfg;
+
+	zynq_replay_stats_t stats;
+
+	struct sigaction sa;
+
+	memset(&cfg, 0, sizeof(cfg));
+
+	while ( (opt = getopt(argc, argv, "s:tTS:n:p:")) != -1)
+	{
+		switch (opt)
+		{
+			case 's':
+				backend = BACKEND_SIM;
+				sim_path = optarg;
+				break;
+			case 't':
+				opmode = OP_TEST_MODE;
+				break;
+			case 'T':
+				cfg.flags |= REPLAY_TIMED;
+				break;
+			case 'S':
+				cfg.spin_ns = strtoull(optarg, NULL, 0);
+				break;
+			case 'n':
+				cfg.loops = strtoul(optarg, NULL, 0);
+				break;
+			case 'p':
+				cfg.rt_priority = atoi(optarg);
+				break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+
+	if (optind != argc - 1)
+	{
+		printf("Usage: %s [-s sim_file] [-t] [-T] [-S spin_ns] [-n loops] [-p rt_priority] trace_file\n", argv[0]);
+		return 1;
+	}
+
+	if (zynq_replay_load(argv[optind], &recs, &count) != 0)
+	{
+		printf("ERROR loading %s...\n", argv[optind]);
+		return 1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if (zynq_set_backend(backend, sim_path) != 0 || zynq_init(opmode, INIT_OPEN_MODE) != 0)
+	{
+		printf("ERROR calling zynq_init()...\n");
+		free(recs);
+		return 1;
+	}
+
+	if ( (rv = zynq_replay_run(zynq_get_dev(), recs, count, &cfg, &stop, &stats)) != 0)
+	{
+		printf("ERROR calling zynq_replay_run()...\n");
+	}
+
+	printf("%llu ops (%llu writes, %llu reads, %llu clock records skipped, %llu strobes issued) "
+		"in %.3f ms, %.0f ops/s\n",
+		(unsigned long long) stats.ops, (unsigned long long) stats.writes, (unsigned long long) stats.reads,
+		(unsigned long long) stats.clocks, (unsigned long long) stats.strobes, stats.elapsed_ns / 1e6,
+		stats.ops_per_sec);
+	printf("op latency mean %llu ns, p99 <= %llu ns\n",
+		(unsigned long long) stats.op_mean_ns, (unsigned long long) stats.op_p99_ns);
+
+	if (cfg.flags & REPLAY_TIMED)
+	{
+		printf("lateness min %llu ns, mean %llu ns, p99 <= %llu ns, max %llu ns\n",
+			(unsigned long long) stats.late_min_ns, (unsigned long long) stats.late_mean_ns,
+			(unsigned long long) stats.late_p99_ns, (unsigned long long) stats.late_max_ns);
+	}
+
+	if (stats.mismatches)
+	{
+		printf("%llu read mismatches, first at record %llu\n",
+			(unsigned long long) stats.mismatches, (unsigned long long) stats.first_mismatch);
+	}
+
+	free(recs);
+
+	if (zynq_close() != 0)
+	{
+		printf("ERROR calling zynq_close()...\n");
+		rv = -1;
+	}
+
+	return rv != 0 || stats.mismatches != 0;
+}
@@ -0,0 +1,227 @@
+/**********************************************************
+ *
+ *  Preloads design slots and switches between them.
+ *
+ *  Usage: zynq_slots.exe [-t target] [-d prog_done] [-n] [-s state_file] [-S sim_file] [-f] [-v]
+ *                        name=bitstream[@base[:chans],...] ...
+ *
+ *  Every bitstream is read into memory up front, then
+ *  each line on stdin names the slot to switch to and the
+ *  switch is timed.  Without a layout a slot brings up
+ *  the default three GPIOs.  -S opens the layouts on the
+ *  simulated PL, -n skips the prog_done check, -f loads
+ *  even when the image is already in the fabric.
+ *
+ **********************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "include/ZYNQ_driver.h"
+#include "include/ZYNQ_slots.h"
+
+#define MAX_SLOTS (16)
+
+/* Default design, see ZYNQ_driver.c */
+static const zynq_gpio_cfg_t default_gpio[NUM_GPIO] = {
+	{ 0x41200000, MAX_CHANS },
+	{ 0x41201000, MAX_CHANS },
+	{ 0x41202000, MAX_CHANS },
+};
+
+static char names[MAX_SLOTS][SLOT_NAME_MAX];
+static zynq_gpio_cfg_t layouts[MAX_SLOTS][NUM_GPIO * 4];
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* name=bitstream[@base[:chans],...], bitstream is left in place */
+static int parse_slot(char *arg, uint32_t i, zynq_slot_cfg_t *slot)
+{
+	char *eq, *at, *tok, *end;
+
+	uint32_t n = 0;
+
+	if ( (eq = strchr(arg, '=')) == NULL || eq - arg >= SLOT_NAME_MAX)
+	{
+		return -1;
+	}
+
+	memcpy(names[i], arg, eq - arg);
+	slot->name = names[i];
+	slot->bitstream = eq + 1;
+	slot->dev.num_gpio = NUM_GPIO;
+	slot->dev.gpio = default_gpio;
+
+	if ( (at = strchr(eq + 1, '@')) == NULL)
+	{
+		return 0;
+	}
+
+	*at = '\0';
+
+	for (tok = strtok(at + 1, ","); tok != NULL; tok = strtok(NULL, ","))
+	{
+		if (n == sizeof(layouts[i]) / sizeof(layouts[i][0]))
+		{
+			return -1;
+		}
+
+		layouts[i][n].base = strtoul(tok, &end, 0);
+		layouts[i][n].num_chans = *end == ':' ? strtoul(end + 1, NULL, 0) : MAX_CHANS;
+		n++;
+	}
+
+	slot->dev.num_gpio = n;
+	slot->dev.gpio = layouts[i];
+
+	return n ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+	int rv = 0;
+
+	int opt;
+
+	uint32_t initmode = INIT_OPEN_MODE;
+
+	uint32_t backend = BACKEND_DEVMEM;
+
+	const char *sim_path = NULL;
+
+	char line[256];
+
+	zynq_slot_cfg_t slot[MAX_SLOTS];
+
+	zynq_slots_cfg_t cfg;
+
+	zynq_slots_t *slots;
+
+	zynq_pl_stats_t stats;
+
+	uint64_t t0, total_ns;
+
+	uint32_t i;
+
+	memset(&cfg, 0, sizeof(cfg));
+	memset(slot, 0, sizeof(slot));
+
+	while ( (opt = getopt(argc, argv, "t:d:ns:S:fv")) != -1)
+	{
+		switch (opt)
+		{
+			case 't':
+				cfg.target = optarg;
+				break;
+			case 'd':
+				cfg.prog_done = optarg;
+				break;
+			case 'n':
+				cfg.prog_done = "";
+				break;
+			case 's':
+				cfg.state_file = optarg;
+				break;
+			case 'S':
+				backend = BACKEND_SIM;
+				sim_path = optarg;
+				break;
+			case 'f':
+				initmode |= INIT_FORCE_PROG;
+				break;
+			case 'v':
+				zynq_set_debug_level(1);
+				break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+
+	for (i = 0; optind + i < (uint32_t) argc && rv == 0; i++)
+	{
+		if (i == MAX_SLOTS || parse_slot(argv[optind + i], i, &slot[i]) != 0)
+		{
+			rv = -1;
+			break;
+		}
+
+		slot[i].dev.backend = backend;
+		slot[i].dev.path = sim_path;
+	}
+
+	if (i == 0 || rv != 0)
+	{
+		printf("Usage: %s [-t target] [-d prog_done] [-n] [-s state_file] [-S sim_file] [-f] [-v]\n"
+			"       name=bitstream[@base[:chans],...] ...\n", argv[0]);
+		return 1;
+	}
+
+	cfg.num_slots = i;
+	cfg.slot = slot;
+
+	t0 = now_ns();
+
+	if ( (slots = zynq_slots_open(&cfg)) == NULL)
+	{
+		printf("ERROR preloading the slots...\n");
+		return 1;
+	}
+
+	printf("%u slots preloaded in %.3f ms\n", cfg.num_slots, (now_ns() - t0) / 1e6);
+
+	for (i = 0; i < cfg.num_slots; i++)
+	{
+		printf("  %-16s %s\n", slot[i].name, zynq_slots_locked(slots, slot[i].name) ? "locked" : "not locked");
+	}
+
+	while (fgets(line, sizeof(line), stdin) != NULL)
+	{
+		line[strcspn(line, " \r\n")] = '\0';
+
+		if (line[0] == '\0')
+		{
+			continue;
+		}
+
+		t0 = now_ns();
+
+		if (zynq_slots_switch(slots, line, OP_NORMAL_MODE, initmode, &stats) == NULL)
+		{
+			printf("ERROR switching to %s...\n", line);
+			rv = -1;
+			continue;
+		}
+
+		total_ns = now_ns() - t0;
+
+		if (stats.cached)
+		{
+			printf("%s: already loaded, switched in %.3f ms\n", line, total_ns / 1e6);
+		}
+		else
+		{
+			printf("%s: %llu bytes at %.1f MB/s, prog_done %.3f ms, switched in %.3f ms\n", line,
+				(unsigned long long) stats.bytes, stats.bytes_per_sec / 1e6, stats.done_ns / 1e6,
+				total_ns / 1e6);
+		}
+	}
+
+	if (zynq_slots_close(slots) != 0)
+	{
+		rv = -1;
+	}
+
+	return rv != 0;
+}
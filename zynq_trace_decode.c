@@ -0,0 +1,93 @@
+/**********************************************************
+ *
+ *  Decoder for register access traces written by
+ *  zynq_trace_dump() or the trace signal handler.
+ *
+ *  Usage: zynq_trace_decode.exe trace_file
+ *
+ **********************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "include/ZYNQ_trace.h"
+
+int main(int argc, char **argv)
+{
+	FILE *fp;
+
+	zynq_trace_hdr_t hdr;
+
+	zynq_trace_rec_t rec;
+
+	uint64_t first_ns = 0;
+
+	uint64_t prev_ns = 0;
+
+	uint32_t i;
+
+	uint32_t writes = 0;
+
+	if (argc != 2)
+	{
+		printf("Usage: %s trace_file\n", argv[0]);
+		return 1;
+	}
+
+	if ( (fp = fopen(argv[1], "rb")) == NULL)
+	{
+		printf("ERROR opening %s...\n", argv[1]);
+		return 1;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != TRACE_MAGIC)
+	{
+		printf("ERROR %s is not a trace file...\n", argv[1]);
+		fclose(fp);
+		return 1;
+	}
+
+	if (hdr.version != TRACE_VERSION || hdr.rec_size != sizeof(rec))
+	{
+		printf("ERROR unsupported trace version=%d, rec_size=%d...\n", hdr.version, hdr.rec_size);
+		fclose(fp);
+		return 1;
+	}
+
+	printf("# %u records, %u older records lost\n", hdr.count, hdr.lost);
+	printf("# %14s %10s  op  reg  offset ch  value\n", "time_us", "delta_us");
+
+	for (i = 0; i < hdr.count; i++)
+	{
+		if (fread(&rec, sizeof(rec), 1, fp) != 1)
+		{
+			printf("ERROR trace truncated after %u records...\n", i);
+			fclose(fp);
+			return 1;
+		}
+
+		if (i == 0)
+		{
+			first_ns = rec.ts_ns;
+			prev_ns = rec.ts_ns;
+		}
+
+		printf("%16.3f %10.3f  %s  %s  %6u %2u  0x%8.8x\n",
+			(rec.ts_ns - first_ns) / 1e3, (rec.ts_ns - prev_ns) / 1e3,
+			rec.flags & TRACE_WRITE ? "W" : "R",
+			rec.flags & TRACE_TRI ? "TRI" : "DAT",
+			rec.offset, rec.chan + 1, rec.value);
+
+		writes += (rec.flags & TRACE_WRITE) != 0;
+		prev_ns = rec.ts_ns;
+	}
+
+	printf("# %u writes, %u reads over %.3f us\n", writes, hdr.count - writes,
+		(prev_ns - first_ns) / 1e3);
+
+	fclose(fp);
+
+	return 0;
+}